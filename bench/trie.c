@@ -0,0 +1,193 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Memory and lookup time of the domains automaton layouts.
+ *
+ * Usage: trieBench [domains count] [lookups count]
+ *
+ * Domains are random labels under a few popular TLDs, the lookups
+ * are SNIs of which every fourth ends with a listed domain.
+ * The bruteforce search runs over 64 KiB of random bytes, the size
+ * of a GSO packet, with the prefilter and without it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trie.h"
+
+#define BENCH_NAME_MAX 64
+#define BENCH_PAYLOAD_LEN 65536
+#define BENCH_PAYLOADS 64
+
+static const char *tlds[] = {"com", "net", "org", "ru", "io", "googlevideo.com"};
+
+static uint32_t rnd_state = 2463534242u;
+
+// xorshift32, the same sequence on every run
+static uint32_t rnd(void) {
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static int random_domain(char *buf) {
+	int len = 3 + rnd() % 14;
+
+	for (int i = 0; i < len; i++) {
+		uint32_t r = rnd() % 37;
+		buf[i] = r < 26 ? 'a' + r : r < 36 ? '0' + r - 26 : '-';
+	}
+
+	return len + sprintf(buf + len, ".%s",
+		tlds[rnd() % (sizeof(tlds) / sizeof(*tlds))]);
+}
+
+static double now_sec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_layout(const char *domains, const int *lens, int n,
+			 const char *sni, const int *sni_lens, int lookups,
+			 const uint8_t *payload, int layout, const char *name) {
+	struct trie_container trie;
+	size_t offset, offlen;
+	size_t builder_size;
+	double start, elapsed;
+	int matches = 0;
+	int ret;
+
+	if (trie_init(&trie) < 0) {
+		printf("%-8s init failed\n", name);
+		return;
+	}
+
+	for (int i = 0; i < n; i++) {
+		trie_add_string(&trie,
+			(const uint8_t *)domains + i * BENCH_NAME_MAX, lens[i]);
+	}
+	builder_size = trie_memsize(&trie);
+
+	start = now_sec();
+	ret = trie_finalize(&trie, layout);
+	elapsed = now_sec() - start;
+	if (ret < 0) {
+		printf("%-8s %zu vertices: finalize failed: %s\n",
+			name, trie.sz, strerror(-ret));
+		trie_destroy(&trie);
+		return;
+	}
+
+	printf("%-8s %zu vertices, builder %zu KiB, automaton %zu KiB "
+		"(%.1f B/vertex), finalized in %.1f ms\n",
+		name, trie.sz, builder_size >> 10, trie_memsize(&trie) >> 10,
+		(double)trie_memsize(&trie) / trie.sz, elapsed * 1e3);
+
+	start = now_sec();
+	for (int i = 0; i < lookups; i++) {
+		matches += trie_process_str(&trie,
+			(const uint8_t *)sni + i * BENCH_NAME_MAX, sni_lens[i],
+			TRIE_OPT_MAP_TO_END, &offset, &offlen);
+	}
+	elapsed = now_sec() - start;
+
+	printf("%-8s %d lookups, %d matched, %.1f ns/lookup\n",
+		name, lookups, matches, elapsed * 1e9 / lookups);
+
+	for (int flags = 0; flags <= TRIE_OPT_PREFILTER; flags += TRIE_OPT_PREFILTER) {
+		matches = 0;
+		start = now_sec();
+		for (int i = 0; i < BENCH_PAYLOADS; i++) {
+			matches += trie_process_str(&trie, payload,
+				BENCH_PAYLOAD_LEN, flags, &offset, &offlen);
+		}
+		elapsed = now_sec() - start;
+
+		printf("%-8s bruteforce%s, %d matched, %.1f us/64 KiB\n",
+			name, flags ? " with prefilter" : "", matches,
+			elapsed * 1e6 / BENCH_PAYLOADS);
+	}
+
+	trie_destroy(&trie);
+}
+
+int main(int argc, const char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 2000;
+	int lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+	char *domains, *sni;
+	int *lens, *sni_lens;
+	uint8_t *payload;
+
+	if (n <= 0 || lookups <= 0) {
+		fprintf(stderr, "Usage: %s [domains count] [lookups count]\n", argv[0]);
+		return 1;
+	}
+
+	domains = malloc((size_t)n * BENCH_NAME_MAX);
+	lens = malloc(sizeof(int) * n);
+	sni = malloc((size_t)lookups * BENCH_NAME_MAX);
+	sni_lens = malloc(sizeof(int) * lookups);
+	payload = malloc(BENCH_PAYLOAD_LEN);
+	if (!domains || !lens || !sni || !sni_lens || !payload) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		lens[i] = random_domain(domains + i * BENCH_NAME_MAX);
+	}
+
+	for (int i = 0; i < lookups; i++) {
+		char *s = sni + i * BENCH_NAME_MAX;
+
+		if (i % 4 == 0) {
+			int d = rnd() % n;
+			sni_lens[i] = sprintf(s, "www.%.*s", lens[d],
+				domains + d * BENCH_NAME_MAX);
+		} else {
+			sni_lens[i] = random_domain(s);
+		}
+	}
+
+	for (int i = 0; i < BENCH_PAYLOAD_LEN; i++) {
+		payload[i] = rnd();
+	}
+
+	printf("%d domains\n", n);
+	bench_layout(domains, lens, n, sni, sni_lens, lookups,
+		payload, TRIE_LAYOUT_FULL, "full");
+	bench_layout(domains, lens, n, sni, sni_lens, lookups,
+		payload, TRIE_LAYOUT_COMPACT, "compact");
+
+	free(domains);
+	free(lens);
+	free(sni);
+	free(sni_lens);
+	free(payload);
+
+	return 0;
+}
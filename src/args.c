@@ -26,6 +26,10 @@
 #include "getopt.h"
 #include "raw_replacements.h"
 
+#ifndef KERNEL_SPACE
+#include <unistd.h>
+#endif
+
 struct statistics_data global_stats;
 
 /**
@@ -96,6 +100,66 @@ close_file:
 	fclose(fd);	
 	return ret;
 }
+
+/**
+ * Parses cpu list like 0-3,8,10-11 into the array of cpu numbers.
+ */
+static int parse_cpu_list(const char *str, int **cpusp, int *cpus_len) {
+	int *cpus = NULL;
+	int len = 0;
+	const char *p = str;
+	char *endp;
+
+	while (*p != '\0') {
+		long cpu1, cpu2;
+
+		errno = 0;
+		cpu1 = strtol(p, &endp, 10);
+		if (errno != 0 || endp == p)
+			goto erret;
+		cpu2 = cpu1;
+		p = endp;
+
+		if (*p == '-') {
+			p++;
+			cpu2 = strtol(p, &endp, 10);
+			if (errno != 0 || endp == p)
+				goto erret;
+			p = endp;
+		}
+
+		if (cpu1 < 0 || cpu2 >= MAX_CPUS || cpu2 < cpu1)
+			goto erret;
+
+		if (*p == ',') {
+			p++;
+		} else if (*p != '\0') {
+			goto erret;
+		}
+
+		int *ncpus = realloc(cpus, (len + cpu2 - cpu1 + 1) * sizeof(int));
+		if (ncpus == NULL) {
+			free(cpus);
+			return -ENOMEM;
+		}
+		cpus = ncpus;
+
+		for (long cpu = cpu1; cpu <= cpu2; cpu++) {
+			cpus[len++] = cpu;
+		}
+	}
+
+	if (len == 0)
+		goto erret;
+
+	*cpusp = cpus;
+	*cpus_len = len;
+	return 0;
+
+erret:
+	free(cpus);
+	return -EINVAL;
+}
 #endif
 
 static int parse_sni_domains(struct trie_container *trie, const char *domains_str, size_t domains_strlen) {
@@ -136,6 +200,79 @@ static int parse_sni_domains(struct trie_container *trie, const char *domains_st
 	return 0;
 }
 
+static int init_config_unfinalized(struct config_t *config);
+
+static int suffix_set_add_cb(void *set, const uint8_t *str, size_t strlen) {
+	return suffix_set_add(set, str, strlen);
+}
+
+/**
+ * Copies the domains of the not finalized trie to the suffix set.
+ */
+static int build_sni_suffixes(struct suffix_set *set,
+			      const struct trie_container *trie) {
+	int ret;
+
+	if (trie->nodes == NULL) {
+		return 0;
+	}
+
+	suffix_set_destroy(set);
+	ret = suffix_set_init(set);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return trie_foreach_string(trie, suffix_set_add_cb, set);
+}
+
+/**
+ * Builds the domains automatons of all the sections
+ * when the layout and the matchers are known.
+ */
+static int finalize_sni_domains(struct config_t *config) {
+	int ret;
+
+	ITER_CONFIG_SECTIONS(config, section) {
+		if (section->sni_matcher == SNI_MATCHER_SUFFIX) {
+			ret = build_sni_suffixes(&section->sni_suffixes,
+				&section->sni_domains);
+			if (ret == 0) {
+				ret = build_sni_suffixes(&section->exclude_sni_suffixes,
+					&section->exclude_sni_domains);
+			}
+
+			if (ret < 0) {
+				lgerror(ret, "build_sni_suffixes");
+				return ret;
+			}
+
+			trie_destroy(&section->exclude_sni_domains);
+			// Bruteforce still looks for the domains over the payload
+			if (section->sni_detection != SNI_DETECTION_BRUTE) {
+				trie_destroy(&section->sni_domains);
+			}
+		}
+
+		ret = trie_finalize(&section->sni_domains, config->trie_layout);
+		if (ret == 0) {
+			ret = trie_finalize(&section->exclude_sni_domains,
+				config->trie_layout);
+		}
+
+		if (ret == -E2BIG) {
+			lgerr("Domains of section #%d are too many for the full trie layout, use --trie-layout=compact",
+				CONFIG_SECTION_NUMBER(section));
+			return ret;
+		} else if (ret < 0) {
+			lgerror(ret, "trie_finalize");
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 static void free_sni_domains(struct trie_container *trie) {
 	trie_destroy(trie);
 }
@@ -375,6 +512,7 @@ enum {
 	OPT_INSTAFLUSH,
 	OPT_QUIC_DROP,
 	OPT_SNI_DETECTION,
+	OPT_SNI_MATCHER,
 	OPT_NO_IPV6,
 	OPT_FAKE_SEQ_OFFSET,
 	OPT_PACKET_MARK,
@@ -386,6 +524,28 @@ enum {
 	OPT_SILENT,
 	OPT_NO_GSO,
 	OPT_USE_CONNTRACK,
+	OPT_BATCH_VERDICTS,
+	OPT_RECV_BATCH,
+	OPT_CPU_AFFINITY,
+	OPT_SCHED_FIFO,
+	OPT_MLOCKALL,
+	OPT_IO_URING,
+	OPT_QUEUE_MAXLEN,
+	OPT_QUEUE_RCVBUF,
+	OPT_QUEUE_DROP_STATS,
+	OPT_CONNMARK_OFFLOAD,
+	OPT_NFT_RULES,
+	OPT_NFT_LEARN_TARGETS,
+	OPT_NFT_TARGETS_ONLY,
+	OPT_DNS_QUEUE_NUM,
+	OPT_VERDICT_CACHE_TTL,
+	OPT_SHED_LATENCY_BUDGET,
+	OPT_TRIE_LAYOUT,
+	OPT_BPF_PREFILTER,
+	OPT_BPF_PREFILTER_MARK,
+	OPT_RAW_BACKEND,
+	OPT_TX_IFACE,
+	OPT_QDISC_BYPASS,
 	OPT_QUEUE_NUM,
 	OPT_UDP_MODE,
 	OPT_UDP_FAKE_SEQ_LEN,
@@ -432,6 +592,7 @@ static struct option long_opt[] = {
 	{"fk-winsize",		1, 0, OPT_FK_WINSIZE},
 	{"quic-drop",		0, 0, OPT_QUIC_DROP},
 	{"sni-detection",	1, 0, OPT_SNI_DETECTION},
+	{"sni-matcher",		1, 0, OPT_SNI_MATCHER},
 	{"seg2delay",		1, 0, OPT_SEG2DELAY},
 	{"udp-mode",		1, 0, OPT_UDP_MODE},
 	{"udp-fake-seq-len",	1, 0, OPT_UDP_FAKE_SEQ_LEN},
@@ -449,6 +610,28 @@ static struct option long_opt[] = {
 	{"instaflush",		0, 0, OPT_INSTAFLUSH},
 	{"no-gso",		0, 0, OPT_NO_GSO},
 	{"use-conntrack",	0, 0, OPT_USE_CONNTRACK},
+	{"batch-verdicts",	0, 0, OPT_BATCH_VERDICTS},
+	{"recv-batch",		1, 0, OPT_RECV_BATCH},
+	{"cpu-affinity",	1, 0, OPT_CPU_AFFINITY},
+	{"sched-fifo",		1, 0, OPT_SCHED_FIFO},
+	{"mlockall",		0, 0, OPT_MLOCKALL},
+	{"io-uring",		0, 0, OPT_IO_URING},
+	{"queue-maxlen",	1, 0, OPT_QUEUE_MAXLEN},
+	{"queue-rcvbuf",	1, 0, OPT_QUEUE_RCVBUF},
+	{"queue-drop-stats",	0, 0, OPT_QUEUE_DROP_STATS},
+	{"connmark-offload",	1, 0, OPT_CONNMARK_OFFLOAD},
+	{"nft-rules",		0, 0, OPT_NFT_RULES},
+	{"nft-learn-targets",	1, 0, OPT_NFT_LEARN_TARGETS},
+	{"nft-targets-only",	0, 0, OPT_NFT_TARGETS_ONLY},
+	{"dns-queue-num",	1, 0, OPT_DNS_QUEUE_NUM},
+	{"verdict-cache-ttl",	1, 0, OPT_VERDICT_CACHE_TTL},
+	{"shed-latency-budget",	1, 0, OPT_SHED_LATENCY_BUDGET},
+	{"trie-layout",		1, 0, OPT_TRIE_LAYOUT},
+	{"bpf-prefilter",	1, 0, OPT_BPF_PREFILTER},
+	{"bpf-prefilter-mark",	1, 0, OPT_BPF_PREFILTER_MARK},
+	{"raw-backend",		1, 0, OPT_RAW_BACKEND},
+	{"tx-iface",		1, 0, OPT_TX_IFACE},
+	{"qdisc-bypass",	0, 0, OPT_QDISC_BYPASS},
 	{"no-ipv6",		0, 0, OPT_NO_IPV6},
 	{"daemonize",		0, 0, OPT_DAEMONIZE},
 	{"noclose",		0, 0, OPT_NOCLOSE},
@@ -505,6 +688,7 @@ void print_usage(const char *argv0) {
 	printf("\t--fk-winsize=<winsize>\n");
 	printf("\t--quic-drop\n");
 	printf("\t--sni-detection={parse|brute}\n");
+	printf("\t--sni-matcher={trie|suffix}\n");
 	printf("\t--seg2delay=<delay>\n");
 	printf("\t--udp-mode={drop|fake}\n");
 	printf("\t--udp-fake-seq-len=<amount of faking packets sent>\n");
@@ -514,7 +698,7 @@ void print_usage(const char *argv0) {
 	printf("\t--udp-stun-filter\n");
 	printf("\t--udp-filter-quic={disabled|all|parse}\n");
 	printf("\t--no-dport-filter\n");
-	printf("\t--threads=<threads number>\n");
+	printf("\t--threads={<threads number>|auto}\n");
 	printf("\t--packet-mark=<mark>\n");
 	printf("\t--connbytes-limit=<pkts>\n");
 	printf("\t--tcp-match-connpackets=<n of packets in connection>\n");
@@ -524,6 +708,28 @@ void print_usage(const char *argv0) {
 	printf("\t--instaflush\n");
 	printf("\t--no-gso\n");
 	printf("\t--no-conntrack\n");
+	printf("\t--batch-verdicts\n");
+	printf("\t--recv-batch=<messages number>\n");
+	printf("\t--cpu-affinity=<cpu list>\n");
+	printf("\t--sched-fifo=<priority>\n");
+	printf("\t--mlockall\n");
+	printf("\t--io-uring\n");
+	printf("\t--queue-maxlen=<packets>\n");
+	printf("\t--queue-rcvbuf=<bytes>\n");
+	printf("\t--queue-drop-stats\n");
+	printf("\t--connmark-offload=<mark>\n");
+	printf("\t--nft-rules\n");
+	printf("\t--nft-learn-targets=<seconds>\n");
+	printf("\t--nft-targets-only\n");
+	printf("\t--dns-queue-num=<num>\n");
+	printf("\t--verdict-cache-ttl=<seconds>\n");
+	printf("\t--shed-latency-budget=<usec>\n");
+	printf("\t--trie-layout={full|compact}\n");
+	printf("\t--bpf-prefilter=<interface>\n");
+	printf("\t--bpf-prefilter-mark=<mark>\n");
+	printf("\t--raw-backend={socket|packet}\n");
+	printf("\t--tx-iface=<interface>\n");
+	printf("\t--qdisc-bypass\n");
 	printf("\t--no-ipv6\n");
 	printf("\t--daemonize\n");
 	printf("\t--noclose\n");
@@ -540,7 +746,7 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 	long num;
 	int ret;
 
-	ret = init_config(config);
+	ret = init_config_unfinalized(config);
 	if (ret < 0) 
 		return ret;
 	struct section_config_t *default_section = config->last_section;
@@ -559,7 +765,7 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 		switch (opt) {
 		case OPT_CLS:
 			free_config(config);
-			ret = init_config(config);
+			ret = init_config_unfinalized(config);
 			if (ret < 0) 
 				return ret;
 			default_section = config->last_section;
@@ -609,6 +815,257 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 #else
 			lgerr("Conntrack is enabled by default in kernel space. If you want to disable it, compile with make kmake EXTRA_CFLAGS=\"-DNO_CONNTRACK\"." );
 			goto invalid_opt;
+#endif
+			break;
+		case OPT_BATCH_VERDICTS:
+#ifndef KERNEL_SPACE
+			config->batch_verdicts = 1;
+#else
+			lgerr("--batch-verdicts is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_RECV_BATCH:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > MAX_RECV_BATCH) {
+				goto invalid_opt;
+			}
+
+			config->recv_batch = num;
+#else
+			lgerr("--recv-batch is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_CPU_AFFINITY:
+#ifndef KERNEL_SPACE
+			free(config->cpu_affinity);
+			config->cpu_affinity = NULL;
+			config->cpu_affinity_len = 0;
+
+			if (parse_cpu_list(optarg, &config->cpu_affinity,
+				&config->cpu_affinity_len) < 0) {
+				goto invalid_opt;
+			}
+#else
+			lgerr("--cpu-affinity is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_SCHED_FIFO:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > 99) {
+				goto invalid_opt;
+			}
+
+			config->sched_fifo_prio = num;
+#else
+			lgerr("--sched-fifo is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_MLOCKALL:
+#ifndef KERNEL_SPACE
+			config->mlockall = 1;
+#else
+			lgerr("--mlockall is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_IO_URING:
+#if defined(KERNEL_SPACE)
+			lgerr("--io-uring is not supported in kernel space");
+			goto invalid_opt;
+#elif !defined(USE_IO_URING)
+			lgerr("--io-uring is not compiled in, rebuild with make USE_IO_URING=yes");
+			goto invalid_opt;
+#else
+			config->io_uring = 1;
+#endif
+			break;
+		case OPT_QUEUE_MAXLEN:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > UINT32_MAX) {
+				goto invalid_opt;
+			}
+
+			config->queue_maxlen = num;
+#else
+			lgerr("--queue-maxlen is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_QUEUE_RCVBUF:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > INT32_MAX / 2) {
+				goto invalid_opt;
+			}
+
+			config->queue_rcvbuf = num;
+#else
+			lgerr("--queue-rcvbuf is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_QUEUE_DROP_STATS:
+#ifndef KERNEL_SPACE
+			config->queue_drop_stats = 1;
+#else
+			lgerr("--queue-drop-stats is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_CONNMARK_OFFLOAD:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > UINT32_MAX) {
+				goto invalid_opt;
+			}
+
+			config->connmark_offload = num;
+#else
+			lgerr("--connmark-offload is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_NFT_RULES:
+#ifndef KERNEL_SPACE
+			config->nft_rules = 1;
+#else
+			lgerr("--nft-rules is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_NFT_LEARN_TARGETS:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > UINT32_MAX / 1000) {
+				goto invalid_opt;
+			}
+
+			config->nft_learn_timeout = num;
+#else
+			lgerr("--nft-learn-targets is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_NFT_TARGETS_ONLY:
+#ifndef KERNEL_SPACE
+			config->nft_targets_only = 1;
+#else
+			lgerr("--nft-targets-only is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_DNS_QUEUE_NUM:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 0 || num > MAX_QUEUE_NUM) {
+				goto invalid_opt;
+			}
+
+			config->dns_queue_num = num;
+#else
+			lgerr("--dns-queue-num is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_VERDICT_CACHE_TTL:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 0 || num > 86400) {
+				goto invalid_opt;
+			}
+
+			config->verdict_cache_ttl = num;
+#else
+			lgerr("--verdict-cache-ttl is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_SHED_LATENCY_BUDGET:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 0 || num > 1000000) {
+				goto invalid_opt;
+			}
+
+			config->shed_latency_budget = num;
+#else
+			lgerr("--shed-latency-budget is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_TRIE_LAYOUT:
+			if (strcmp(optarg, "full") == 0) {
+				config->trie_layout = TRIE_LAYOUT_FULL;
+			} else if (strcmp(optarg, "compact") == 0) {
+				config->trie_layout = TRIE_LAYOUT_COMPACT;
+			} else {
+				goto invalid_opt;
+			}
+			break;
+		case OPT_BPF_PREFILTER:
+#ifndef KERNEL_SPACE
+			if (strlen(optarg) == 0 || strlen(optarg) >= MAX_IFNAME_LEN) {
+				goto invalid_opt;
+			}
+
+			strcpy(config->bpf_prefilter_iface, optarg);
+#else
+			lgerr("--bpf-prefilter is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_BPF_PREFILTER_MARK:
+#ifndef KERNEL_SPACE
+			num = parse_numeric_option(optarg);
+			if (errno != 0 || num < 1 || num > UINT32_MAX) {
+				goto invalid_opt;
+			}
+
+			config->bpf_prefilter_mark = num;
+#else
+			lgerr("--bpf-prefilter-mark is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_RAW_BACKEND:
+#ifndef KERNEL_SPACE
+			if (strcmp(optarg, "socket") == 0) {
+				config->raw_backend = RAW_BACKEND_SOCKET;
+			} else if (strcmp(optarg, "packet") == 0) {
+				config->raw_backend = RAW_BACKEND_PACKET;
+			} else {
+				goto invalid_opt;
+			}
+#else
+			lgerr("--raw-backend is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_TX_IFACE:
+#ifndef KERNEL_SPACE
+			if (strlen(optarg) == 0 || strlen(optarg) >= MAX_IFNAME_LEN) {
+				goto invalid_opt;
+			}
+
+			strcpy(config->tx_iface, optarg);
+#else
+			lgerr("--tx-iface is not supported in kernel space");
+			goto invalid_opt;
+#endif
+			break;
+		case OPT_QDISC_BYPASS:
+#ifndef KERNEL_SPACE
+			config->qdisc_bypass = 1;
+#else
+			lgerr("--qdisc-bypass is not supported in kernel space");
+			goto invalid_opt;
 #endif
 			break;
 		case OPT_NO_IPV6:
@@ -632,8 +1089,20 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 			config->syslog = 1;
 			break;
 		case OPT_THREADS:
+#ifndef KERNEL_SPACE
+			if (strcmp(optarg, "auto") == 0) {
+				num = sysconf(_SC_NPROCESSORS_ONLN);
+				if (num < 1) {
+					lgerror(-errno, "Unable to get online CPU count");
+					goto invalid_opt;
+				}
+
+				config->threads = num;
+				break;
+			}
+#endif
 			num = parse_numeric_option(optarg);
-			if (errno != 0 || num < 0 || num > MAX_THREADS) {
+			if (errno != 0 || num < 1 || num > MAX_QUEUE_NUM + 1) {
 				goto invalid_opt;
 			}
 
@@ -962,6 +1431,16 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 				goto invalid_opt;
 			}
 
+			break;
+		case OPT_SNI_MATCHER:
+			if (strcmp(optarg, "trie") == 0) {
+				sect_config->sni_matcher = SNI_MATCHER_TRIE;
+			} else if (strcmp(optarg, "suffix") == 0) {
+				sect_config->sni_matcher = SNI_MATCHER_SUFFIX;
+			} else {
+				goto invalid_opt;
+			}
+
 			break;
 		case OPT_SYNFAKE:
 			if (strcmp(optarg, "1") == 0) {
@@ -1047,6 +1526,91 @@ int yparse_args(struct config_t *config, int argc, char *argv[]) {
 
 	}
 
+	ret = finalize_sni_domains(config);
+	if (ret < 0) {
+		errno = -ret;
+		goto error;
+	}
+
+#ifndef KERNEL_SPACE
+	if (config->queue_start_num + config->threads - 1 > MAX_QUEUE_NUM) {
+		lgerr("Queues %d-%d are out of range: the maximum queue number is %d",
+			config->queue_start_num,
+			config->queue_start_num + config->threads - 1,
+			MAX_QUEUE_NUM);
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->connmark_offload && !config->use_conntrack) {
+		lgerr("--connmark-offload requires --use-conntrack");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->nft_learn_timeout && !config->nft_rules) {
+		lgerr("--nft-learn-targets requires --nft-rules");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->nft_targets_only && !config->nft_learn_timeout) {
+		lgerr("--nft-targets-only requires --nft-learn-targets");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	// Nothing else fills the targets sets when only the targets are queued
+	if (config->nft_targets_only && config->dns_queue_num < 0) {
+		lgerr("--nft-targets-only requires --dns-queue-num");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->dns_queue_num >= 0 && !config->nft_learn_timeout) {
+		lgerr("--dns-queue-num requires --nft-learn-targets");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->dns_queue_num >= (int)config->queue_start_num &&
+		config->dns_queue_num < (int)config->queue_start_num + config->threads) {
+		lgerr("--dns-queue-num must not be one of the packet queues");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->bpf_prefilter_iface[0] != '\0' &&
+		(config->bpf_prefilter_mark & config->mark)) {
+		lgerr("--bpf-prefilter-mark must not overlap --packet-mark");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->raw_backend == RAW_BACKEND_PACKET &&
+		config->tx_iface[0] == '\0') {
+		lgerr("--raw-backend=packet requires --tx-iface");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (config->qdisc_bypass && config->raw_backend != RAW_BACKEND_PACKET) {
+		lgerr("--qdisc-bypass requires --raw-backend=packet");
+		errno = EINVAL;
+		ret = -EINVAL;
+		goto error;
+	}
+#endif
+
 	errno = 0;
 	return 0;
 
@@ -1219,11 +1783,17 @@ static size_t print_config_section(const struct section_config_t *section, char
 
 	if (section->all_domains) {
 		print_cnf_buf("--sni-domains=all");
-	} else if (section->sni_domains.vx != NULL) {
+	} else if (section->sni_matcher == SNI_MATCHER_SUFFIX) {
+		print_cnf_buf("--sni-domains=<%zu suffixes>", section->sni_suffixes.len);
+	} else if (section->sni_domains.finalized) {
 		print_cnf_buf("--sni-domains=<trie of %zu vertexes>", section->sni_domains.sz);
 	}
-	if (section->exclude_sni_domains.vx != NULL) {
-		print_cnf_buf("--exclude-domains=<trie of %zu vertexes>", section->sni_domains.sz);
+	if (section->sni_matcher == SNI_MATCHER_SUFFIX) {
+		if (section->exclude_sni_suffixes.len != 0) {
+			print_cnf_buf("--exclude-domains=<%zu suffixes>", section->exclude_sni_suffixes.len);
+		}
+	} else if (section->exclude_sni_domains.finalized) {
+		print_cnf_buf("--exclude-domains=<trie of %zu vertexes>", section->exclude_sni_domains.sz);
 	}
 
 	switch(section->sni_detection) {
@@ -1236,6 +1806,10 @@ static size_t print_config_section(const struct section_config_t *section, char
 
 	}
 
+	if (section->sni_matcher == SNI_MATCHER_SUFFIX) {
+		print_cnf_buf("--sni-matcher=suffix");
+	}
+
 	if (section->synfake) {
 		print_cnf_buf("--synfake=1");
 		print_cnf_buf("--synfake-len=%d", section->synfake_len);
@@ -1336,6 +1910,70 @@ size_t print_config(const struct config_t *config, char *buffer, size_t buffer_s
 	if (config->use_conntrack) {
 		print_cnf_buf("--use-conntrack");
 	}
+	if (config->batch_verdicts) {
+		print_cnf_buf("--batch-verdicts");
+	}
+	if (config->recv_batch != 1) {
+		print_cnf_buf("--recv-batch=%d", config->recv_batch);
+	}
+	if (config->cpu_affinity_len != 0) {
+		print_cnf_raw("--cpu-affinity=");
+		for (int i = 0; i < config->cpu_affinity_len; i++) {
+			print_cnf_raw("%s%d", i == 0 ? "" : ",",
+				config->cpu_affinity[i]);
+		}
+		print_cnf_raw(" ");
+	}
+	if (config->sched_fifo_prio != 0) {
+		print_cnf_buf("--sched-fifo=%d", config->sched_fifo_prio);
+	}
+	if (config->mlockall) {
+		print_cnf_buf("--mlockall");
+	}
+	if (config->io_uring) {
+		print_cnf_buf("--io-uring");
+	}
+	if (config->queue_maxlen) {
+		print_cnf_buf("--queue-maxlen=%u", config->queue_maxlen);
+	}
+	if (config->queue_rcvbuf) {
+		print_cnf_buf("--queue-rcvbuf=%d", config->queue_rcvbuf);
+	}
+	if (config->queue_drop_stats) {
+		print_cnf_buf("--queue-drop-stats");
+	}
+	if (config->connmark_offload) {
+		print_cnf_buf("--connmark-offload=%u", config->connmark_offload);
+	}
+	if (config->nft_rules) {
+		print_cnf_buf("--nft-rules");
+	}
+	if (config->nft_learn_timeout) {
+		print_cnf_buf("--nft-learn-targets=%u", config->nft_learn_timeout);
+	}
+	if (config->nft_targets_only) {
+		print_cnf_buf("--nft-targets-only");
+	}
+	if (config->dns_queue_num >= 0) {
+		print_cnf_buf("--dns-queue-num=%d", config->dns_queue_num);
+	}
+	if (config->verdict_cache_ttl) {
+		print_cnf_buf("--verdict-cache-ttl=%u", config->verdict_cache_ttl);
+	}
+	if (config->shed_latency_budget) {
+		print_cnf_buf("--shed-latency-budget=%u", config->shed_latency_budget);
+	}
+	if (config->bpf_prefilter_iface[0] != '\0') {
+		print_cnf_buf("--bpf-prefilter=%s", config->bpf_prefilter_iface);
+		print_cnf_buf("--bpf-prefilter-mark=%u", config->bpf_prefilter_mark);
+	}
+	if (config->raw_backend == RAW_BACKEND_PACKET) {
+		print_cnf_buf("--raw-backend=packet");
+		print_cnf_buf("--tx-iface=%s", config->tx_iface);
+	}
+	if (config->qdisc_bypass) {
+		print_cnf_buf("--qdisc-bypass");
+	}
 #endif
 
 #ifdef KERNEL_SPACE
@@ -1344,6 +1982,9 @@ size_t print_config(const struct config_t *config, char *buffer, size_t buffer_s
 	if (!config->use_ipv6) {
 		print_cnf_buf("--no-ipv6");
 	}
+	if (config->trie_layout == TRIE_LAYOUT_COMPACT) {
+		print_cnf_buf("--trie-layout=compact");
+	}
 	if (config->verbose == VERBOSE_TRACE) {
 		print_cnf_buf("--trace");
 	}
@@ -1378,6 +2019,27 @@ void print_welcome(const struct config_t *config) {
 	size_t sz = print_config(config, welcome_message, 4000);
 	printf("Running with flags: %.*s\n", (int)sz, welcome_message);
 	free(welcome_message);
+
+#ifndef KERNEL_SPACE
+	if (config->threads > 1) {
+		printf("%d queue threads will be started, "
+			"use queue num %d-%d in the firewall rule\n",
+			config->threads, config->queue_start_num,
+			config->queue_start_num + config->threads - 1);
+	}
+	for (int i = 0; i < config->threads && config->cpu_affinity_len; i++) {
+		printf("Queue %d thread will be pinned to CPU %d\n",
+			config->queue_start_num + i,
+			config->cpu_affinity[i % config->cpu_affinity_len]);
+	}
+	if (config->sched_fifo_prio) {
+		printf("Queue threads will run with SCHED_FIFO priority %d\n",
+			config->sched_fifo_prio);
+	}
+	if (config->mlockall) {
+		printf("Process memory will be locked with mlockall\n");
+	}
+#endif
 }
 
 int init_section_config(struct section_config_t **section, struct section_config_t *prev) {
@@ -1407,7 +2069,10 @@ int init_section_config(struct section_config_t **section, struct section_config
 	return 0;
 }
 
-int init_config(struct config_t *config) {
+/**
+ * The domains are left open for more strings until finalize_sni_domains.
+ */
+static int init_config_unfinalized(struct config_t *config) {
 	struct config_t def_config = default_config_set;
 	int ret = 0;
 	struct section_config_t *def_section = NULL;
@@ -1422,6 +2087,22 @@ int init_config(struct config_t *config) {
 	return 0;
 }
 
+int init_config(struct config_t *config) {
+	int ret;
+
+	ret = init_config_unfinalized(config);
+	if (ret < 0)
+		return ret;
+
+	ret = finalize_sni_domains(config);
+	if (ret < 0) {
+		free_config(config);
+		return ret;
+	}
+
+	return 0;
+}
+
 void free_config_section(struct section_config_t *section) {
 	if (section->udp_dport_range_len != 0) {
 		SFREE(section->udp_dport_range);
@@ -1433,6 +2114,8 @@ void free_config_section(struct section_config_t *section) {
 
 	free_sni_domains(&section->sni_domains);
 	free_sni_domains(&section->exclude_sni_domains);
+	suffix_set_destroy(&section->sni_suffixes);
+	suffix_set_destroy(&section->exclude_sni_suffixes);
 
 	section->fake_custom_pkt_sz = 0;
 	SFREE(section->fake_custom_pkt);
@@ -1446,4 +2129,10 @@ void free_config(struct config_t *config) {
 		free_config_section(sct);
 		sct = psct;
 	}
+
+#ifndef KERNEL_SPACE
+	free(config->cpu_affinity);
+	config->cpu_affinity = NULL;
+	config->cpu_affinity_len = 0;
+#endif
 }
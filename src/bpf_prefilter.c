@@ -0,0 +1,397 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef KERNEL_SPACE
+#error "The BPF prefilter is userspace only"
+#endif
+
+#include "bpf_prefilter.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+#include <libmnl/libmnl.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
+
+#define BPF_PREFILTER_HANDLE 1
+#define BPF_PREFILTER_NAME "youtubeUnblock"
+
+// Enough for the headers the program looks at
+#define BPF_STACK_BUF 40
+
+#define BPF_MAX_INSNS 128
+
+// TLS record: handshake type, version major, ..., handshake message type
+#define TLS_CONTENT_TYPE_HANDSHAKE 0x16
+#define TLS_HANDSHAKE_CLIENT_HELLO 0x01
+// QUIC long header form and fixed bits
+#define QUIC_LONG_HEADER_MASK 0xc0
+
+enum bpf_label {
+	L_IP4,
+	L_IP6,
+	L_L4,
+	L_TCP,
+	L_UDP,
+	L_MARK,
+	L_OUT,
+	L_MAX,
+};
+
+/**
+ * Tiny assembler with forward jumps to labels.
+ */
+struct bpf_asm {
+	struct bpf_insn insns[BPF_MAX_INSNS];
+	int len;
+	int labels[L_MAX];
+	// Label of the jump at the same index, -1 for other instructions
+	int jmp_labels[BPF_MAX_INSNS];
+};
+
+static void emit(struct bpf_asm *a, uint8_t code, uint8_t dst, uint8_t src,
+		 int16_t off, int32_t imm) {
+	a->jmp_labels[a->len] = -1;
+	a->insns[a->len++] = (struct bpf_insn){
+		.code = code,
+		.dst_reg = dst,
+		.src_reg = src,
+		.off = off,
+		.imm = imm,
+	};
+}
+
+static void emit_jmp(struct bpf_asm *a, uint8_t op, uint8_t dst,
+		     int32_t imm, enum bpf_label label) {
+	emit(a, BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+	a->jmp_labels[a->len - 1] = label;
+}
+
+static void emit_label(struct bpf_asm *a, enum bpf_label label) {
+	a->labels[label] = a->len;
+}
+
+static void bpf_asm_resolve(struct bpf_asm *a) {
+	for (int i = 0; i < a->len; i++) {
+		if (a->jmp_labels[i] >= 0)
+			a->insns[i].off = a->labels[a->jmp_labels[i]] - i - 1;
+	}
+}
+
+#define mov_imm(a, dst, imm)	emit(a, BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm)
+#define mov_reg(a, dst, src)	emit(a, BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define alu_imm(a, op, dst, imm)	emit(a, BPF_ALU64 | (op) | BPF_K, dst, 0, 0, imm)
+#define alu_reg(a, op, dst, src)	emit(a, BPF_ALU64 | (op) | BPF_X, dst, src, 0, 0)
+#define ldx(a, size, dst, src, off)	emit(a, BPF_LDX | BPF_MEM | (size), dst, src, off, 0)
+#define stx(a, size, dst, src, off)	emit(a, BPF_STX | BPF_MEM | (size), dst, src, off, 0)
+#define jmp(a, label)		emit_jmp(a, BPF_JA, 0, 0, label)
+
+// Stack buffer offset and its byte
+#define STK (-BPF_STACK_BUF)
+#define STK_B(i) (STK + (i))
+
+/**
+ * r0 = skb_load_bytes_relative(ctx, off, fp + STK, len, BPF_HDR_START_NET)
+ * Jumps out if the packet is shorter.
+ * The offset is taken from off_reg, or is 0 if off_reg is 0.
+ */
+static void emit_load(struct bpf_asm *a, int off_reg, int len) {
+	mov_reg(a, BPF_REG_1, BPF_REG_6);
+	if (off_reg) {
+		mov_reg(a, BPF_REG_2, off_reg);
+	} else {
+		mov_imm(a, BPF_REG_2, 0);
+	}
+	mov_reg(a, BPF_REG_3, BPF_REG_10);
+	alu_imm(a, BPF_ADD, BPF_REG_3, STK);
+	mov_imm(a, BPF_REG_4, len);
+	mov_imm(a, BPF_REG_5, BPF_HDR_START_NET);
+	emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_skb_load_bytes_relative);
+	emit_jmp(a, BPF_JNE, BPF_REG_0, 0, L_OUT);
+}
+
+/**
+ * r6 - context, r7 - transport header offset or payload offset,
+ * r8 - transport protocol
+ */
+static void prefilter_assemble(struct bpf_asm *a, uint32_t mark) {
+	*a = (struct bpf_asm){0};
+
+	mov_reg(a, BPF_REG_6, BPF_REG_1);
+	ldx(a, BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, protocol));
+	emit_jmp(a, BPF_JEQ, BPF_REG_2, htons(ETH_P_IP), L_IP4);
+	emit_jmp(a, BPF_JEQ, BPF_REG_2, htons(ETH_P_IPV6), L_IP6);
+	jmp(a, L_OUT);
+
+	emit_label(a, L_IP4);
+	emit_load(a, 0, 20);
+	ldx(a, BPF_B, BPF_REG_7, BPF_REG_10, STK_B(0));
+	alu_imm(a, BPF_AND, BPF_REG_7, 0x0f);
+	alu_imm(a, BPF_LSH, BPF_REG_7, 2);
+	ldx(a, BPF_B, BPF_REG_8, BPF_REG_10, STK_B(9));
+	// Only the first fragment has the transport header
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(6));
+	alu_imm(a, BPF_AND, BPF_REG_2, 0x1f);
+	ldx(a, BPF_B, BPF_REG_3, BPF_REG_10, STK_B(7));
+	alu_reg(a, BPF_OR, BPF_REG_2, BPF_REG_3);
+	emit_jmp(a, BPF_JNE, BPF_REG_2, 0, L_OUT);
+	jmp(a, L_L4);
+
+	// Extension headers are not followed
+	emit_label(a, L_IP6);
+	emit_load(a, 0, 40);
+	ldx(a, BPF_B, BPF_REG_8, BPF_REG_10, STK_B(6));
+	mov_imm(a, BPF_REG_7, 40);
+
+	emit_label(a, L_L4);
+	emit_jmp(a, BPF_JEQ, BPF_REG_8, IPPROTO_TCP, L_TCP);
+	emit_jmp(a, BPF_JEQ, BPF_REG_8, IPPROTO_UDP, L_UDP);
+	jmp(a, L_OUT);
+
+	emit_label(a, L_TCP);
+	emit_load(a, BPF_REG_7, 13);
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(12));
+	alu_imm(a, BPF_RSH, BPF_REG_2, 4);
+	alu_imm(a, BPF_LSH, BPF_REG_2, 2);
+	alu_reg(a, BPF_ADD, BPF_REG_7, BPF_REG_2);
+	// Pure ACKs have no payload and fail here
+	emit_load(a, BPF_REG_7, 6);
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(0));
+	emit_jmp(a, BPF_JNE, BPF_REG_2, TLS_CONTENT_TYPE_HANDSHAKE, L_OUT);
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(1));
+	emit_jmp(a, BPF_JNE, BPF_REG_2, 0x03, L_OUT);
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(5));
+	emit_jmp(a, BPF_JNE, BPF_REG_2, TLS_HANDSHAKE_CLIENT_HELLO, L_OUT);
+	jmp(a, L_MARK);
+
+	emit_label(a, L_UDP);
+	alu_imm(a, BPF_ADD, BPF_REG_7, 8);
+	emit_load(a, BPF_REG_7, 1);
+	ldx(a, BPF_B, BPF_REG_2, BPF_REG_10, STK_B(0));
+	alu_imm(a, BPF_AND, BPF_REG_2, QUIC_LONG_HEADER_MASK);
+	emit_jmp(a, BPF_JNE, BPF_REG_2, QUIC_LONG_HEADER_MASK, L_OUT);
+
+	emit_label(a, L_MARK);
+	ldx(a, BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, mark));
+	// 32-bit OR, so the mark is not sign extended
+	emit(a, BPF_ALU | BPF_OR | BPF_K, BPF_REG_2, 0, 0, (int32_t)mark);
+	stx(a, BPF_W, BPF_REG_6, BPF_REG_2, offsetof(struct __sk_buff, mark));
+
+	emit_label(a, L_OUT);
+	mov_imm(a, BPF_REG_0, TC_ACT_OK);
+	emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	bpf_asm_resolve(a);
+}
+
+static int prefilter_load(uint32_t mark) {
+	struct bpf_asm a;
+	union bpf_attr attr;
+	static char log_buf[65536];
+	int fd;
+
+	prefilter_assemble(&a, mark);
+
+	attr = (union bpf_attr){0};
+	attr.prog_type = BPF_PROG_TYPE_SCHED_CLS;
+	attr.insns = (uint64_t)(uintptr_t)a.insns;
+	attr.insn_cnt = a.len;
+	attr.license = (uint64_t)(uintptr_t)"GPL";
+	attr.log_buf = (uint64_t)(uintptr_t)log_buf;
+	attr.log_size = sizeof(log_buf);
+	attr.log_level = 1;
+
+	fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (fd < 0) {
+		int ret = -errno;
+		lgerror(ret, "BPF program load");
+		if (log_buf[0] != '\0') {
+			lgerr("Verifier log:\n%s", log_buf);
+		}
+		return ret;
+	}
+
+	return fd;
+}
+
+static struct nlmsghdr *tc_msg_put(char *buf, uint16_t type, uint16_t flags,
+				   int ifindex, uint32_t handle, uint32_t parent,
+				   uint32_t info, const char *kind) {
+	struct nlmsghdr *nlh = mnl_nlmsg_put_header(buf);
+	struct tcmsg *tcm;
+
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = time(NULL);
+
+	tcm = mnl_nlmsg_put_extra_header(nlh, sizeof(struct tcmsg));
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = ifindex;
+	tcm->tcm_handle = handle;
+	tcm->tcm_parent = parent;
+	tcm->tcm_info = info;
+
+	mnl_attr_put_strz(nlh, TCA_KIND, kind);
+
+	return nlh;
+}
+
+/**
+ * Sends the request and waits for the acknowledgement.
+ */
+static int rtnl_talk(struct nlmsghdr *nlh) {
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct mnl_socket *nl;
+	uint32_t portid;
+	int ret;
+
+	nl = mnl_socket_open(NETLINK_ROUTE);
+	if (nl == NULL)
+		return -errno;
+
+	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		ret = -errno;
+		goto close;
+	}
+	portid = mnl_socket_get_portid(nl);
+
+	if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
+		ret = -errno;
+		goto close;
+	}
+
+	ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
+	if (ret < 0) {
+		ret = -errno;
+		goto close;
+	}
+
+	ret = mnl_cb_run(buf, ret, nlh->nlmsg_seq, portid, NULL, NULL);
+	ret = ret < 0 ? -errno : 0;
+
+close:
+	mnl_socket_close(nl);
+	return ret;
+}
+
+#define FILTER_PARENT TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS)
+#define FILTER_INFO(proto) TC_H_MAKE((uint32_t)BPF_PREFILTER_PRIO << 16, proto)
+
+static int prefilter_ifindex = 0;
+static int prefilter_fd = -1;
+static int qdisc_created = 0;
+
+int bpf_prefilter_attach(const char *ifname, uint32_t mark) {
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct nlattr *opts;
+	int ifindex;
+	int ret;
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		ret = -errno;
+		lgerror(ret, "Interface %s", ifname);
+		return ret;
+	}
+
+	prefilter_fd = prefilter_load(mark);
+	if (prefilter_fd < 0)
+		return prefilter_fd;
+
+	nlh = tc_msg_put(buf, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+		  TC_H_MAKE(TC_H_CLSACT, 0), TC_H_CLSACT, 0, "clsact");
+	ret = rtnl_talk(nlh);
+	if (ret == 0) {
+		qdisc_created = 1;
+	} else if (ret != -EEXIST) {
+		lgerror(ret, "Unable to add clsact qdisc to %s", ifname);
+		goto close_fd;
+	}
+
+	nlh = tc_msg_put(buf, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_REPLACE,
+		  ifindex, BPF_PREFILTER_HANDLE, FILTER_PARENT,
+		  FILTER_INFO(htons(ETH_P_ALL)), "bpf");
+	opts = mnl_attr_nest_start(nlh, TCA_OPTIONS);
+	mnl_attr_put_u32(nlh, TCA_BPF_FD, prefilter_fd);
+	mnl_attr_put_strz(nlh, TCA_BPF_NAME, BPF_PREFILTER_NAME);
+	mnl_attr_put_u32(nlh, TCA_BPF_FLAGS, TCA_BPF_FLAG_ACT_DIRECT);
+	mnl_attr_nest_end(nlh, opts);
+
+	ret = rtnl_talk(nlh);
+	if (ret < 0) {
+		lgerror(ret, "Unable to attach BPF prefilter to %s", ifname);
+		goto del_qdisc;
+	}
+
+	prefilter_ifindex = ifindex;
+	return 0;
+
+del_qdisc:
+	if (qdisc_created) {
+		nlh = tc_msg_put(buf, RTM_DELQDISC, 0, ifindex,
+		   TC_H_MAKE(TC_H_CLSACT, 0), TC_H_CLSACT, 0, "clsact");
+		rtnl_talk(nlh);
+		qdisc_created = 0;
+	}
+close_fd:
+	close(prefilter_fd);
+	prefilter_fd = -1;
+	return ret;
+}
+
+void bpf_prefilter_detach(void) {
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	int ret;
+
+	if (prefilter_ifindex == 0)
+		return;
+
+	if (qdisc_created) {
+		// The filters go away with the qdisc
+		nlh = tc_msg_put(buf, RTM_DELQDISC, 0, prefilter_ifindex,
+		   TC_H_MAKE(TC_H_CLSACT, 0), TC_H_CLSACT, 0, "clsact");
+	} else {
+		nlh = tc_msg_put(buf, RTM_DELTFILTER, 0, prefilter_ifindex,
+		   BPF_PREFILTER_HANDLE, FILTER_PARENT,
+		   FILTER_INFO(htons(ETH_P_ALL)), "bpf");
+	}
+
+	if ((ret = rtnl_talk(nlh)) < 0) {
+		lgerror(ret, "Unable to detach BPF prefilter");
+	}
+
+	close(prefilter_fd);
+	prefilter_fd = -1;
+	prefilter_ifindex = 0;
+	qdisc_created = 0;
+}
@@ -0,0 +1,52 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BPF_PREFILTER_H
+#define BPF_PREFILTER_H
+
+#include "types.h"
+
+/**
+ * TC classifier that marks the packets worth to be queued:
+ * TCP segments starting with a TLS ClientHello record and
+ * UDP datagrams starting with a QUIC long header.
+ *
+ * The classifier is attached to the ingress of the interface
+ * the clients are behind, so the mark is set before netfilter
+ * and the queue rule may require it. The program is assembled
+ * in place and attached over rtnetlink, so neither clang nor
+ * libbpf are needed.
+ */
+
+// Filter priority, unique for youtubeUnblock on the interface
+#define BPF_PREFILTER_PRIO 537
+
+/**
+ * Loads the classifier setting mark and attaches it to ifname.
+ * A filter left by a killed instance is replaced.
+ */
+int bpf_prefilter_attach(const char *ifname, uint32_t mark);
+
+/**
+ * Detaches the classifier. The clsact qdisc is deleted
+ * only if it was created by bpf_prefilter_attach.
+ */
+void bpf_prefilter_detach(void);
+
+#endif /* BPF_PREFILTER_H */
@@ -26,6 +26,7 @@
 
 #include "types.h"
 #include "trie.h"
+#include "suffix_set.h"
 
 typedef int (*raw_send_t)(const unsigned char *data, size_t data_len);
 /**
@@ -34,9 +35,26 @@ typedef int (*raw_send_t)(const unsigned char *data, size_t data_len);
  */
 typedef int (*delayed_send_t)(const unsigned char *data, size_t data_len, unsigned int delay_ms);
 
+/**
+ * Raw packets sent between begin_raw_batch and flush_raw_batch may be
+ * queued by send_raw_packet and put to the network all together on flush.
+ * Both hooks are optional.
+ */
+typedef void (*raw_batch_begin_t)(void);
+typedef int (*raw_batch_flush_t)(void);
+
+/**
+ * Returns the MTU towards the destination of the packet.
+ * Optional, AVAILABLE_MTU is used without it.
+ */
+typedef size_t (*path_mtu_t)(const unsigned char *data, size_t data_len);
+
 struct instance_config_t {
 	raw_send_t send_raw_packet;
 	delayed_send_t send_delayed_packet;
+	raw_batch_begin_t begin_raw_batch;
+	raw_batch_flush_t flush_raw_batch;
+	path_mtu_t path_mtu;
 };
 extern struct instance_config_t instance_config;
 
@@ -60,6 +78,9 @@ struct section_config_t {
 
 	struct trie_container sni_domains;
 	struct trie_container exclude_sni_domains;
+	// Built from the tries above with SNI_MATCHER_SUFFIX
+	struct suffix_set sni_suffixes;
+	struct suffix_set exclude_sni_suffixes;
 	unsigned int all_domains;
 
 	int tls_enabled;
@@ -108,6 +129,12 @@ struct section_config_t {
 #define SNI_DETECTION_BRUTE 1
 	int sni_detection;
 
+// Domains at the end of the name, labels ignored
+#define SNI_MATCHER_TRIE 0
+// Domains as the name suffixes on the label boundaries
+#define SNI_MATCHER_SUFFIX 1
+	int sni_matcher;
+
 	int udp_mode;
 	unsigned int udp_fake_seq_len;
 	unsigned int udp_fake_len;
@@ -120,6 +147,8 @@ struct section_config_t {
 };
 
 #define MAX_CONFIGLIST_LEN 64
+// IFNAMSIZ
+#define MAX_IFNAME_LEN 16
 
 struct config_t {
 	unsigned int queue_start_num;
@@ -127,6 +156,51 @@ struct config_t {
 	int use_gso;
 	int use_ipv6;
 	int use_conntrack;
+	// Send NFQUEUE verdicts in batches
+	int batch_verdicts;
+	// Max number of netlink messages received with one syscall
+	int recv_batch;
+	// CPUs the queue threads are pinned to, round robin
+	int *cpu_affinity;
+	int cpu_affinity_len;
+	// SCHED_FIFO priority of the queue threads, 0 keeps the default policy
+	int sched_fifo_prio;
+	// Lock all the process memory in RAM
+	int mlockall;
+	// Run the queue loop on io_uring. Requires USE_IO_URING build
+	int io_uring;
+	// NFQUEUE max length, 0 keeps the kernel default
+	unsigned int queue_maxlen;
+	// Netlink socket receive buffer size, 0 keeps the system default
+	int queue_rcvbuf;
+	// Count the packets lost in kernel instead of hiding ENOBUFS
+	int queue_drop_stats;
+	// Conntrack mark set on the decided flows, 0 disables the offload
+	uint32_t connmark_offload;
+	// Install the queue rules compiled from the sections
+	int nft_rules;
+	// Timeout of the learned targets in seconds, 0 disables the learning
+	unsigned int nft_learn_timeout;
+	// Queue only the flows to the learned targets
+	int nft_targets_only;
+	// Queue of the DNS responses the targets are learned from, -1 to disable
+	int dns_queue_num;
+	// Time to live of the cached destination verdicts, 0 disables the cache
+	unsigned int verdict_cache_ttl;
+	// Queue latency in microseconds the shedding starts above, 0 disables
+	unsigned int shed_latency_budget;
+	// TRIE_LAYOUT_* of the domains automatons
+	int trie_layout;
+	// Interface the BPF prefilter is attached to, empty to disable
+	char bpf_prefilter_iface[MAX_IFNAME_LEN];
+	// Mark set by the BPF prefilter on the packets worth to be queued
+	uint32_t bpf_prefilter_mark;
+	// RAW_BACKEND_* the packets are sent with
+	int raw_backend;
+	// Egress interface of the packet backend
+	char tx_iface[MAX_IFNAME_LEN];
+	// Skip the qdisc layer of tx_iface
+	int qdisc_bypass;
 	unsigned int mark;
 	int daemonize;
 	// Same as daemon() noclose
@@ -155,15 +229,18 @@ for (struct section_config_t *section = (config)->last_section; section != NULL;
 
 #define CONFIG_SECTION_NUMBER(section) ((section)->id)
 
-#define MAX_THREADS 16
-
 #ifndef THREADS_NUM
 #define THREADS_NUM 1
 #endif
 
-#if THREADS_NUM > MAX_THREADS
-#error "Too much threads"
-#endif
+// NFQUEUE numbers are 16-bit
+#define MAX_QUEUE_NUM 65535
+
+// Each message in the receive batch takes about 68KiB of memory
+#define MAX_RECV_BATCH 256
+
+// Same as glibc CPU_SETSIZE
+#define MAX_CPUS 1024
 
 #ifndef NOUSE_GSO
 #define USE_GSO
@@ -178,6 +255,7 @@ for (struct section_config_t *section = (config)->last_section; section != NULL;
 #endif
 
 #define DEFAULT_RAWSOCKET_MARK (1 << 15)
+#define DEFAULT_BPF_PREFILTER_MARK (1 << 16)
 
 #ifdef USE_SEG2_DELAY
 #define SEG2_DELAY 100
@@ -220,7 +298,10 @@ if ((fake_bitmask) & strategy)
 
 // The Maximum Transmission Unit size for rawsocket
 // Larger packets will be fragmented. Applicable for Chrome's kyber.
+// Used when the path MTU of the destination is unknown.
 #define AVAILABLE_MTU 1400
+// Upper bound of the path MTU, jumbo frames included
+#define MAX_SEND_MTU 9000
 
 #define DEFAULT_QUEUE_NUM 537
 
@@ -230,6 +311,11 @@ if ((fake_bitmask) & strategy)
 
 static const char default_snistr[] = DEFAULT_SNISTR;
 
+enum {
+	RAW_BACKEND_SOCKET,
+	RAW_BACKEND_PACKET,
+};
+
 enum {
 	UDP_MODE_DROP,
 	UDP_MODE_FAKE,
@@ -272,6 +358,7 @@ enum {
 	.seg2_delay = 0,                                        \
                                                                 \
 	.sni_detection = SNI_DETECTION_PARSE,                   \
+	.sni_matcher = SNI_MATCHER_TRIE,			\
 								\
 	.udp_mode = UDP_MODE_FAKE,				\
 	.udp_fake_seq_len = 6,					\
@@ -296,6 +383,29 @@ enum {
 	.verbose = VERBOSE_DEBUG,                               \
 	.use_gso = 1,                                           \
 	.use_conntrack = 0,					\
+	.batch_verdicts = 0,					\
+	.recv_batch = 1,					\
+	.cpu_affinity = NULL,					\
+	.cpu_affinity_len = 0,					\
+	.sched_fifo_prio = 0,					\
+	.mlockall = 0,						\
+	.io_uring = 0,						\
+	.queue_maxlen = 0,					\
+	.queue_rcvbuf = 0,					\
+	.queue_drop_stats = 0,					\
+	.connmark_offload = 0,					\
+	.nft_rules = 0,						\
+	.nft_learn_timeout = 0,					\
+	.nft_targets_only = 0,					\
+	.dns_queue_num = -1,					\
+	.verdict_cache_ttl = 0,					\
+	.shed_latency_budget = 0,				\
+	.trie_layout = TRIE_LAYOUT_FULL,			\
+	.bpf_prefilter_iface = "",				\
+	.bpf_prefilter_mark = DEFAULT_BPF_PREFILTER_MARK,	\
+	.raw_backend = RAW_BACKEND_SOCKET,			\
+	.tx_iface = "",						\
+	.qdisc_bypass = 0,					\
                                                                 \
 	.first_section = NULL,					\
 	.last_section = NULL,					\
@@ -348,6 +458,35 @@ struct packet_data {
 	const uint8_t *payload;
 	size_t payload_len;
 	struct ytb_conntrack yct;
+
+	/**
+	 * Set by process_packet when the rest of the connection
+	 * does not need to be processed.
+	 */
+	int flow_decided;
+
+	/**
+	 * Set by process_packet when the packet goes to a target,
+	 * so its destination may be learned.
+	 */
+	int target_matched;
+
+	/**
+	 * Set by the backend if it is able to replace the packet
+	 * with the verdict. The modified packet is written to mangled_payload
+	 * and PKT_ACCEPT_MANGLED is returned.
+	 */
+	int can_mangle;
+	uint8_t *mangled_payload;
+	size_t mangled_payload_bufsize;
+	size_t mangled_payload_len;
+
+	/**
+	 * Set by the backend if the verdict leaves after all the raw
+	 * packets sent while processing the packet, so the accepted
+	 * original follows them on the wire.
+	 */
+	int verdict_after_raw;
 };
 
 struct statistics_data {
@@ -355,6 +494,22 @@ struct statistics_data {
 	unsigned long packet_counter;
 	unsigned long target_counter;
 	unsigned long sent_counter;
+	unsigned long verdict_batch_counter;
+	unsigned long recv_batch_counter;
+	unsigned long recv_msg_counter;
+	unsigned long enobufs_counter;
+	// Read from the kernel queue stats
+	unsigned long queue_dropped;
+	unsigned long queue_user_dropped;
+	unsigned long offload_counter;
+	// Addresses queued to the nft sets, again after each flush
+	unsigned long learn_counter;
+	unsigned long vcache_hits;
+	unsigned long vcache_misses;
+	unsigned long tx_ring_counter;
+	unsigned long shed_enter_counter;
+	unsigned long shed_leave_counter;
+	unsigned long shed_counter;
 };
 
 extern struct statistics_data global_stats;
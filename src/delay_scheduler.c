@@ -0,0 +1,403 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef KERNEL_SPACE
+#error "The delay scheduler is userspace only"
+#endif
+
+#include "delay_scheduler.h"
+#include "logging.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define DSCHED_NONE UINT32_MAX
+
+struct dsched_slot {
+	// CLOCK_MONOTONIC, in nanoseconds
+	uint64_t deadline;
+	// Keeps the submission order for equal deadlines
+	uint64_t seq;
+	// Next slot in the free list or in the submission list
+	uint32_t next;
+	size_t len;
+	// Points to buf or to allocated memory for large packets
+	uint8_t *data;
+	uint8_t buf[DSCHED_SLOT_BUFSIZE];
+};
+
+static struct dsched_slot *slots;
+
+/**
+ * Free slots stack (Treiber stack). Popped by the queue threads,
+ * pushed by the scheduler thread.
+ * The lower 32 bits are the slot index, the upper 32 bits are
+ * the tag incremented on each change to avoid ABA.
+ */
+static uint64_t free_head;
+
+/**
+ * Submitted slots stack. Pushed by the queue threads,
+ * taken all at once by the scheduler thread.
+ */
+static uint32_t submit_head;
+static uint64_t submit_seq;
+
+// Owned by the scheduler thread
+static uint32_t heap[DSCHED_SLOTS];
+static size_t heap_len;
+
+static int efd = -1;
+static int tfd = -1;
+static int stop_flag;
+static pthread_t sched_thread;
+static struct dsched_ops sched_ops;
+// Thread init result is passed to dsched_start
+static sem_t init_sem;
+static int init_status;
+
+static uint64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t free_pop(void) {
+	uint64_t old = __atomic_load_n(&free_head, __ATOMIC_ACQUIRE);
+	uint64_t new;
+	uint32_t idx;
+
+	do {
+		idx = (uint32_t)old;
+		if (idx == DSCHED_NONE)
+			return DSCHED_NONE;
+
+		uint32_t next = __atomic_load_n(&slots[idx].next, __ATOMIC_RELAXED);
+		new = (((old >> 32) + 1) << 32) | next;
+	} while (!__atomic_compare_exchange_n(&free_head, &old, new, 1,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return idx;
+}
+
+static void free_push(uint32_t idx) {
+	uint64_t old = __atomic_load_n(&free_head, __ATOMIC_RELAXED);
+	uint64_t new;
+
+	do {
+		__atomic_store_n(&slots[idx].next, (uint32_t)old, __ATOMIC_RELAXED);
+		new = (((old >> 32) + 1) << 32) | idx;
+	} while (!__atomic_compare_exchange_n(&free_head, &old, new, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Returns 1 if the submission list was empty,
+ * so the scheduler should be woken up.
+ */
+static int submit_push(uint32_t idx) {
+	uint32_t old = __atomic_load_n(&submit_head, __ATOMIC_RELAXED);
+
+	do {
+		slots[idx].next = old;
+	} while (!__atomic_compare_exchange_n(&submit_head, &old, idx, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return old == DSCHED_NONE;
+}
+
+static void slot_release(uint32_t idx) {
+	struct dsched_slot *slot = &slots[idx];
+
+	if (slot->data != slot->buf) {
+		free(slot->data);
+	}
+	slot->data = NULL;
+
+	free_push(idx);
+}
+
+static int slot_before(uint32_t a, uint32_t b) {
+	if (slots[a].deadline != slots[b].deadline)
+		return slots[a].deadline < slots[b].deadline;
+
+	return slots[a].seq < slots[b].seq;
+}
+
+static void heap_push(uint32_t idx) {
+	size_t i = heap_len++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!slot_before(idx, heap[parent]))
+			break;
+
+		heap[i] = heap[parent];
+		i = parent;
+	}
+
+	heap[i] = idx;
+}
+
+static uint32_t heap_pop(void) {
+	uint32_t top = heap[0];
+	uint32_t last = heap[--heap_len];
+	size_t i = 0;
+
+	while (1) {
+		size_t child = 2 * i + 1;
+		if (child >= heap_len)
+			break;
+
+		if (child + 1 < heap_len && slot_before(heap[child + 1], heap[child]))
+			child++;
+
+		if (!slot_before(heap[child], last))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	if (heap_len != 0)
+		heap[i] = last;
+
+	return top;
+}
+
+static void take_submitted(void) {
+	uint32_t idx = __atomic_exchange_n(&submit_head, DSCHED_NONE,
+				    __ATOMIC_ACQUIRE);
+
+	while (idx != DSCHED_NONE) {
+		uint32_t next = slots[idx].next;
+		heap_push(idx);
+		idx = next;
+	}
+}
+
+static void send_expired(void) {
+	uint64_t now = monotonic_ns();
+	int ret;
+
+	while (heap_len != 0 && slots[heap[0]].deadline <= now) {
+		uint32_t idx = heap_pop();
+		struct dsched_slot *slot = &slots[idx];
+
+		ret = sched_ops.send(slot->data, slot->len);
+		if (ret < 0) {
+			lgerror(ret, "send delayed raw packet");
+		}
+
+		slot_release(idx);
+	}
+}
+
+static int arm_timer(void) {
+	struct itimerspec its = {0};
+
+	if (heap_len != 0) {
+		uint64_t deadline = slots[heap[0]].deadline;
+		its.it_value.tv_sec = deadline / 1000000000ULL;
+		its.it_value.tv_nsec = deadline % 1000000000ULL;
+	}
+
+	// Zero it_value disarms the timer
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		lgerror(-errno, "timerfd_settime");
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void *dsched_thread_fn(void *arg) {
+	struct pollfd pfds[2] = {
+		{ .fd = efd, .events = POLLIN },
+		{ .fd = tfd, .events = POLLIN },
+	};
+	uint64_t cnt;
+	int ret;
+
+	init_status = sched_ops.thread_init ? sched_ops.thread_init() : 0;
+	sem_post(&init_sem);
+	if (init_status < 0) {
+		return NULL;
+	}
+
+	while (!__atomic_load_n(&stop_flag, __ATOMIC_ACQUIRE)) {
+		ret = poll(pfds, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			lgerror(-errno, "Delay scheduler poll");
+			break;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			(void)!read(efd, &cnt, sizeof(cnt));
+		}
+		if (pfds[1].revents & POLLIN) {
+			(void)!read(tfd, &cnt, sizeof(cnt));
+		}
+
+		take_submitted();
+		send_expired();
+
+		if (arm_timer() < 0)
+			break;
+	}
+
+	if (sched_ops.thread_exit)
+		sched_ops.thread_exit();
+
+	return NULL;
+}
+
+int dsched_submit(const uint8_t *data, size_t data_len, unsigned int delay_ms) {
+	uint32_t idx = free_pop();
+	if (idx == DSCHED_NONE) {
+		return -ENOBUFS;
+	}
+
+	struct dsched_slot *slot = &slots[idx];
+
+	if (data_len > DSCHED_SLOT_BUFSIZE) {
+		slot->data = malloc(data_len);
+		if (slot->data == NULL) {
+			slot->data = slot->buf;
+			free_push(idx);
+			return -ENOMEM;
+		}
+	} else {
+		slot->data = slot->buf;
+	}
+
+	memcpy(slot->data, data, data_len);
+	slot->len = data_len;
+	slot->deadline = monotonic_ns() + (uint64_t)delay_ms * 1000000ULL;
+	slot->seq = __atomic_fetch_add(&submit_seq, 1, __ATOMIC_RELAXED);
+
+	if (submit_push(idx)) {
+		uint64_t one = 1;
+		if (write(efd, &one, sizeof(one)) < 0) {
+			lgerror(-errno, "Delay scheduler wakeup");
+		}
+	}
+
+	return 0;
+}
+
+int dsched_start(const struct dsched_ops *ops) {
+	int ret;
+
+	slots = calloc(DSCHED_SLOTS, sizeof(struct dsched_slot));
+	if (slots == NULL) {
+		return -ENOMEM;
+	}
+
+	for (uint32_t i = 0; i < DSCHED_SLOTS; i++) {
+		slots[i].next = i + 1 < DSCHED_SLOTS ? i + 1 : DSCHED_NONE;
+	}
+	free_head = 0;
+	submit_head = DSCHED_NONE;
+	submit_seq = 0;
+	heap_len = 0;
+	stop_flag = 0;
+	sched_ops = *ops;
+
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd < 0) {
+		ret = -errno;
+		goto free_slots;
+	}
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (tfd < 0) {
+		ret = -errno;
+		goto close_efd;
+	}
+
+	if (sem_init(&init_sem, 0, 0) < 0) {
+		ret = -errno;
+		goto close_tfd;
+	}
+
+	ret = pthread_create(&sched_thread, NULL, dsched_thread_fn, NULL);
+	if (ret != 0) {
+		ret = -ret;
+		goto destroy_sem;
+	}
+
+	while (sem_wait(&init_sem) < 0 && errno == EINTR)
+		;
+	sem_destroy(&init_sem);
+
+	if (init_status < 0) {
+		ret = init_status;
+		pthread_join(sched_thread, NULL);
+		goto close_tfd;
+	}
+
+	return 0;
+
+destroy_sem:
+	sem_destroy(&init_sem);
+close_tfd:
+	close(tfd);
+	tfd = -1;
+close_efd:
+	close(efd);
+	efd = -1;
+free_slots:
+	free(slots);
+	slots = NULL;
+	return ret;
+}
+
+void dsched_stop(void) {
+	uint64_t one = 1;
+
+	if (slots == NULL)
+		return;
+
+	__atomic_store_n(&stop_flag, 1, __ATOMIC_RELEASE);
+	(void)!write(efd, &one, sizeof(one));
+	pthread_join(sched_thread, NULL);
+
+	take_submitted();
+	while (heap_len != 0) {
+		slot_release(heap_pop());
+	}
+
+	close(tfd);
+	tfd = -1;
+	close(efd);
+	efd = -1;
+	free(slots);
+	slots = NULL;
+}
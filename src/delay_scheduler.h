@@ -0,0 +1,68 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DELAY_SCHEDULER_H
+#define DELAY_SCHEDULER_H
+
+#include "types.h"
+#include "config.h"
+
+/**
+ * Delayed packets scheduler.
+ *
+ * One scheduler thread per process owns a min-heap of deadlines
+ * and sleeps on timerfd until the nearest one. Packets are copied
+ * to preallocated slots and handed to the scheduler through
+ * a lock-free queue, so submission never allocates memory
+ * (except for packets larger than the slot buffer).
+ */
+
+// Number of preallocated packet slots
+#define DSCHED_SLOTS 512
+// Packets larger than this are stored in allocated memory
+#define DSCHED_SLOT_BUFSIZE 1500
+
+struct dsched_ops {
+	// Called in the scheduler thread before it starts. May be NULL.
+	int (*thread_init)(void);
+	// Called in the scheduler thread on exit. May be NULL.
+	void (*thread_exit)(void);
+	// Sends the packet when its time has come
+	raw_send_t send;
+};
+
+/**
+ * Starts the scheduler thread.
+ */
+int dsched_start(const struct dsched_ops *ops);
+
+/**
+ * Stops the scheduler thread. Pending packets are dropped.
+ */
+void dsched_stop(void);
+
+/**
+ * Schedules the packet to be sent after delay_ms.
+ * The packet is copied, so the caller owns data.
+ *
+ * Returns -ENOBUFS if all the slots are in use.
+ */
+int dsched_submit(const uint8_t *data, size_t data_len, unsigned int delay_ms);
+
+#endif /* DELAY_SCHEDULER_H */
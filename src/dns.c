@@ -0,0 +1,206 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "dns.h"
+#include "tls.h"
+
+#include <sys/socket.h>
+
+#define DNS_HDR_LEN 12
+#define DNS_FLAG_QR 0x8000
+#define DNS_RCODE_MASK 0x000f
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+
+// Compression pointer: two high bits set, 14-bit offset
+#define DNS_LABEL_PTR 0xc0
+#define DNS_MAX_LABEL 63
+// Protects from the compression pointer loops
+#define DNS_MAX_JUMPS 16
+
+static uint16_t dns_u16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t dns_u32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Reads the name at *off and moves *off after it.
+ * The name is written to name in the text form if name is not NULL.
+ */
+static int dns_read_name(const uint8_t *data, size_t dlen, size_t *off,
+			 char *name, size_t *name_len) {
+	size_t pos = *off;
+	size_t end = 0;
+	size_t len = 0;
+	int jumps = 0;
+
+	while (1) {
+		if (pos >= dlen)
+			return -EINVAL;
+
+		uint8_t llen = data[pos];
+
+		if ((llen & DNS_LABEL_PTR) == DNS_LABEL_PTR) {
+			if (pos + 1 >= dlen || ++jumps > DNS_MAX_JUMPS)
+				return -EINVAL;
+			if (end == 0)
+				end = pos + 2;
+
+			pos = ((llen & ~DNS_LABEL_PTR) << 8) | data[pos + 1];
+			continue;
+		}
+
+		if (llen > DNS_MAX_LABEL)
+			return -EINVAL;
+
+		if (llen == 0) {
+			if (end == 0)
+				end = pos + 1;
+			break;
+		}
+
+		if (pos + 1 + llen > dlen)
+			return -EINVAL;
+
+		// The dot separator is counted for all labels but the first
+		if (len + (len != 0) + llen > DNS_MAX_NAME)
+			return -EINVAL;
+
+		if (name != NULL) {
+			if (len != 0)
+				name[len] = '.';
+			for (int i = 0; i < llen; i++) {
+				uint8_t c = data[pos + 1 + i];
+				if (c >= 'A' && c <= 'Z')
+					c += 'a' - 'A';
+				name[len + (len != 0) + i] = c;
+			}
+		}
+
+		len += (len != 0) + llen;
+		pos += 1 + llen;
+	}
+
+	if (name != NULL) {
+		name[len] = '\0';
+		*name_len = len;
+	}
+
+	*off = end;
+	return 0;
+}
+
+int dns_parse_response(const uint8_t *data, size_t dlen,
+		       struct dns_response *resp) {
+	size_t off = DNS_HDR_LEN;
+	uint16_t flags, qdcount, ancount;
+	int ret;
+
+	resp->qname_len = 0;
+	resp->answers_len = 0;
+
+	if (dlen < DNS_HDR_LEN)
+		return -EINVAL;
+
+	flags = dns_u16(data + 2);
+	qdcount = dns_u16(data + 4);
+	ancount = dns_u16(data + 6);
+
+	if (!(flags & DNS_FLAG_QR) || (flags & DNS_RCODE_MASK) != 0)
+		return -EINVAL;
+
+	if (qdcount != 1)
+		return -EINVAL;
+
+	ret = dns_read_name(data, dlen, &off, resp->qname, &resp->qname_len);
+	if (ret < 0)
+		return ret;
+
+	// QTYPE and QCLASS
+	off += 4;
+	if (off > dlen)
+		return -EINVAL;
+
+	for (int i = 0; i < ancount; i++) {
+		uint16_t type, class, rdlen;
+		uint32_t ttl;
+
+		ret = dns_read_name(data, dlen, &off, NULL, NULL);
+		if (ret < 0)
+			return ret;
+
+		if (off + 10 > dlen)
+			return -EINVAL;
+
+		type = dns_u16(data + off);
+		class = dns_u16(data + off + 2);
+		ttl = dns_u32(data + off + 4);
+		rdlen = dns_u16(data + off + 8);
+		off += 10;
+
+		if (off + rdlen > dlen)
+			return -EINVAL;
+
+		if (class == DNS_CLASS_IN && resp->answers_len < DNS_MAX_ANSWERS &&
+			((type == DNS_TYPE_A && rdlen == 4) ||
+			(type == DNS_TYPE_AAAA && rdlen == 16))) {
+			struct dns_addr_answer *ans =
+				&resp->answers[resp->answers_len++];
+
+			ans->family = type == DNS_TYPE_A ? AF_INET : AF_INET6;
+			memcpy(ans->addr, data + off, rdlen);
+			ans->ttl = ttl;
+		}
+
+		off += rdlen;
+	}
+
+	return 0;
+}
+
+int dns_drop_family(struct dns_response *resp, int family) {
+	int n = 0;
+
+	for (int i = 0; i < resp->answers_len; i++) {
+		if (resp->answers[i].family != family)
+			resp->answers[n++] = resp->answers[i];
+	}
+
+	resp->answers_len = n;
+	return n;
+}
+
+int dns_name_is_target(const struct section_config_t *section,
+		       const char *name, size_t name_len) {
+	size_t offset, offlen;
+
+	if (!section->all_domains &&
+		!tls_match_domains(section, 0, (const uint8_t *)name, name_len,
+			&offset, &offlen)) {
+		return 0;
+	}
+
+	return !tls_match_domains(section, 1, (const uint8_t *)name, name_len,
+			&offset, &offlen);
+}
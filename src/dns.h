@@ -0,0 +1,76 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef YU_DNS_H
+#define YU_DNS_H
+
+/**
+ * DNS responses parsing for the target destinations snooping.
+ * The name asked in the question is matched against the sections,
+ * the A and AAAA records of the answer section are the addresses
+ * of the name, CNAME chains included.
+ */
+
+#include "types.h"
+#include "config.h"
+
+#define DNS_PORT 53
+
+// Text form of the name without the trailing dot
+#define DNS_MAX_NAME 254
+#define DNS_MAX_ANSWERS 32
+
+struct dns_addr_answer {
+	// AF_INET or AF_INET6
+	int family;
+	uint8_t addr[16];
+	uint32_t ttl;
+};
+
+struct dns_response {
+	// Lower case question name
+	char qname[DNS_MAX_NAME + 1];
+	size_t qname_len;
+	struct dns_addr_answer answers[DNS_MAX_ANSWERS];
+	int answers_len;
+};
+
+/**
+ * Parses a successful DNS response with one question.
+ * The answers after the first DNS_MAX_ANSWERS addresses are skipped.
+ * Returns 0 on success or -EINVAL if the message is malformed,
+ * is not a response or reports an error.
+ */
+int dns_parse_response(const uint8_t *data, size_t dlen,
+		       struct dns_response *resp);
+
+/**
+ * Removes the answers of the family keeping the order of the rest.
+ * Returns the number of the answers left.
+ */
+int dns_drop_family(struct dns_response *resp, int family);
+
+/**
+ * Checks the name against the section sni_domains
+ * and exclude_sni_domains, like the SNI is checked.
+ */
+int dns_name_is_target(const struct section_config_t *section,
+		       const char *name, size_t name_len);
+
+#endif /* YU_DNS_H */
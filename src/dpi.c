@@ -39,6 +39,10 @@
 
 #include "mangle.h"
 
+#ifndef KERNEL_SPACE
+#include "verdict_cache.h"
+#endif
+
 void log_packet(const struct parsed_packet *pkt);
 
 #define MAX_FRAGMENTATION_PTS 16
@@ -48,14 +52,30 @@ struct fragmentation_points {
 	int used_points;
 };
 
-int process_packet(const struct config_t *config, const struct packet_data *pd) {
+/**
+ * Sections matching by connection packets want to see
+ * all the packets of the TCP flow.
+ */
+static int tcp_flow_tracked(const struct config_t *config) {
+	ITER_CONFIG_SECTIONS(config, section) {
+		if (section->tcp_match_all || section->tcp_match_connpkts)
+			return 1;
+	}
+
+	return 0;
+}
+
+int process_packet(const struct config_t *config, struct packet_data *pd) {
 	assert (config);
 	assert (pd);
 
 	struct parsed_packet pkt = {0};
+	struct packet_analysis analysis = {0};
 	int ret = 0;
 
 	pkt.yct = pd->yct;
+	pkt.pd = pd;
+	pkt.analysis = &analysis;
 
 	lgtrace_start();	
 
@@ -118,6 +138,14 @@ int process_packet(const struct config_t *config, const struct packet_data *pd)
 
 	int verdict = PKT_CONTINUE;
 
+	/**
+	 * All the packets sent for this one are queued
+	 * and go to the network before the verdict.
+	 */
+	if (instance_config.begin_raw_batch) {
+		instance_config.begin_raw_batch();
+	}
+
 	ITER_CONFIG_SECTIONS(config, section) {
 		lgtrace_wr("Section #%d: ", CONFIG_SECTION_NUMBER(section));
 
@@ -144,6 +172,19 @@ accept:
 	verdict = PKT_ACCEPT;
 
 ret_verdict:
+	quic_initial_info_free(&analysis.quic);
+
+	if (pd->flow_decided && pkt.transport_proto == IPPROTO_TCP &&
+		tcp_flow_tracked(config)) {
+		pd->flow_decided = 0;
+	}
+
+	if (instance_config.flush_raw_batch) {
+		ret = instance_config.flush_raw_batch();
+		if (ret < 0) {
+			lgerror(ret, "flush_raw_batch");
+		}
+	}
 
 	switch (verdict) {
 	case PKT_ACCEPT:
@@ -152,6 +193,9 @@ ret_verdict:
 	case PKT_DROP:
 		lgtrace_wr("drop");
 		break;
+	case PKT_ACCEPT_MANGLED:
+		lgtrace_wr("accept mangled");
+		break;
 	default:
 		lgtrace_wr("unknown verdict: %d", verdict);
 	}
@@ -171,6 +215,25 @@ enum tls_proc_verdict process_tls_packet(const struct section_config_t *section,
 		       struct fragmentation_points *frag_pts);
 
 
+/**
+ * Puts the modified packet to the verdict if the backend supports it.
+ * Otherwise the original packet is accepted.
+ */
+static int accept_mangled(const struct parsed_packet *pkt,
+			  const uint8_t *payload, size_t payload_len) {
+	struct packet_data *pd = pkt->pd;
+
+	if (pd == NULL || !pd->can_mangle ||
+		payload_len > pd->mangled_payload_bufsize) {
+		return PKT_ACCEPT;
+	}
+
+	memcpy(pd->mangled_payload, payload, payload_len);
+	pd->mangled_payload_len = payload_len;
+
+	return PKT_ACCEPT_MANGLED;
+}
+
 int perform_attack(const struct section_config_t *section,
 		   const struct parsed_packet *pkt, const struct fragmentation_points *frag_pts);
 
@@ -268,23 +331,78 @@ static void bubblesort(size_t arr[], size_t n){
 	}
 }
 
+/**
+ * Same as analyze_tls_data, but the ClientHello is parsed only
+ * by the first section and then matched by each one.
+ */
+static struct tls_verdict tls_packet_sni(const struct section_config_t *section,
+					 const struct parsed_packet *pkt) {
+	struct packet_analysis *pa = pkt->analysis;
+	struct tls_verdict vrd = {0};
+
+	if (section->sni_detection == SNI_DETECTION_BRUTE) {
+		bruteforce_analyze_sni_str(section,
+			pkt->transport_payload, pkt->transport_payload_len, &vrd);
+		return vrd;
+	}
+
+	if (!pa->tls_parsed) {
+		tls_find_sni(pkt->transport_payload, pkt->transport_payload_len,
+			&pa->tls_sni);
+		pa->tls_parsed = 1;
+	}
+
+	vrd = pa->tls_sni;
+	tls_match_sni(section, &vrd);
+
+	return vrd;
+}
+
 enum tls_proc_verdict process_tls_packet(const struct section_config_t *section,
 		       const struct parsed_packet *pkt,
 		       struct fragmentation_points *frag_pts) {
 	assert (section);
 	assert (pkt);
-	
 
-	struct tls_verdict vrd = analyze_tls_data(section,
-					   pkt->transport_payload, pkt->transport_payload_len);
+	struct tls_verdict vrd;
+
+#ifndef KERNEL_SPACE
+	struct vcache_key vkey;
+	int vcache_key_ok = vcache_enabled() &&
+		pkt->transport_proto == IPPROTO_TCP &&
+		vcache_key_build(&vkey, pkt->iph, pkt->iph_len, IPPROTO_TCP,
+				 pkt->tcph->dest, section) == 0;
+
+	if (vcache_key_ok && vcache_tls_lookup(&vkey, pkt->transport_payload,
+				pkt->transport_payload_len, &vrd)) {
+		lgtrace_addp("TLS verdict cached");
+	} else {
+		vrd = tls_packet_sni(section, pkt);
+		lgtrace_addp("TLS analyzed");
+
+		if (vcache_key_ok)
+			vcache_tls_store(&vkey, pkt->transport_payload, &vrd);
+	}
+#else
+	vrd = tls_packet_sni(section, pkt);
 	lgtrace_addp("TLS analyzed");
+#endif
 
 	if (vrd.sni_len != 0) {
 		lgtrace_addp("SNI detected: %.*s", vrd.sni_len, vrd.sni_ptr);
 	}
 
+	// ClientHello is handled here whether the SNI is a target or not
+	if ((vrd.sni_len != 0 || vrd.target_sni) && pkt->pd != NULL) {
+		pkt->pd->flow_decided = 1;
+	}
+
 	if (vrd.target_sni) {
 		lgdebug("Target SNI detected: %.*s", vrd.sni_len, vrd.sni_ptr);
+		if (pkt->pd != NULL) {
+			pkt->pd->target_matched = 1;
+		}
+
 		size_t target_sni_offset = vrd.target_sni_ptr - pkt->transport_payload;
 
 		size_t ipd_offset = target_sni_offset;
@@ -324,6 +442,9 @@ int perform_attack(const struct section_config_t *section,
 	assert (frag_pts);
 
 	int ret = 0;
+	int verdict = PKT_ACCEPT;
+	// The packet itself is modified, not only split
+	int is_mangled = 0;
 
 	size_t payload_len = pkt->raw_payload_len;
 	uint8_t *payload = malloc(pkt->raw_payload_len);
@@ -334,7 +455,10 @@ int perform_attack(const struct section_config_t *section,
 
 	memcpy(payload, pkt->raw_payload, pkt->raw_payload_len);
 
-	if (pkt->transport_payload_len > AVAILABLE_MTU) {
+	size_t mtu = instance_config.path_mtu != NULL ?
+		instance_config.path_mtu(pkt->raw_payload, pkt->raw_payload_len) :
+		AVAILABLE_MTU;
+	if (pkt->raw_payload_len > mtu) {
 		lgdebug("WARNING! Tartget packet is too big and may cause issues!");
 	}
 
@@ -358,6 +482,7 @@ int perform_attack(const struct section_config_t *section,
 		if (section->fk_winsize) {
 			tcph->window = htons(section->fk_winsize);
 			set_tcp_checksum(tcph, iph, iph_len);
+			is_mangled = 1;
 		}
 	
 
@@ -383,6 +508,11 @@ int perform_attack(const struct section_config_t *section,
 		}
 
 
+		// The original goes with the verdict, only duplicates are sent
+		if (is_mangled) {
+			verdict = accept_mangled(pkt, payload, payload_len);
+		}
+
 		for (int i = 0; i < section->frag_origin_retries; i++) {
 			if (pkt->ipver == IP4VERSION) {
 				struct iphdr *ip4h = (struct iphdr *)iph;
@@ -399,7 +529,7 @@ int perform_attack(const struct section_config_t *section,
 			}
 		}
 
-		goto accept_lc;
+		goto ret_lc;
 	}
 
 	if (frag_pts->used_points > 0) {
@@ -424,11 +554,17 @@ int perform_attack(const struct section_config_t *section,
 
 		} else if (section->fragmentation_strategy == FRAG_STRAT_IP && pkt->ipver != IP4VERSION) {
 			lginfo("WARNING: IP fragmentation is supported only for IPv4");	
-			goto accept_lc;
 		}
 	}
 
+	// The packet is not split, so the modified one may go with the verdict
+	if (is_mangled) {
+		verdict = accept_mangled(pkt, payload, payload_len);
+	}
 
+ret_lc:
+		free(payload);
+		return verdict;
 accept_lc:
 		free(payload);
 		return PKT_ACCEPT;
@@ -445,9 +581,15 @@ int process_udp_packet(const struct section_config_t *section, const struct pars
 
 	int ret = 0;
 
-	if (!detect_udp_filtered(section, pkt->raw_payload, pkt->raw_payload_len)) 
+	ret = detect_udp_filtered(section, pkt->raw_payload, pkt->raw_payload_len,
+				  &pkt->analysis->quic);
+	if (!ret)
 		goto continue_flow;
 
+	if (ret == UDP_FILTERED_TARGET_SNI && pkt->pd != NULL) {
+		pkt->pd->target_matched = 1;
+	}
+
 	if (section->udp_mode == UDP_MODE_DROP)
 		goto drop;
 	else if (section->udp_mode == UDP_MODE_FAKE) {
@@ -486,6 +628,11 @@ erret:
 		}
 
 		
+		// The fakes leave first, so the original may go with the verdict
+		if (pkt->pd != NULL && pkt->pd->verdict_after_raw) {
+			goto accept;
+		}
+
 		// requeue
 		ret = instance_config.send_raw_packet(pkt->raw_payload, pkt->raw_payload_len);
 		goto drop;
@@ -22,12 +22,28 @@
 
 #include "types.h"
 #include "tls.h"
+#include "quic.h"
 #include "config.h"
 
 #define PKT_ACCEPT	0
 #define PKT_DROP	1
 // Used for section config
 #define PKT_CONTINUE	2
+// Accept the packet replaced with packet_data mangled_payload
+#define PKT_ACCEPT_MANGLED	3
+
+/**
+ * Section independent results of the payload parsing. Filled lazily by
+ * the first section which needs them, so the number of sections does not
+ * multiply the parsing cost.
+ */
+struct packet_analysis {
+	// ClientHello SNI of the TCP payload, not matched against the domains
+	int tls_parsed;
+	struct tls_verdict tls_sni;
+
+	struct quic_initial_info quic;
+};
 
 struct parsed_packet {
 	const uint8_t *raw_payload;
@@ -62,13 +78,18 @@ struct parsed_packet {
 	size_t transport_payload_len;
 
 	struct ytb_conntrack yct;
+
+	struct packet_analysis *analysis;
+
+	// Used to return the modified packet
+	struct packet_data *pd;
 };
 
 /**
  * Processes the packet and returns verdict.
  * This is the primary function that traverses the packet.
  */
-int process_packet(const struct config_t *config, const struct packet_data *pd);
+int process_packet(const struct config_t *config, struct packet_data *pd);
 
 
 /**
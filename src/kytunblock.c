@@ -287,46 +287,14 @@ static int send_raw_socket(const uint8_t *pkt, size_t pktlen) {
 	if (pktlen > AVAILABLE_MTU) {
 		lgtrace("Split packet!");
 
-		size_t buff1_size = pktlen;
-		uint8_t *buff1 = malloc(buff1_size);
-		if (buff1 == NULL) {
+		uint8_t *seg = malloc(AVAILABLE_MTU);
+		if (seg == NULL) {
 			lgerror(-ENOMEM, "Allocation error");
 			return -ENOMEM;
 		}
-		size_t buff2_size = pktlen;
-		uint8_t *buff2 = malloc(buff2_size);
-		if (buff2 == NULL) {
-			lgerror(-ENOMEM, "Allocation error");
-			free(buff1);
-			return -ENOMEM;
-		}
-
-		if ((ret = tcp_frag(pkt, pktlen, AVAILABLE_MTU-128,
-			buff1, &buff1_size, buff2, &buff2_size)) < 0) {
-
-			goto erret_lc;
-		}
-
-		int sent = 0;
-		ret = send_raw_socket(buff1, buff1_size);
 
-		if (ret >= 0) sent += ret;
-		else {
-			goto erret_lc;
-		}
-
-		ret = send_raw_socket(buff2, buff2_size);
-		if (ret >= 0) sent += ret;
-		else {
-			goto erret_lc;
-		}
-		 
-		free(buff1);
-		free(buff2);
-		return sent;
-erret_lc:
-		free(buff1);
-		free(buff2);
+		ret = tcp_segment(pkt, pktlen, seg, AVAILABLE_MTU, send_raw_socket);
+		free(seg);
 		return ret;
 	}
 	
@@ -352,9 +320,15 @@ static int delay_packet_send(const unsigned char *data, size_t data_len, unsigne
 	return send_raw_socket(data, data_len);
 }
 
+/**
+ * Raw packets are put to the network stack directly with no syscall
+ * overhead, so the kernel module sends them one by one.
+ */
 struct instance_config_t instance_config = {
 	.send_raw_packet = send_raw_socket,
 	.send_delayed_packet = delay_packet_send,
+	.begin_raw_batch = NULL,
+	.flush_raw_batch = NULL,
 };
 
 static int conntrack_parse(const struct sk_buff *skb, 
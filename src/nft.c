@@ -0,0 +1,1082 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef KERNEL_SPACE
+#error "nftables rules are userspace only"
+#endif
+
+#include "nft.h"
+#include "logging.h"
+#include "dns.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+// Same as `type filter hook postrouting priority mangle - 1`
+#define NFT_CHAIN_NAME "postrouting"
+#define NFT_CHAIN_PRIORITY (-151)
+
+#define NFT_TCP_SET "tcp_ports"
+#define NFT_UDP_SET "udp_ports"
+#define NFT_TCP_SET_ID 1
+#define NFT_UDP_SET_ID 2
+#define NFT_TARGETS4_SET_ID 3
+#define NFT_TARGETS6_SET_ID 4
+
+// nft userspace datatypes of the set keys, shown in `nft list`
+#define NFT_TYPE_IPADDR 7
+#define NFT_TYPE_IP6ADDR 8
+#define NFT_TYPE_INET_SERVICE 13
+
+// IP_CT_DIR_ORIGINAL
+#define NFT_CT_DIR_ORIGINAL 0
+
+// Room for one set element message part
+#define NFT_ELEM_MAXSIZE 64
+
+static int range_cmp(const void *a, const void *b) {
+	const struct dport_range *ra = a;
+	const struct dport_range *rb = b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+
+	return ra->end < rb->end ? -1 : ra->end > rb->end;
+}
+
+int nft_merge_port_ranges(struct dport_range *ranges, int len) {
+	int n = 0;
+
+	if (len == 0)
+		return 0;
+
+	qsort(ranges, len, sizeof(struct dport_range), range_cmp);
+
+	for (int i = 1; i < len; i++) {
+		struct dport_range *last = &ranges[n];
+
+		if ((uint32_t)ranges[i].start <= (uint32_t)last->end + 1) {
+			if (ranges[i].end > last->end)
+				last->end = ranges[i].end;
+			continue;
+		}
+
+		ranges[++n] = ranges[i];
+	}
+
+	return n + 1;
+}
+
+static int proto_rule_add_range(struct nft_proto_rule *rule,
+				uint16_t start, uint16_t end) {
+	struct dport_range *ports = realloc(rule->ports,
+		(rule->ports_len + 1) * sizeof(struct dport_range));
+	if (ports == NULL)
+		return -ENOMEM;
+
+	rule->ports = ports;
+	rule->ports[rule->ports_len++] = (struct dport_range){
+		.start = start,
+		.end = end,
+	};
+
+	return 0;
+}
+
+static int proto_rule_add_ranges(struct nft_proto_rule *rule,
+				 const struct dport_range *ranges, int len) {
+	int ret;
+
+	for (int i = 0; i < len; i++) {
+		ret = proto_rule_add_range(rule, ranges[i].start, ranges[i].end);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Follows process_tcp_packet filtering
+ */
+static int compile_tcp_section(const struct section_config_t *section,
+			       struct nft_proto_rule *rule) {
+	if (!section->tls_enabled && !section->tcp_match_all &&
+		!section->tcp_match_connpkts && !section->synfake) {
+		return 0;
+	}
+
+	rule->enabled = 1;
+
+	if (section->tcp_dport_range_len) {
+		return proto_rule_add_ranges(rule, section->tcp_dport_range,
+			       section->tcp_dport_range_len);
+	} else if (section->dport_filter) {
+		return proto_rule_add_range(rule, 443, 443);
+	}
+
+	return proto_rule_add_range(rule, 0, 65535);
+}
+
+/**
+ * Follows detect_udp_filtered
+ */
+static int compile_udp_section(const struct section_config_t *section,
+			       struct nft_proto_rule *rule, int *only_quic) {
+	int ret;
+
+	if (section->udp_dport_range_len) {
+		rule->enabled = 1;
+		*only_quic = 0;
+		ret = proto_rule_add_ranges(rule, section->udp_dport_range,
+			      section->udp_dport_range_len);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (section->udp_stun_filter) {
+		// STUN is detected on any port
+		rule->enabled = 1;
+		*only_quic = 0;
+		return proto_rule_add_range(rule, 0, 65535);
+	}
+
+	if (section->udp_filter_quic != UDP_FILTER_QUIC_DISABLED) {
+		rule->enabled = 1;
+		if (section->dport_filter) {
+			return proto_rule_add_range(rule, 443, 443);
+		}
+
+		return proto_rule_add_range(rule, 0, 65535);
+	}
+
+	return 0;
+}
+
+/**
+ * The prefilter marks TLS ClientHello only, so it must not
+ * hide the packets matched by the connection.
+ */
+static int tcp_prefilter_compatible(const struct section_config_t *section) {
+	return !section->tcp_match_all && !section->tcp_match_connpkts &&
+		!section->synfake;
+}
+
+int nft_ruleset_compile(const struct config_t *config, struct nft_ruleset *rs) {
+	int only_quic = 1;
+	int tcp_prefilter = 1;
+	unsigned int tcp_limit = config->connbytes_limit;
+	int ret;
+
+	*rs = (struct nft_ruleset){0};
+	rs->use_ipv6 = config->use_ipv6;
+	rs->mark = config->mark;
+	rs->connmark = config->connmark_offload;
+	rs->queue_start_num = config->queue_start_num;
+	rs->queue_total = config->threads;
+	rs->learn_timeout = config->nft_learn_timeout;
+	rs->targets_only = config->nft_targets_only;
+	rs->dns_queue_num = config->dns_queue_num;
+
+	ITER_CONFIG_SECTIONS(config, section) {
+		ret = compile_tcp_section(section, &rs->tcp);
+		if (ret < 0)
+			goto error;
+
+		if (!tcp_prefilter_compatible(section))
+			tcp_prefilter = 0;
+
+		ret = compile_udp_section(section, &rs->udp, &only_quic);
+		if (ret < 0)
+			goto error;
+
+		if (section->tcp_match_connpkts > 0 &&
+			(unsigned int)section->tcp_match_connpkts > tcp_limit) {
+			tcp_limit = section->tcp_match_connpkts;
+		}
+	}
+
+	rs->tcp.ports_len = nft_merge_port_ranges(rs->tcp.ports, rs->tcp.ports_len);
+	rs->udp.ports_len = nft_merge_port_ranges(rs->udp.ports, rs->udp.ports_len);
+
+	if (config->connbytes_limit != 0) {
+		rs->tcp.packets_limit = tcp_limit;
+		rs->udp.packets_limit = config->connbytes_limit;
+		if (only_quic && rs->udp.packets_limit > NFT_QUIC_PACKETS_LIMIT) {
+			rs->udp.packets_limit = NFT_QUIC_PACKETS_LIMIT;
+		}
+	}
+
+	if (config->bpf_prefilter_iface[0] != '\0') {
+		if (tcp_prefilter)
+			rs->tcp.prefilter_mark = config->bpf_prefilter_mark;
+		// The prefilter marks QUIC long header packets only
+		if (only_quic)
+			rs->udp.prefilter_mark = config->bpf_prefilter_mark;
+	}
+
+	return 0;
+
+error:
+	nft_ruleset_destroy(rs);
+	return ret;
+}
+
+void nft_ruleset_destroy(struct nft_ruleset *rs) {
+	free(rs->tcp.ports);
+	free(rs->udp.ports);
+	rs->tcp.ports = NULL;
+	rs->udp.ports = NULL;
+	rs->tcp.ports_len = 0;
+	rs->udp.ports_len = 0;
+}
+
+static int proto_rule_any_port(const struct nft_proto_rule *rule) {
+	return rule->ports_len == 1 &&
+		rule->ports[0].start == 0 && rule->ports[0].end == 65535;
+}
+
+/**
+ * nf_tables transaction. All the messages are sent with one syscall
+ * and applied by the kernel atomically.
+ */
+struct nft_batch {
+	struct mnl_nlmsg_batch *b;
+	char *buf;
+	uint32_t seq;
+	// Sequence number of the last message to be acknowledged
+	uint32_t last_seq;
+};
+
+static int nft_batch_init(struct nft_batch *nb, size_t size) {
+	// The last message may go over the limit
+	nb->buf = malloc(size * 2);
+	if (nb->buf == NULL)
+		return -ENOMEM;
+
+	nb->b = mnl_nlmsg_batch_start(nb->buf, size);
+	if (nb->b == NULL) {
+		free(nb->buf);
+		return -ENOMEM;
+	}
+
+	nb->seq = time(NULL);
+	nb->last_seq = 0;
+
+	return 0;
+}
+
+static void nft_batch_destroy(struct nft_batch *nb) {
+	mnl_nlmsg_batch_stop(nb->b);
+	free(nb->buf);
+}
+
+static struct nlmsghdr *nft_msg_put(struct nft_batch *nb, uint16_t type,
+			uint16_t flags, uint8_t family, uint16_t res_id) {
+	struct nlmsghdr *nlh = mnl_nlmsg_put_header(mnl_nlmsg_batch_current(nb->b));
+	struct nfgenmsg *nfg;
+
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = nb->seq++;
+
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+	nfg->nfgen_family = family;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(res_id);
+
+	return nlh;
+}
+
+/**
+ * Each nf_tables message is acknowledged, so the errors
+ * are reported for the exact message.
+ */
+static struct nlmsghdr *nft_msg_start(struct nft_batch *nb, uint16_t type,
+				      uint16_t flags) {
+	struct nlmsghdr *nlh = nft_msg_put(nb, (NFNL_SUBSYS_NFTABLES << 8) | type,
+			      flags | NLM_F_ACK, NFPROTO_INET, 0);
+	nb->last_seq = nlh->nlmsg_seq;
+
+	return nlh;
+}
+
+static int nft_msg_end(struct nft_batch *nb) {
+	if (!mnl_nlmsg_batch_next(nb->b))
+		return -ENOSPC;
+
+	return 0;
+}
+
+static void nft_batch_begin(struct nft_batch *nb) {
+	nft_msg_put(nb, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES);
+	mnl_nlmsg_batch_next(nb->b);
+}
+
+static int nft_batch_end(struct nft_batch *nb) {
+	nft_msg_put(nb, NFNL_MSG_BATCH_END, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES);
+	return nft_msg_end(nb);
+}
+
+/**
+ * Sends the batch and waits for the acknowledgement of the last message.
+ * Returns the first error reported by the kernel.
+ */
+static int nft_batch_send(struct nft_batch *nb) {
+	struct mnl_socket *nl;
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	ssize_t len;
+	int ret = 0;
+
+	nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (nl == NULL)
+		return -errno;
+
+	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		ret = -errno;
+		goto close;
+	}
+
+	if (mnl_socket_sendto(nl, mnl_nlmsg_batch_head(nb->b),
+		       mnl_nlmsg_batch_size(nb->b)) < 0) {
+		ret = -errno;
+		goto close;
+	}
+
+	while (1) {
+		len = mnl_socket_recvfrom(nl, buf, sizeof(buf));
+		if (len < 0) {
+			ret = -errno;
+			goto close;
+		}
+
+		const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+		int rlen = len;
+
+		for (; mnl_nlmsg_ok(nlh, rlen); nlh = mnl_nlmsg_next(nlh, &rlen)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			const struct nlmsgerr *err = mnl_nlmsg_get_payload(nlh);
+			if (err->error != 0) {
+				ret = err->error;
+				goto close;
+			}
+
+			if (nlh->nlmsg_seq == nb->last_seq)
+				goto close;
+		}
+	}
+
+close:
+	mnl_socket_close(nl);
+	return ret;
+}
+
+static struct nlattr *nft_expr_start(struct nlmsghdr *nlh, const char *name,
+				     struct nlattr **data) {
+	struct nlattr *elem = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
+
+	mnl_attr_put_strz(nlh, NFTA_EXPR_NAME, name);
+	*data = mnl_attr_nest_start(nlh, NFTA_EXPR_DATA);
+
+	return elem;
+}
+
+static void nft_expr_end(struct nlmsghdr *nlh, struct nlattr *elem,
+			 struct nlattr *data) {
+	mnl_attr_nest_end(nlh, data);
+	mnl_attr_nest_end(nlh, elem);
+}
+
+static void nft_put_data(struct nlmsghdr *nlh, uint16_t type,
+			 const void *value, size_t len) {
+	struct nlattr *nest = mnl_attr_nest_start(nlh, type);
+
+	mnl_attr_put(nlh, NFTA_DATA_VALUE, len, value);
+	mnl_attr_nest_end(nlh, nest);
+}
+
+static void nft_expr_meta(struct nlmsghdr *nlh, uint32_t key) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "meta", &data);
+
+	mnl_attr_put_u32(nlh, NFTA_META_KEY, htonl(key));
+	mnl_attr_put_u32(nlh, NFTA_META_DREG, htonl(NFT_REG_1));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_ct(struct nlmsghdr *nlh, uint32_t key, int dir) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "ct", &data);
+
+	mnl_attr_put_u32(nlh, NFTA_CT_KEY, htonl(key));
+	if (dir >= 0) {
+		mnl_attr_put_u8(nlh, NFTA_CT_DIRECTION, dir);
+	}
+	mnl_attr_put_u32(nlh, NFTA_CT_DREG, htonl(NFT_REG_1));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_payload(struct nlmsghdr *nlh, uint32_t base,
+			     uint32_t offset, uint32_t len) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "payload", &data);
+
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_DREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_BASE, htonl(base));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_OFFSET, htonl(offset));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_LEN, htonl(len));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_cmp(struct nlmsghdr *nlh, uint32_t op,
+			 const void *value, size_t len) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "cmp", &data);
+
+	mnl_attr_put_u32(nlh, NFTA_CMP_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_CMP_OP, htonl(op));
+	nft_put_data(nlh, NFTA_CMP_DATA, value, len);
+	nft_expr_end(nlh, elem, data);
+}
+
+/**
+ * reg = reg & mask
+ */
+static void nft_expr_mask32(struct nlmsghdr *nlh, uint32_t mask) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "bitwise", &data);
+	uint32_t xor = 0;
+
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_DREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_LEN, htonl(sizeof(uint32_t)));
+	nft_put_data(nlh, NFTA_BITWISE_MASK, &mask, sizeof(mask));
+	nft_put_data(nlh, NFTA_BITWISE_XOR, &xor, sizeof(xor));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_hton64(struct nlmsghdr *nlh) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "byteorder", &data);
+
+	mnl_attr_put_u32(nlh, NFTA_BYTEORDER_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BYTEORDER_DREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BYTEORDER_OP, htonl(NFT_BYTEORDER_HTON));
+	mnl_attr_put_u32(nlh, NFTA_BYTEORDER_LEN, htonl(sizeof(uint64_t)));
+	mnl_attr_put_u32(nlh, NFTA_BYTEORDER_SIZE, htonl(sizeof(uint64_t)));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_lookup(struct nlmsghdr *nlh, const char *set,
+			    uint32_t set_id) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "lookup", &data);
+
+	mnl_attr_put_strz(nlh, NFTA_LOOKUP_SET, set);
+	mnl_attr_put_u32(nlh, NFTA_LOOKUP_SET_ID, htonl(set_id));
+	mnl_attr_put_u32(nlh, NFTA_LOOKUP_SREG, htonl(NFT_REG_1));
+	nft_expr_end(nlh, elem, data);
+}
+
+/**
+ * update @<set> { reg }
+ * Restarts the set timeout of the element, which re-adding it does not
+ * do on every kernel.
+ */
+static void nft_expr_dynset_update(struct nlmsghdr *nlh, const char *set,
+				   uint32_t set_id) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "dynset", &data);
+
+	mnl_attr_put_strz(nlh, NFTA_DYNSET_SET_NAME, set);
+	mnl_attr_put_u32(nlh, NFTA_DYNSET_SET_ID, htonl(set_id));
+	mnl_attr_put_u32(nlh, NFTA_DYNSET_OP, htonl(NFT_DYNSET_OP_UPDATE));
+	mnl_attr_put_u32(nlh, NFTA_DYNSET_SREG_KEY, htonl(NFT_REG_1));
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_counter(struct nlmsghdr *nlh) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "counter", &data);
+
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_accept(struct nlmsghdr *nlh) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "immediate", &data);
+	struct nlattr *idata, *verdict;
+
+	mnl_attr_put_u32(nlh, NFTA_IMMEDIATE_DREG, htonl(NFT_REG_VERDICT));
+	idata = mnl_attr_nest_start(nlh, NFTA_IMMEDIATE_DATA);
+	verdict = mnl_attr_nest_start(nlh, NFTA_DATA_VERDICT);
+	mnl_attr_put_u32(nlh, NFTA_VERDICT_CODE, htonl(NF_ACCEPT));
+	mnl_attr_nest_end(nlh, verdict);
+	mnl_attr_nest_end(nlh, idata);
+	nft_expr_end(nlh, elem, data);
+}
+
+static void nft_expr_queue(struct nlmsghdr *nlh, uint16_t num, uint16_t total) {
+	struct nlattr *data;
+	struct nlattr *elem = nft_expr_start(nlh, "queue", &data);
+
+	mnl_attr_put_u16(nlh, NFTA_QUEUE_NUM, htons(num));
+	mnl_attr_put_u16(nlh, NFTA_QUEUE_TOTAL, htons(total));
+	mnl_attr_put_u16(nlh, NFTA_QUEUE_FLAGS, htons(NFT_QUEUE_FLAG_BYPASS));
+	nft_expr_end(nlh, elem, data);
+}
+
+static int nft_put_table(struct nft_batch *nb, uint16_t type, uint16_t flags) {
+	struct nlmsghdr *nlh = nft_msg_start(nb, type, flags);
+
+	mnl_attr_put_strz(nlh, NFTA_TABLE_NAME, NFT_TABLE_NAME);
+	return nft_msg_end(nb);
+}
+
+static int nft_put_port_set(struct nft_batch *nb, const char *name,
+			    uint32_t set_id, const struct nft_proto_rule *rule) {
+	struct nlmsghdr *nlh;
+	struct nlattr *elems, *elem, *key;
+	int ret;
+
+	nlh = nft_msg_start(nb, NFT_MSG_NEWSET, NLM_F_CREATE);
+	mnl_attr_put_strz(nlh, NFTA_SET_TABLE, NFT_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_SET_NAME, name);
+	mnl_attr_put_u32(nlh, NFTA_SET_ID, htonl(set_id));
+	mnl_attr_put_u32(nlh, NFTA_SET_FLAGS,
+		  htonl(NFT_SET_INTERVAL | NFT_SET_CONSTANT));
+	mnl_attr_put_u32(nlh, NFTA_SET_KEY_TYPE, htonl(NFT_TYPE_INET_SERVICE));
+	mnl_attr_put_u32(nlh, NFTA_SET_KEY_LEN, htonl(sizeof(uint16_t)));
+	if ((ret = nft_msg_end(nb)) < 0)
+		return ret;
+
+	nlh = nft_msg_start(nb, NFT_MSG_NEWSETELEM, NLM_F_CREATE);
+	mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_SET, name);
+	mnl_attr_put_u32(nlh, NFTA_SET_ELEM_LIST_SET_ID, htonl(set_id));
+	elems = mnl_attr_nest_start(nlh, NFTA_SET_ELEM_LIST_ELEMENTS);
+
+	/**
+	 * Interval [start, end] is the start element
+	 * and the end flagged element after the last port.
+	 */
+	for (int i = 0; i < rule->ports_len; i++) {
+		uint16_t start = htons(rule->ports[i].start);
+
+		elem = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
+		key = mnl_attr_nest_start(nlh, NFTA_SET_ELEM_KEY);
+		mnl_attr_put(nlh, NFTA_DATA_VALUE, sizeof(start), &start);
+		mnl_attr_nest_end(nlh, key);
+		mnl_attr_nest_end(nlh, elem);
+
+		if (rule->ports[i].end == 65535)
+			continue;
+
+		uint16_t end = htons(rule->ports[i].end + 1);
+
+		elem = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
+		mnl_attr_put_u32(nlh, NFTA_SET_ELEM_FLAGS,
+			htonl(NFT_SET_ELEM_INTERVAL_END));
+		key = mnl_attr_nest_start(nlh, NFTA_SET_ELEM_KEY);
+		mnl_attr_put(nlh, NFTA_DATA_VALUE, sizeof(end), &end);
+		mnl_attr_nest_end(nlh, key);
+		mnl_attr_nest_end(nlh, elem);
+	}
+
+	mnl_attr_nest_end(nlh, elems);
+	return nft_msg_end(nb);
+}
+
+static int nft_put_target_set(struct nft_batch *nb, const char *name,
+			      uint32_t set_id, uint32_t key_type,
+			      uint32_t key_len, unsigned int timeout) {
+	struct nlmsghdr *nlh;
+
+	nlh = nft_msg_start(nb, NFT_MSG_NEWSET, NLM_F_CREATE);
+	mnl_attr_put_strz(nlh, NFTA_SET_TABLE, NFT_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_SET_NAME, name);
+	mnl_attr_put_u32(nlh, NFTA_SET_ID, htonl(set_id));
+	// Updated by the queue rules with --nft-targets-only
+	mnl_attr_put_u32(nlh, NFTA_SET_FLAGS,
+		  htonl(NFT_SET_TIMEOUT | NFT_SET_EVAL));
+	mnl_attr_put_u32(nlh, NFTA_SET_KEY_TYPE, htonl(key_type));
+	mnl_attr_put_u32(nlh, NFTA_SET_KEY_LEN, htonl(key_len));
+	mnl_attr_put_u64(nlh, NFTA_SET_TIMEOUT, htobe64((uint64_t)timeout * 1000));
+
+	return nft_msg_end(nb);
+}
+
+static int nft_put_chain(struct nft_batch *nb) {
+	struct nlmsghdr *nlh;
+	struct nlattr *hook;
+
+	nlh = nft_msg_start(nb, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	mnl_attr_put_strz(nlh, NFTA_CHAIN_TABLE, NFT_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_CHAIN_NAME, NFT_CHAIN_NAME);
+	hook = mnl_attr_nest_start(nlh, NFTA_CHAIN_HOOK);
+	mnl_attr_put_u32(nlh, NFTA_HOOK_HOOKNUM, htonl(NF_INET_POST_ROUTING));
+	mnl_attr_put_u32(nlh, NFTA_HOOK_PRIORITY, htonl(NFT_CHAIN_PRIORITY));
+	mnl_attr_nest_end(nlh, hook);
+	mnl_attr_put_u32(nlh, NFTA_CHAIN_POLICY, htonl(NF_ACCEPT));
+	mnl_attr_put_strz(nlh, NFTA_CHAIN_TYPE, "filter");
+
+	return nft_msg_end(nb);
+}
+
+static struct nlmsghdr *nft_rule_start(struct nft_batch *nb,
+				       struct nlattr **exprs) {
+	struct nlmsghdr *nlh;
+
+	nlh = nft_msg_start(nb, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, NFT_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_RULE_CHAIN, NFT_CHAIN_NAME);
+	*exprs = mnl_attr_nest_start(nlh, NFTA_RULE_EXPRESSIONS);
+
+	return nlh;
+}
+
+static int nft_rule_end(struct nft_batch *nb, struct nlmsghdr *nlh,
+			struct nlattr *exprs) {
+	mnl_attr_nest_end(nlh, exprs);
+	return nft_msg_end(nb);
+}
+
+/**
+ * meta mark and <mark> == <mark> accept
+ * or
+ * ct mark and <mark> == <mark> accept
+ */
+static int nft_put_mark_rule(struct nft_batch *nb, int ct, uint32_t mark) {
+	struct nlattr *exprs;
+	struct nlmsghdr *nlh = nft_rule_start(nb, &exprs);
+
+	if (ct) {
+		nft_expr_ct(nlh, NFT_CT_MARK, -1);
+	} else {
+		nft_expr_meta(nlh, NFT_META_MARK);
+	}
+	// Marks are in host byte order
+	nft_expr_mask32(nlh, mark);
+	nft_expr_cmp(nlh, NFT_CMP_EQ, &mark, sizeof(mark));
+	nft_expr_counter(nlh);
+	nft_expr_accept(nlh);
+
+	return nft_rule_end(nb, nlh, exprs);
+}
+
+/**
+ * [meta nfproto <family>] meta l4proto <proto>
+ * [ip daddr @targets4 update @targets4 { ip daddr } |
+ *  ip6 daddr @targets6 update @targets6 { ip6 daddr }] [th dport @<set>]
+ * [ct original packets < <limit + 1>] [meta mark and <pmark> == <pmark>]
+ * counter queue num <A-B> bypass
+ *
+ * family is NFPROTO_UNSPEC for both IPv4 and IPv6.
+ */
+static int nft_put_queue_rule(struct nft_batch *nb, const struct nft_ruleset *rs,
+			      uint8_t family, uint8_t proto,
+			      const char *set, uint32_t set_id,
+			      const struct nft_proto_rule *rule) {
+	struct nlattr *exprs;
+	struct nlmsghdr *nlh = nft_rule_start(nb, &exprs);
+
+	if (family == NFPROTO_UNSPEC && !rs->use_ipv6)
+		family = NFPROTO_IPV4;
+
+	if (family != NFPROTO_UNSPEC) {
+		nft_expr_meta(nlh, NFT_META_NFPROTO);
+		nft_expr_cmp(nlh, NFT_CMP_EQ, &family, sizeof(family));
+	}
+
+	nft_expr_meta(nlh, NFT_META_L4PROTO);
+	nft_expr_cmp(nlh, NFT_CMP_EQ, &proto, sizeof(proto));
+
+	if (rs->targets_only && family == NFPROTO_IPV4) {
+		// IPv4 destination address
+		nft_expr_payload(nlh, NFT_PAYLOAD_NETWORK_HEADER, 16, 4);
+		nft_expr_lookup(nlh, NFT_TARGETS4_SET, NFT_TARGETS4_SET_ID);
+		nft_expr_dynset_update(nlh, NFT_TARGETS4_SET, NFT_TARGETS4_SET_ID);
+	} else if (rs->targets_only && family == NFPROTO_IPV6) {
+		// IPv6 destination address
+		nft_expr_payload(nlh, NFT_PAYLOAD_NETWORK_HEADER, 24, 16);
+		nft_expr_lookup(nlh, NFT_TARGETS6_SET, NFT_TARGETS6_SET_ID);
+		nft_expr_dynset_update(nlh, NFT_TARGETS6_SET, NFT_TARGETS6_SET_ID);
+	}
+
+	if (!proto_rule_any_port(rule)) {
+		// Destination port is at the same offset for TCP and UDP
+		nft_expr_payload(nlh, NFT_PAYLOAD_TRANSPORT_HEADER, 2, sizeof(uint16_t));
+		nft_expr_lookup(nlh, set, set_id);
+	}
+
+	if (rule->packets_limit) {
+		uint64_t limit = htobe64((uint64_t)rule->packets_limit + 1);
+
+		nft_expr_ct(nlh, NFT_CT_PKTS, NFT_CT_DIR_ORIGINAL);
+		nft_expr_hton64(nlh);
+		nft_expr_cmp(nlh, NFT_CMP_LT, &limit, sizeof(limit));
+	}
+
+	if (rule->prefilter_mark) {
+		uint32_t mark = rule->prefilter_mark;
+
+		nft_expr_meta(nlh, NFT_META_MARK);
+		nft_expr_mask32(nlh, mark);
+		nft_expr_cmp(nlh, NFT_CMP_EQ, &mark, sizeof(mark));
+	}
+
+	nft_expr_counter(nlh);
+	nft_expr_queue(nlh, rs->queue_start_num, rs->queue_total);
+
+	return nft_rule_end(nb, nlh, exprs);
+}
+
+/**
+ * [meta nfproto ipv4] meta l4proto udp udp sport 53 counter queue num <dns> bypass
+ */
+static int nft_put_dns_rule(struct nft_batch *nb, const struct nft_ruleset *rs) {
+	struct nlattr *exprs;
+	struct nlmsghdr *nlh = nft_rule_start(nb, &exprs);
+	uint8_t proto = IPPROTO_UDP;
+	uint16_t sport = htons(DNS_PORT);
+
+	if (!rs->use_ipv6) {
+		uint8_t nfproto = NFPROTO_IPV4;
+		nft_expr_meta(nlh, NFT_META_NFPROTO);
+		nft_expr_cmp(nlh, NFT_CMP_EQ, &nfproto, sizeof(nfproto));
+	}
+
+	nft_expr_meta(nlh, NFT_META_L4PROTO);
+	nft_expr_cmp(nlh, NFT_CMP_EQ, &proto, sizeof(proto));
+	nft_expr_payload(nlh, NFT_PAYLOAD_TRANSPORT_HEADER, 0, sizeof(sport));
+	nft_expr_cmp(nlh, NFT_CMP_EQ, &sport, sizeof(sport));
+	nft_expr_counter(nlh);
+	nft_expr_queue(nlh, rs->dns_queue_num, 1);
+
+	return nft_rule_end(nb, nlh, exprs);
+}
+
+static int nft_put_proto(struct nft_batch *nb, const struct nft_ruleset *rs,
+			 uint8_t proto, const char *set, uint32_t set_id,
+			 const struct nft_proto_rule *rule) {
+	int ret;
+
+	if (!rule->enabled)
+		return 0;
+
+	if (!proto_rule_any_port(rule)) {
+		ret = nft_put_port_set(nb, set, set_id, rule);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (!rs->targets_only) {
+		return nft_put_queue_rule(nb, rs, NFPROTO_UNSPEC, proto,
+			    set, set_id, rule);
+	}
+
+	// The address sets are per family
+	ret = nft_put_queue_rule(nb, rs, NFPROTO_IPV4, proto, set, set_id, rule);
+	if (ret < 0 || !rs->use_ipv6)
+		return ret;
+
+	return nft_put_queue_rule(nb, rs, NFPROTO_IPV6, proto, set, set_id, rule);
+}
+
+static int nft_put_target_sets(struct nft_batch *nb,
+			       const struct nft_ruleset *rs) {
+	int ret;
+
+	if (!rs->learn_timeout)
+		return 0;
+
+	ret = nft_put_target_set(nb, NFT_TARGETS4_SET, NFT_TARGETS4_SET_ID,
+			  NFT_TYPE_IPADDR, 4, rs->learn_timeout);
+	if (ret < 0 || !rs->use_ipv6)
+		return ret;
+
+	return nft_put_target_set(nb, NFT_TARGETS6_SET, NFT_TARGETS6_SET_ID,
+			   NFT_TYPE_IP6ADDR, 16, rs->learn_timeout);
+}
+
+int nft_rules_install(const struct nft_ruleset *rs) {
+	struct nft_batch nb;
+	int ret;
+
+	ret = nft_batch_init(&nb, MNL_SOCKET_BUFFER_SIZE +
+		(rs->tcp.ports_len + rs->udp.ports_len) * NFT_ELEM_MAXSIZE);
+	if (ret < 0)
+		return ret;
+
+	nft_batch_begin(&nb);
+
+	// Creating the table before deleting it makes the deletion never fail
+	if ((ret = nft_put_table(&nb, NFT_MSG_NEWTABLE, NLM_F_CREATE)) < 0 ||
+		(ret = nft_put_table(&nb, NFT_MSG_DELTABLE, 0)) < 0 ||
+		(ret = nft_put_table(&nb, NFT_MSG_NEWTABLE, NLM_F_CREATE)) < 0 ||
+		(ret = nft_put_chain(&nb)) < 0 ||
+		(ret = nft_put_mark_rule(&nb, 0, rs->mark)) < 0) {
+		goto out;
+	}
+
+	if (rs->connmark &&
+		(ret = nft_put_mark_rule(&nb, 1, rs->connmark)) < 0) {
+		goto out;
+	}
+
+	if (rs->dns_queue_num >= 0 &&
+		(ret = nft_put_dns_rule(&nb, rs)) < 0) {
+		goto out;
+	}
+
+	if ((ret = nft_put_target_sets(&nb, rs)) < 0 ||
+		(ret = nft_put_proto(&nb, rs, IPPROTO_TCP,
+			  NFT_TCP_SET, NFT_TCP_SET_ID, &rs->tcp)) < 0 ||
+		(ret = nft_put_proto(&nb, rs, IPPROTO_UDP,
+			  NFT_UDP_SET, NFT_UDP_SET_ID, &rs->udp)) < 0 ||
+		(ret = nft_batch_end(&nb)) < 0) {
+		goto out;
+	}
+
+	ret = nft_batch_send(&nb);
+
+out:
+	nft_batch_destroy(&nb);
+	return ret;
+}
+
+int nft_rules_remove(void) {
+	struct nft_batch nb;
+	int ret;
+
+	ret = nft_batch_init(&nb, MNL_SOCKET_BUFFER_SIZE);
+	if (ret < 0)
+		return ret;
+
+	nft_batch_begin(&nb);
+	if ((ret = nft_put_table(&nb, NFT_MSG_DELTABLE, 0)) < 0 ||
+		(ret = nft_batch_end(&nb)) < 0) {
+		goto out;
+	}
+
+	ret = nft_batch_send(&nb);
+	if (ret == -ENOENT)
+		ret = 0;
+
+out:
+	nft_batch_destroy(&nb);
+	return ret;
+}
+
+// Fits NFT_LEARN_BATCH elements with the transaction messages
+#define NFT_LEARN_BATCH_SIZE (MNL_SOCKET_BUFFER_SIZE + \
+	NFT_LEARN_BATCH * NFT_ELEM_MAXSIZE)
+
+int nft_learner_init(struct nft_learner *l) {
+	int ret;
+
+	*l = (struct nft_learner){0};
+
+	l->batch = malloc(sizeof(struct nft_batch));
+	if (l->batch == NULL)
+		return -ENOMEM;
+
+	ret = nft_batch_init(l->batch, NFT_LEARN_BATCH_SIZE);
+	if (ret < 0)
+		goto free_batch;
+
+	l->nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (l->nl == NULL) {
+		ret = -errno;
+		goto destroy_batch;
+	}
+
+	if (mnl_socket_bind(l->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		ret = -errno;
+		goto close;
+	}
+
+	return 0;
+
+close:
+	mnl_socket_close(l->nl);
+	l->nl = NULL;
+destroy_batch:
+	nft_batch_destroy(l->batch);
+free_batch:
+	free(l->batch);
+	l->batch = NULL;
+	return ret;
+}
+
+void nft_learner_destroy(struct nft_learner *l) {
+	if (l->nl == NULL)
+		return;
+
+	mnl_socket_close(l->nl);
+	nft_batch_destroy(l->batch);
+	free(l->batch);
+	*l = (struct nft_learner){0};
+}
+
+static size_t target_addr_len(int family) {
+	return family == AF_INET ? 4 : 16;
+}
+
+int nft_learner_add(struct nft_learner *l, int family, const void *addr,
+		    uint64_t timeout) {
+	size_t addr_len = target_addr_len(family);
+	struct nft_target *t;
+	int ret;
+
+	for (int i = 0; i < l->len; i++) {
+		t = &l->targets[i];
+		if (t->family == family && !memcmp(t->addr, addr, addr_len)) {
+			if (t->timeout && (timeout == 0 || timeout > t->timeout))
+				t->timeout = timeout;
+			return 0;
+		}
+	}
+
+	if (l->len == NFT_LEARN_BATCH && (ret = nft_learner_flush(l)) < 0)
+		return ret;
+
+	t = &l->targets[l->len++];
+	t->family = family;
+	memcpy(t->addr, addr, addr_len);
+	t->timeout = timeout;
+
+	return 1;
+}
+
+/**
+ * Reads the errors reported for the previous flushes.
+ * Returns the last one.
+ */
+static int nft_learner_read_errors(struct nft_learner *l) {
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	ssize_t len;
+	int ret = 0;
+
+	while ((len = recv(mnl_socket_get_fd(l->nl), buf, sizeof(buf),
+			MSG_DONTWAIT)) > 0) {
+		const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+		int rlen = len;
+
+		for (; mnl_nlmsg_ok(nlh, rlen); nlh = mnl_nlmsg_next(nlh, &rlen)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			const struct nlmsgerr *err = mnl_nlmsg_get_payload(nlh);
+			if (err->error != 0)
+				ret = err->error;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Puts the queued addresses of the family as one message.
+ * Without NLM_F_ACK the kernel replies only on errors. An address still
+ * in the set may keep its old expiration, the queue rules restart it.
+ */
+static int nft_put_learned(struct nft_learner *l, int family,
+			   const char *set) {
+	struct nft_batch *nb = l->batch;
+	struct nlmsghdr *nlh = NULL;
+	struct nlattr *elems = NULL;
+	struct nlattr *elem, *key;
+
+	for (int i = 0; i < l->len; i++) {
+		const struct nft_target *t = &l->targets[i];
+
+		if (t->family != family)
+			continue;
+
+		if (nlh == NULL) {
+			nlh = nft_msg_put(nb, (NFNL_SUBSYS_NFTABLES << 8) |
+				NFT_MSG_NEWSETELEM, NLM_F_CREATE,
+				NFPROTO_INET, 0);
+			mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_TABLE, NFT_TABLE_NAME);
+			mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_SET, set);
+			elems = mnl_attr_nest_start(nlh, NFTA_SET_ELEM_LIST_ELEMENTS);
+		}
+
+		elem = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
+		key = mnl_attr_nest_start(nlh, NFTA_SET_ELEM_KEY);
+		mnl_attr_put(nlh, NFTA_DATA_VALUE, target_addr_len(family), t->addr);
+		mnl_attr_nest_end(nlh, key);
+		if (t->timeout) {
+			mnl_attr_put_u64(nlh, NFTA_SET_ELEM_TIMEOUT,
+				htobe64(t->timeout));
+		}
+		mnl_attr_nest_end(nlh, elem);
+	}
+
+	if (nlh == NULL)
+		return 0;
+
+	mnl_attr_nest_end(nlh, elems);
+	return nft_msg_end(nb);
+}
+
+int nft_learner_flush(struct nft_learner *l) {
+	struct nft_batch *nb = l->batch;
+	int ret;
+
+	ret = nft_learner_read_errors(l);
+	if (ret < 0) {
+		lgerror(ret, "Unable to add the learned targets");
+	}
+
+	if (l->len == 0)
+		return 0;
+
+	mnl_nlmsg_batch_reset(nb->b);
+	nft_batch_begin(nb);
+
+	if ((ret = nft_put_learned(l, AF_INET, NFT_TARGETS4_SET)) < 0 ||
+		(ret = nft_put_learned(l, AF_INET6, NFT_TARGETS6_SET)) < 0 ||
+		(ret = nft_batch_end(nb)) < 0) {
+		goto out;
+	}
+
+	ret = 0;
+	if (mnl_socket_sendto(l->nl, mnl_nlmsg_batch_head(nb->b),
+		       mnl_nlmsg_batch_size(nb->b)) < 0) {
+		ret = -errno;
+	}
+
+out:
+	l->len = 0;
+	return ret;
+}
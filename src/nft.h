@@ -0,0 +1,149 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef YU_NFT_H
+#define YU_NFT_H
+
+/**
+ * nftables rules for the queue, compiled from the sections config.
+ *
+ * Only the traffic some section is able to process is queued:
+ * the ports are gathered from the sections and merged into
+ * interval sets, the connection packets limits are set per protocol.
+ * The table is installed with one nf_tables transaction
+ * over netlink, so no nft binary or libnftnl is needed.
+ */
+
+#include "types.h"
+#include "config.h"
+
+#define NFT_TABLE_NAME "youtubeUnblock"
+
+// QUIC Initial messages are in the first packets of the connection
+#define NFT_QUIC_PACKETS_LIMIT 8
+
+// Timeout sets of the learned target destinations
+#define NFT_TARGETS4_SET "targets4"
+#define NFT_TARGETS6_SET "targets6"
+
+// Number of addresses the learner holds before it flushes itself
+#define NFT_LEARN_BATCH 64
+
+struct nft_proto_rule {
+	// Some section processes the protocol
+	int enabled;
+	/**
+	 * Sorted and merged destination ports.
+	 * Single 0-65535 range means any port.
+	 */
+	struct dport_range *ports;
+	int ports_len;
+	/**
+	 * Only the connections with at most this number of packets
+	 * in the original direction are queued. 0 means no limit.
+	 */
+	unsigned int packets_limit;
+	/**
+	 * Only the packets marked by the BPF prefilter are queued.
+	 * Set when the prefilter sees all the packets the sections
+	 * need. 0 to disable
+	 */
+	uint32_t prefilter_mark;
+};
+
+struct nft_ruleset {
+	struct nft_proto_rule tcp;
+	struct nft_proto_rule udp;
+	int use_ipv6;
+	// Packets sent by youtubeUnblock are accepted
+	uint32_t mark;
+	// Connections with this conntrack mark are accepted. 0 to disable
+	uint32_t connmark;
+	int queue_start_num;
+	int queue_total;
+	/**
+	 * Default timeout of the learned targets in seconds.
+	 * 0 disables the targets sets.
+	 */
+	unsigned int learn_timeout;
+	// Only the flows to the learned targets are queued
+	int targets_only;
+	// Queue of the DNS responses, -1 if they are not queued
+	int dns_queue_num;
+};
+
+/**
+ * Sorts the ranges and merges the overlapping and adjacent ones in place.
+ * Returns the new number of ranges.
+ */
+int nft_merge_port_ranges(struct dport_range *ranges, int len);
+
+/**
+ * Compiles the config into the ruleset.
+ * Free it with nft_ruleset_destroy.
+ */
+int nft_ruleset_compile(const struct config_t *config, struct nft_ruleset *rs);
+void nft_ruleset_destroy(struct nft_ruleset *rs);
+
+/**
+ * Atomically replaces NFT_TABLE_NAME table with the ruleset.
+ */
+int nft_rules_install(const struct nft_ruleset *rs);
+
+/**
+ * Deletes NFT_TABLE_NAME table. Missing table is not an error.
+ */
+int nft_rules_remove(void);
+
+struct nft_target {
+	int family;
+	uint8_t addr[16];
+	// Milliseconds, 0 for the set default timeout
+	uint64_t timeout;
+};
+
+/**
+ * Adds the target destinations to the targets sets.
+ * The addresses are gathered and sent with one transaction on flush,
+ * so a whole receive batch costs one syscall. The kernel replies
+ * only on errors, they are read on the next flush.
+ */
+struct mnl_socket;
+struct nft_batch;
+
+struct nft_learner {
+	struct mnl_socket *nl;
+	struct nft_batch *batch;
+	struct nft_target targets[NFT_LEARN_BATCH];
+	int len;
+};
+
+int nft_learner_init(struct nft_learner *l);
+void nft_learner_destroy(struct nft_learner *l);
+
+/**
+ * Queues the address for the next flush. The address already
+ * queued is skipped. Flushes the learner when it is full.
+ * Returns 1 if the address is queued, 0 if it was queued already.
+ */
+int nft_learner_add(struct nft_learner *l, int family, const void *addr,
+		    uint64_t timeout);
+int nft_learner_flush(struct nft_learner *l);
+
+#endif /* YU_NFT_H */
@@ -0,0 +1,93 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef KERNEL_SPACE
+#error "path mtu lookups are userspace only"
+#endif
+
+#include "pmtu.h"
+#include "config.h"
+#include "utils.h"
+#include "logging.h"
+
+#include <stddef.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <sys/socket.h>
+
+// Minimal MTU of the protocols
+#define PMTU_MIN4 576
+#define PMTU_MIN6 1280
+
+static pmtu_query_t pmtu_query = NULL;
+
+void pmtu_set_query(pmtu_query_t query) {
+	pmtu_query = query;
+}
+
+size_t pmtu_get(const uint8_t *pkt, size_t pktlen) {
+	const uint8_t *daddr;
+	unsigned int mtu;
+	size_t min;
+	int family;
+	int ret;
+
+	if (pmtu_query == NULL)
+		return AVAILABLE_MTU;
+
+	switch (netproto_version(pkt, pktlen)) {
+	case IP4VERSION:
+		if (pktlen < sizeof(struct iphdr))
+			return AVAILABLE_MTU;
+		family = AF_INET;
+		min = PMTU_MIN4;
+		daddr = pkt + offsetof(struct iphdr, daddr);
+		break;
+	case IP6VERSION:
+		if (pktlen < sizeof(struct ip6_hdr))
+			return AVAILABLE_MTU;
+		family = AF_INET6;
+		min = PMTU_MIN6;
+		daddr = pkt + offsetof(struct ip6_hdr, ip6_dst);
+		break;
+	default:
+		return AVAILABLE_MTU;
+	}
+
+	ret = pmtu_query(family, daddr, &mtu);
+	if (ret < 0) {
+		lgtrace_addp("path mtu unresolved: %d", ret);
+		return AVAILABLE_MTU;
+	}
+
+	if (mtu > MAX_SEND_MTU)
+		mtu = MAX_SEND_MTU;
+	if (mtu < min)
+		mtu = min;
+
+	return mtu;
+}
+
+size_t pmtu_segment_len(const uint8_t *pkt, size_t pktlen) {
+	size_t mtu = pmtu_get(pkt, pktlen);
+
+	return pktlen > mtu ? mtu : 0;
+}
@@ -0,0 +1,60 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PMTU_H
+#define PMTU_H
+
+/**
+ * Path MTU of the raw packets destinations.
+ *
+ * The MTU is taken from the kernel route of the destination, so the
+ * path MTU learned from ICMP fragmentation needed and the smaller MTU
+ * of PPPoE or tunnel uplinks are followed. Routes without the MTU
+ * metric take the MTU of the egress interface. The lookups go through
+ * the route cache of the thread, see route_cache.h.
+ */
+
+#include "types.h"
+
+/**
+ * Looks up the MTU towards the address of the family.
+ * Returns 0 or a negative error if the route is unknown.
+ */
+typedef int (*pmtu_query_t)(int family, const uint8_t *addr, unsigned int *mtu);
+
+/**
+ * Sets the lookup used by all the threads. AVAILABLE_MTU is used
+ * without it.
+ */
+void pmtu_set_query(pmtu_query_t query);
+
+/**
+ * Returns the MTU towards the destination of the IP packet, clamped to
+ * MAX_SEND_MTU and to the minimal MTU of the protocol. AVAILABLE_MTU is
+ * returned when the route is unknown.
+ */
+size_t pmtu_get(const uint8_t *pkt, size_t pktlen);
+
+/**
+ * Returns the size of the segments the IP packet should be split to,
+ * or 0 if it fits the path MTU.
+ */
+size_t pmtu_segment_len(const uint8_t *pkt, size_t pktlen);
+
+#endif /* PMTU_H */
@@ -21,6 +21,10 @@
 #include "tls.h"
 #include "logging.h"
 
+#ifndef KERNEL_SPACE
+#include "verdict_cache.h"
+#endif
+
 
 /**
  * Packet number.
@@ -468,8 +472,94 @@ int is_stun_message(const uint8_t *data, size_t dlen) {
 	return 1;
 }
 
+void quic_initial_info_free(struct quic_initial_info *qi) {
+	free(qi->crypto_message);
+	qi->crypto_message = NULL;
+}
+
+/**
+ * Returns 1 if data is QUIC Initial. The header is parsed only once.
+ */
+static int quic_initial_probe(struct quic_initial_info *qi,
+			      const uint8_t *data, size_t dlen) {
+	const struct quic_lhdr *qch;
+	size_t qch_len;
+	struct quic_cids qci;
+	const uint8_t *quic_in_payload;
+	size_t quic_in_plen;
+	int ret;
+
+	if (qi->probed)
+		return qi->is_initial;
+
+	qi->probed = 1;
+
+	ret = quic_parse_data((uint8_t *)data, dlen,
+		 &qch, &qch_len, &qci,
+		 &quic_in_payload, &quic_in_plen);
+
+	if (ret < 0) {
+		lgtrace_addp("QUIC undefined type");
+		return 0;
+	}
+
+	lgtrace_addp("QUIC detected");
+
+	if (!quic_check_is_initial(qch)) {
+		lgtrace_addp("QUIC not initial");
+		return 0;
+	}
+
+	qi->is_initial = 1;
+	return 1;
+}
+
+/**
+ * Decrypts QUIC Initial and gathers its CRYPTO frames.
+ * The decryption is done only once.
+ */
+static int quic_initial_decrypt(struct quic_initial_info *qi,
+				const struct section_config_t *section,
+				const uint8_t *data, size_t dlen) {
+	uint8_t *decrypted_payload;
+	size_t decrypted_payload_len;
+	const uint8_t *decrypted_message;
+	size_t decrypted_message_len;
+	int ret;
+
+	if (qi->decrypted)
+		return qi->crypto_message != NULL ? 0 : -EINVAL;
+
+	qi->decrypted = 1;
+
+	ret = quic_parse_initial_message(
+		data, dlen,
+		&decrypted_payload, &decrypted_payload_len,
+		&decrypted_message, &decrypted_message_len
+	);
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = parse_quic_decrypted(section,
+		decrypted_message, decrypted_message_len,
+		&qi->crypto_message, &qi->crypto_message_len
+	);
+	free(decrypted_payload);
+	decrypted_payload = NULL;
+
+	if (ret < 0) {
+		qi->crypto_message = NULL;
+		return ret;
+	}
+
+	return 0;
+}
+
 int detect_udp_filtered(const struct section_config_t *section,
-			const uint8_t *payload, size_t plen) {
+			const uint8_t *payload, size_t plen,
+			struct quic_initial_info *qi) {
 	const void *iph;
 	size_t iph_len;
 	const struct udphdr *udph;
@@ -492,28 +582,9 @@ int detect_udp_filtered(const struct section_config_t *section,
 			goto match_port;
 
 
-		const struct quic_lhdr *qch;
-		size_t qch_len;
-		struct quic_cids qci;
-		const uint8_t *quic_in_payload;
-		size_t quic_in_plen;
-
 		lgtrace_addp("QUIC probe");
 
-		ret = quic_parse_data((uint8_t *)data, dlen, 
-			 &qch, &qch_len, &qci, 
-			 &quic_in_payload, &quic_in_plen);
-
-		if (ret < 0) {
-			lgtrace_addp("QUIC undefined type");
-			goto match_port;
-		}
-
-		lgtrace_addp("QUIC detected");
-
-			
-		if (!quic_check_is_initial(qch)) {
-			lgtrace_addp("QUIC not initial");
+		if (!quic_initial_probe(qi, data, dlen)) {
 			goto match_port;
 		}
 
@@ -524,41 +595,36 @@ int detect_udp_filtered(const struct section_config_t *section,
 			goto approve;
 		}
 
-		uint8_t *decrypted_payload;
-		size_t decrypted_payload_len;
-		const uint8_t *decrypted_message;
-		size_t decrypted_message_len;
-		uint8_t *crypto_message;
-		size_t crypto_message_len;
-		struct tls_verdict tlsv;
+#ifndef KERNEL_SPACE
+		struct vcache_key vkey;
+		int vcache_key_ok = vcache_enabled() &&
+			vcache_key_build(&vkey, iph, iph_len, IPPROTO_UDP,
+					 udph->dest, section) == 0;
 
-		ret = quic_parse_initial_message(
-			data, dlen,
-			&decrypted_payload, &decrypted_payload_len,
-			&decrypted_message, &decrypted_message_len
-		);
-
-		if (ret < 0) {
-			goto match_port;
+		if (vcache_key_ok && vcache_quic_lookup(&vkey)) {
+			lgtrace_addp("QUIC target verdict cached");
+			goto approve_target;
 		}
+#endif
 
-		ret = parse_quic_decrypted(section,
-			decrypted_message, decrypted_message_len,
-			&crypto_message, &crypto_message_len
-		);
-		free(decrypted_payload);
-		decrypted_payload = NULL;
+		struct tls_verdict tlsv;
 
-		if (ret < 0) {
+		if (quic_initial_decrypt(qi, section, data, dlen) < 0) {
 			goto match_port;
 		}
 
 		if (section->sni_detection == SNI_DETECTION_BRUTE) {
-			ret = bruteforce_analyze_sni_str(section, crypto_message, crypto_message_len, &tlsv);
+			bruteforce_analyze_sni_str(section,
+				qi->crypto_message, qi->crypto_message_len, &tlsv);
 		} else {
-			ret = analyze_tls_message(
-				section, crypto_message, crypto_message_len, &tlsv
-			);
+			if (!qi->sni_parsed) {
+				tls_message_find_sni(qi->crypto_message,
+					qi->crypto_message_len, &qi->sni);
+				qi->sni_parsed = 1;
+			}
+
+			tlsv = qi->sni;
+			tls_match_sni(section, &tlsv);
 		}
 
 		if (tlsv.sni_len != 0) {
@@ -567,13 +633,12 @@ int detect_udp_filtered(const struct section_config_t *section,
 
 		if (tlsv.target_sni) {
 			lgdebug("QUIC target SNI detected: %.*s", tlsv.sni_len, tlsv.sni_ptr);
-			free(crypto_message);
-			crypto_message = NULL;
-			goto approve;
+#ifndef KERNEL_SPACE
+			if (vcache_key_ok)
+				vcache_quic_store(&vkey);
+#endif
+			goto approve_target;
 		}
-
-		free(crypto_message);
-		crypto_message = NULL;
 	}
 
 match_port:
@@ -594,5 +659,7 @@ match_port:
 skip:
 	return 0;
 approve:
-	return 1;
+	return UDP_FILTERED;
+approve_target:
+	return UDP_FILTERED_TARGET_SNI;
 }
@@ -21,6 +21,7 @@
 #define QUIC_H
 #include "types.h"
 #include "utils.h"
+#include "tls.h"
 
 
 /**
@@ -240,7 +241,41 @@ int gen_fake_udp(struct udp_fake_type type,
 		const struct udphdr *udph,
 		uint8_t **buf, size_t *buflen);
 
+// detect_udp_filtered matched the packet
+#define UDP_FILTERED 1
+// detect_udp_filtered matched QUIC Initial with the target SNI
+#define UDP_FILTERED_TARGET_SNI 2
+
+/**
+ * QUIC Initial of the packet, parsed and decrypted once
+ * and shared by all the sections.
+ */
+struct quic_initial_info {
+	// The header is parsed, is_initial is valid
+	int probed;
+	int is_initial;
+	// The decryption is tried, crypto_message is NULL if it failed
+	int decrypted;
+	uint8_t *crypto_message;
+	size_t crypto_message_len;
+	// ClientHello SNI of crypto_message, not matched against the domains
+	int sni_parsed;
+	struct tls_verdict sni;
+};
+
+/**
+ * Frees the buffers of quic_initial_info.
+ */
+void quic_initial_info_free(struct quic_initial_info *qi);
+
+/**
+ * Returns 0 if the packet is not filtered by the section,
+ * UDP_FILTERED or UDP_FILTERED_TARGET_SNI otherwise.
+ * qi keeps the section independent QUIC parsing of the packet
+ * between the calls for different sections.
+ */
 int detect_udp_filtered(const struct section_config_t *section,
-			const uint8_t *payload, size_t plen);
+			const uint8_t *payload, size_t plen,
+			struct quic_initial_info *qi);
 
 #endif /* QUIC_H */
@@ -0,0 +1,345 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "route_cache.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <libmnl/libmnl.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+// Neighbor states the kernel itself sends to
+#define ROUTE_NUD_VALID (NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | \
+			 NUD_PERMANENT | NUD_NOARP)
+
+struct route_cache {
+	struct mnl_socket *nl;
+	uint32_t portid;
+	uint32_t seq;
+	uint32_t mark;
+	struct route_entry entries[ROUTE_CACHE_SIZE];
+};
+
+static __thread struct route_cache *thread_routes = NULL;
+
+static time_t route_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec + 1;
+}
+
+int route_cache_thread_init(uint32_t mark) {
+	struct route_cache *rc;
+	int ret;
+
+	rc = calloc(1, sizeof(struct route_cache));
+	if (rc == NULL)
+		return -ENOMEM;
+
+	rc->mark = mark;
+	rc->nl = mnl_socket_open(NETLINK_ROUTE);
+	if (rc->nl == NULL) {
+		ret = -errno;
+		goto free_cache;
+	}
+
+	if (mnl_socket_bind(rc->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		ret = -errno;
+		goto close_nl;
+	}
+	rc->portid = mnl_socket_get_portid(rc->nl);
+
+	thread_routes = rc;
+	return 0;
+
+close_nl:
+	mnl_socket_close(rc->nl);
+free_cache:
+	free(rc);
+	return ret;
+}
+
+void route_cache_thread_destroy(void) {
+	if (thread_routes == NULL)
+		return;
+
+	mnl_socket_close(thread_routes->nl);
+	free(thread_routes);
+	thread_routes = NULL;
+}
+
+static int attr_table_cb(const struct nlattr *attr, void *data) {
+	const struct nlattr **tb = data;
+
+	tb[mnl_attr_get_type(attr)] = attr;
+	return MNL_CB_OK;
+}
+
+static int metrics_attr_cb(const struct nlattr *attr, void *data) {
+	unsigned int *mtu = data;
+
+	if (mnl_attr_get_type(attr) == RTAX_MTU &&
+		mnl_attr_validate(attr, MNL_TYPE_U32) >= 0)
+		*mtu = mnl_attr_get_u32(attr);
+
+	return MNL_CB_OK;
+}
+
+static int route_attr_cb(const struct nlattr *attr, void *data) {
+	if (mnl_attr_type_valid(attr, RTA_MAX) < 0)
+		return MNL_CB_OK;
+
+	return attr_table_cb(attr, data);
+}
+
+static int route_cb(const struct nlmsghdr *nlh, void *data) {
+	struct route_entry *re = data;
+	const struct rtmsg *rtm = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[RTA_MAX + 1] = {0};
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE)
+		return MNL_CB_OK;
+
+	mnl_attr_parse(nlh, sizeof(*rtm), route_attr_cb, tb);
+
+	re->type = rtm->rtm_type;
+	if (tb[RTA_OIF] && mnl_attr_validate(tb[RTA_OIF], MNL_TYPE_U32) >= 0)
+		re->oif = mnl_attr_get_u32(tb[RTA_OIF]);
+
+	// IPv4 over IPv6 next hop is left to the kernel
+	if (tb[RTA_VIA])
+		re->type = RTN_UNSPEC;
+
+	if (tb[RTA_GATEWAY] &&
+		mnl_attr_get_payload_len(tb[RTA_GATEWAY]) <= sizeof(re->gateway)) {
+		memcpy(re->gateway, mnl_attr_get_payload(tb[RTA_GATEWAY]),
+			mnl_attr_get_payload_len(tb[RTA_GATEWAY]));
+		re->flags |= ROUTE_F_GATEWAY;
+	}
+
+	if (tb[RTA_METRICS])
+		mnl_attr_parse_nested(tb[RTA_METRICS], metrics_attr_cb, &re->mtu);
+
+	return MNL_CB_OK;
+}
+
+static int link_attr_cb(const struct nlattr *attr, void *data) {
+	unsigned int *mtu = data;
+
+	if (mnl_attr_get_type(attr) == IFLA_MTU &&
+		mnl_attr_validate(attr, MNL_TYPE_U32) >= 0)
+		*mtu = mnl_attr_get_u32(attr);
+
+	return MNL_CB_OK;
+}
+
+static int link_cb(const struct nlmsghdr *nlh, void *data) {
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return MNL_CB_OK;
+
+	return mnl_attr_parse(nlh, sizeof(struct ifinfomsg), link_attr_cb, data);
+}
+
+static int neigh_attr_cb(const struct nlattr *attr, void *data) {
+	if (mnl_attr_type_valid(attr, NDA_MAX) < 0)
+		return MNL_CB_OK;
+
+	return attr_table_cb(attr, data);
+}
+
+static int neigh_cb(const struct nlmsghdr *nlh, void *data) {
+	struct route_entry *re = data;
+	const struct ndmsg *ndm = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[NDA_MAX + 1] = {0};
+
+	if (nlh->nlmsg_type != RTM_NEWNEIGH)
+		return MNL_CB_OK;
+
+	mnl_attr_parse(nlh, sizeof(*ndm), neigh_attr_cb, tb);
+
+	if ((ndm->ndm_state & ROUTE_NUD_VALID) && tb[NDA_LLADDR] &&
+		mnl_attr_get_payload_len(tb[NDA_LLADDR]) == ETH_ALEN) {
+		memcpy(re->mac, mnl_attr_get_payload(tb[NDA_LLADDR]), ETH_ALEN);
+		re->flags |= ROUTE_F_MAC;
+	}
+
+	return MNL_CB_OK;
+}
+
+/**
+ * Sends the rtnetlink request and runs cb on the reply.
+ */
+static int route_query(struct route_cache *rc, struct nlmsghdr *nlh,
+		       mnl_cb_t cb, void *data) {
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	int ret;
+
+	nlh->nlmsg_seq = ++rc->seq;
+
+	if (mnl_socket_sendto(rc->nl, nlh, nlh->nlmsg_len) < 0)
+		return -errno;
+
+	ret = mnl_socket_recvfrom(rc->nl, buf, sizeof(buf));
+	if (ret < 0)
+		return -errno;
+
+	ret = mnl_cb_run(buf, ret, nlh->nlmsg_seq, rc->portid, cb, data);
+	return ret < 0 ? -errno : 0;
+}
+
+static size_t route_addr_len(int family) {
+	return family == AF_INET ? 4 : 16;
+}
+
+static int route_resolve(struct route_cache *rc, struct route_entry *re) {
+	char buf[256];
+	size_t alen = route_addr_len(re->family);
+	struct nlmsghdr *nlh;
+	struct rtmsg *rtm;
+
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = RTM_GETROUTE;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	rtm = mnl_nlmsg_put_extra_header(nlh, sizeof(*rtm));
+	rtm->rtm_family = re->family;
+	rtm->rtm_dst_len = alen * 8;
+	mnl_attr_put(nlh, RTA_DST, alen, re->addr);
+	// The raw socket packets are routed with the mark
+	if (rc->mark)
+		mnl_attr_put_u32(nlh, RTA_MARK, rc->mark);
+
+	return route_query(rc, nlh, route_cb, re);
+}
+
+struct route_entry *route_cache_get(int family, const uint8_t *addr) {
+	struct route_cache *rc = thread_routes;
+	size_t alen = route_addr_len(family);
+	uint32_t h = 2166136261u;
+	time_t now = route_now();
+	struct route_entry *re;
+	int ret;
+
+	if (rc == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < alen; i++)
+		h = (h ^ addr[i]) * 16777619u;
+	re = &rc->entries[h % ROUTE_CACHE_SIZE];
+
+	if (re->expires > now && re->family == family &&
+		!memcmp(re->addr, addr, alen))
+		return re->oif != 0 ? re : NULL;
+
+	*re = (struct route_entry){0};
+	re->family = family;
+	memcpy(re->addr, addr, alen);
+
+	ret = route_resolve(rc, re);
+	if (ret < 0 || re->oif == 0) {
+		lgtrace_addp("route unresolved: %d", ret);
+		re->oif = 0;
+		re->expires = now + ROUTE_CACHE_NEG_TTL;
+		return NULL;
+	}
+	re->expires = now + ROUTE_CACHE_TTL;
+
+	return re;
+}
+
+unsigned int route_cache_mtu(struct route_entry *re) {
+	struct route_cache *rc = thread_routes;
+	struct ifinfomsg *ifm;
+	struct nlmsghdr *nlh;
+	char buf[256];
+	int ret;
+
+	if ((re->flags & ROUTE_F_MTU) || re->mtu != 0)
+		return re->mtu;
+	re->flags |= ROUTE_F_MTU;
+
+	// Routes without the MTU metric take the MTU of the interface
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = RTM_GETLINK;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	ifm = mnl_nlmsg_put_extra_header(nlh, sizeof(*ifm));
+	ifm->ifi_family = AF_UNSPEC;
+	ifm->ifi_index = re->oif;
+
+	if ((ret = route_query(rc, nlh, link_cb, &re->mtu)) < 0) {
+		lgtrace_addp("link mtu unresolved: %d", ret);
+		re->mtu = 0;
+	}
+
+	return re->mtu;
+}
+
+int route_cache_neigh(struct route_entry *re) {
+	struct route_cache *rc = thread_routes;
+	size_t alen = route_addr_len(re->family);
+	struct nlmsghdr *nlh;
+	struct ndmsg *ndm;
+	char buf[256];
+	int ret;
+
+	if (re->flags & ROUTE_F_NEIGH)
+		return re->flags & ROUTE_F_MAC ? 0 : -EHOSTUNREACH;
+	re->flags |= ROUTE_F_NEIGH;
+
+	if (re->type != RTN_UNICAST)
+		return -ENETUNREACH;
+
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = RTM_GETNEIGH;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	ndm = mnl_nlmsg_put_extra_header(nlh, sizeof(*ndm));
+	ndm->ndm_family = re->family;
+	ndm->ndm_ifindex = re->oif;
+	mnl_attr_put(nlh, NDA_DST, alen,
+		re->flags & ROUTE_F_GATEWAY ? re->gateway : re->addr);
+
+	// ENOENT until the kernel resolves the neighbor itself
+	ret = route_query(rc, nlh, neigh_cb, re);
+	if (ret == 0 && !(re->flags & ROUTE_F_MAC))
+		ret = -EHOSTUNREACH;
+
+	if (ret < 0) {
+		lgtrace_addp("next hop unresolved: %d", ret);
+		// Asked again soon, the kernel resolves it meanwhile
+		time_t retry = route_now() + ROUTE_CACHE_NEG_TTL;
+		if (re->expires > retry)
+			re->expires = retry;
+	}
+
+	return ret;
+}
+
+int route_cache_path_mtu(int family, const uint8_t *addr, unsigned int *mtu) {
+	struct route_entry *re = route_cache_get(family, addr);
+
+	if (re == NULL)
+		return -ENETUNREACH;
+
+	*mtu = route_cache_mtu(re);
+	return *mtu != 0 ? 0 : -ENODEV;
+}
@@ -0,0 +1,97 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+/**
+ * Per-thread cache of the kernel routes to the raw packets destinations.
+ *
+ * A miss asks the kernel for the route of the destination, with the
+ * mark of the raw sockets. The MTU of the egress interface and the next
+ * hop MAC address are looked up only when asked for, so the path MTU
+ * lookups never touch the neighbor table and the TX ring ones
+ * share the route with them.
+ */
+
+#include "types.h"
+
+#include <time.h>
+#include <linux/if_ether.h>
+
+#define ROUTE_CACHE_SIZE 64
+// Seconds the route of a destination is trusted
+#define ROUTE_CACHE_TTL 10
+// Seconds before a failed lookup is repeated
+#define ROUTE_CACHE_NEG_TTL 1
+
+// The route has a gateway
+#define ROUTE_F_GATEWAY	0x01
+// mtu is looked up
+#define ROUTE_F_MTU	0x02
+// The next hop is looked up
+#define ROUTE_F_NEIGH	0x04
+// mac holds the next hop address
+#define ROUTE_F_MAC	0x08
+
+struct route_entry {
+	uint8_t addr[16];
+	uint8_t family;
+	// rtm_type, RTN_UNSPEC if the kernel resolves the next hop itself
+	uint8_t type;
+	uint8_t flags;
+	uint8_t mac[ETH_ALEN];
+	int oif;
+	// MTU of the route, or of its egress interface, 0 if unknown
+	unsigned int mtu;
+	uint8_t gateway[16];
+	// Monotonic seconds, 0 for the empty entry
+	time_t expires;
+};
+
+/**
+ * Opens the rtnetlink socket of the calling thread.
+ * The routes are looked up with the mark.
+ */
+int route_cache_thread_init(uint32_t mark);
+void route_cache_thread_destroy(void);
+
+/**
+ * Returns the route to the address of the family, or NULL if the thread
+ * has no cache or the kernel has no route.
+ */
+struct route_entry *route_cache_get(int family, const uint8_t *addr);
+
+/**
+ * Looks up the MTU of the route once. Returns it, or 0 if unknown.
+ */
+unsigned int route_cache_mtu(struct route_entry *re);
+
+/**
+ * Looks up the next hop MAC address of the route once.
+ * Returns 0 if the kernel has resolved the neighbor.
+ */
+int route_cache_neigh(struct route_entry *re);
+
+/**
+ * pmtu_query_t of the thread cache.
+ */
+int route_cache_path_mtu(int family, const uint8_t *addr, unsigned int *mtu);
+
+#endif /* ROUTE_CACHE_H */
@@ -0,0 +1,91 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef KERNEL_SPACE
+#error "load shedding is userspace only"
+#endif
+
+#include "shed.h"
+
+// New sample weights 1/8
+#define SHED_EWMA_DIV 8
+
+static void shed_ewma(int64_t *avg, int64_t sample) {
+	*avg += (sample - *avg) / SHED_EWMA_DIV;
+}
+
+void shed_sample_latency(struct shed_state *s, int64_t usec) {
+	if (usec < 0 || usec > SHED_MAX_SAMPLE)
+		return;
+
+	shed_ewma(&s->latency, usec);
+	++s->latency_samples;
+}
+
+int64_t shed_delay(const struct shed_state *s) {
+	return s->wait > s->latency ? s->wait : s->latency;
+}
+
+/**
+ * The backlog is drained at bytes / busy_nsec. It is counted with
+ * the kernel buffers overhead, so the estimate leans high.
+ */
+static int64_t shed_wait_sample(const struct shed_batch *b) {
+	int64_t busy = b->busy_nsec > 0 ? b->busy_nsec : 1;
+	uint64_t wait;
+
+	if (b->backlog == 0)
+		return 0;
+
+	wait = (uint64_t)b->backlog * (uint64_t)busy / b->bytes / 1000;
+
+	return wait > SHED_MAX_SAMPLE ? SHED_MAX_SAMPLE : (int64_t)wait;
+}
+
+int shed_update(struct shed_state *s, const struct shed_batch *b,
+		int64_t budget, int recv_batch) {
+	int64_t fill, delay;
+
+	if (budget == 0 || b->msgs_len <= 0 || b->bytes == 0)
+		return SHED_KEEP;
+
+	fill = (int64_t)b->msgs_len * 100 / recv_batch;
+	shed_ewma(&s->fill, fill > 100 ? 100 : fill);
+	shed_ewma(&s->wait, shed_wait_sample(b));
+
+	// Without the new timestamps the old ones must not hold the mode
+	if (s->latency_samples == 0)
+		shed_ewma(&s->latency, 0);
+	s->latency_samples = 0;
+
+	delay = shed_delay(s);
+
+	if (!s->active && delay > budget) {
+		s->active = 1;
+		return SHED_ENTER;
+	}
+
+	if (s->active && delay < budget / 2 &&
+		(recv_batch == 1 || s->fill < 50)) {
+		s->active = 0;
+		return SHED_LEAVE;
+	}
+
+	return SHED_KEEP;
+}
@@ -0,0 +1,89 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef YU_SHED_H
+#define YU_SHED_H
+
+/**
+ * Load shedding state of a queue thread.
+ *
+ * The queue wait is estimated after each receive batch as the time
+ * to drain the socket backlog at the rate the batch was processed.
+ * The backlog exists for every queued packet, unlike NFQA_TIMESTAMP:
+ * the kernel clears the timestamp of the forwarded packets before
+ * postrouting and the local ones carry their departure time. The
+ * timestamps which look like the queue latency are an extra signal.
+ */
+
+#include "types.h"
+
+// Samples over 10 seconds are the clock steps, not the latency
+#define SHED_MAX_SAMPLE 10000000
+
+struct shed_state {
+	int active;
+	// EWMA of the estimated queue wait in microseconds
+	int64_t wait;
+	// EWMA of the queue latency by NFQA_TIMESTAMP in microseconds
+	int64_t latency;
+	// Timestamps sampled since the last batch
+	int latency_samples;
+	// EWMA of the receive batch fill in percents
+	int64_t fill;
+};
+
+struct shed_batch {
+	// Messages and their bytes read with the batch
+	int msgs_len;
+	size_t bytes;
+	// Bytes left in the socket receive queue after the batch
+	size_t backlog;
+	// Time the batch was processed in
+	int64_t busy_nsec;
+};
+
+enum shed_transition {
+	SHED_KEEP,
+	SHED_ENTER,
+	SHED_LEAVE,
+};
+
+/**
+ * Samples the latency of one packet by its NFQA_TIMESTAMP.
+ * Negative and too long latencies are skipped.
+ */
+void shed_sample_latency(struct shed_state *s, int64_t usec);
+
+/**
+ * Queue delay the shedding is decided by, in microseconds.
+ */
+int64_t shed_delay(const struct shed_state *s);
+
+/**
+ * Switches the shedding after the batch. The shedding starts when the
+ * delay exceeds the budget in microseconds. It ends when the delay falls
+ * under half of the budget and the reads do not fill recv_batch,
+ * so the mode does not flap around the budget.
+ *
+ * Returns the transition made.
+ */
+int shed_update(struct shed_state *s, const struct shed_batch *b,
+		int64_t budget, int recv_batch);
+
+#endif /* YU_SHED_H */
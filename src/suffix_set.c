@@ -0,0 +1,196 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "suffix_set.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// FNV-1a step, the bytes are fed from the end of the name
+static inline uint32_t suffix_hash_step(uint32_t h, uint8_t c) {
+	return (h ^ c) * FNV_PRIME;
+}
+
+static uint32_t suffix_hash(const uint8_t *name, size_t len) {
+	uint32_t h = FNV_OFFSET;
+
+	while (len > 0) {
+		h = suffix_hash_step(h, name[--len]);
+	}
+
+	return h;
+}
+
+int suffix_set_init(struct suffix_set *set) {
+	*set = (struct suffix_set){0};
+
+	set->slots = calloc(SUFFIX_SET_STARTSZ, sizeof(struct suffix_slot));
+	set->pool = malloc(SUFFIX_SET_STARTSZ);
+	if (set->slots == NULL || set->pool == NULL) {
+		suffix_set_destroy(set);
+		return -ENOMEM;
+	}
+
+	set->cap = SUFFIX_SET_STARTSZ;
+	set->pool_cap = SUFFIX_SET_STARTSZ;
+	set->pool_sz = 1;
+
+	return 0;
+}
+
+void suffix_set_destroy(struct suffix_set *set) {
+	free(set->slots);
+	free(set->pool);
+	*set = (struct suffix_set){0};
+}
+
+static const struct suffix_slot *suffix_set_find(const struct suffix_set *set,
+						 uint32_t hash,
+						 const uint8_t *name, size_t len) {
+	size_t mask = set->cap - 1;
+
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		const struct suffix_slot *slot = &set->slots[i];
+
+		if (slot->off == 0) {
+			return slot;
+		}
+
+		if (slot->hash == hash && slot->len == len &&
+			!memcmp(set->pool + slot->off, name, len)) {
+			return slot;
+		}
+	}
+}
+
+static int suffix_set_grow(struct suffix_set *set) {
+	size_t cap = set->cap * 2;
+	struct suffix_slot *slots = calloc(cap, sizeof(struct suffix_slot));
+
+	if (slots == NULL) {
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < set->cap; i++) {
+		const struct suffix_slot *slot = &set->slots[i];
+		size_t j = slot->hash & (cap - 1);
+
+		if (slot->off == 0) {
+			continue;
+		}
+
+		while (slots[j].off != 0) {
+			j = (j + 1) & (cap - 1);
+		}
+		slots[j] = *slot;
+	}
+
+	free(set->slots);
+	set->slots = slots;
+	set->cap = cap;
+
+	return 0;
+}
+
+int suffix_set_add(struct suffix_set *set, const uint8_t *name, size_t len) {
+	struct suffix_slot *slot;
+	uint32_t hash;
+	int ret;
+
+	if (set->slots == NULL || len == 0 ||
+		set->pool_sz + len > UINT32_MAX) {
+		return -EINVAL;
+	}
+
+	// Load factor is kept under 1/2
+	if ((set->len + 1) * 2 > set->cap) {
+		ret = suffix_set_grow(set);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	hash = suffix_hash(name, len);
+	slot = (struct suffix_slot *)suffix_set_find(set, hash, name, len);
+	if (slot->off != 0) {
+		return 0;
+	}
+
+	if (set->pool_sz + len > set->pool_cap) {
+		size_t pool_cap = set->pool_cap;
+		void *pool;
+
+		while (set->pool_sz + len > pool_cap) {
+			pool_cap *= 2;
+		}
+
+		pool = realloc(set->pool, pool_cap);
+		if (pool == NULL) {
+			return -ENOMEM;
+		}
+
+		set->pool = pool;
+		set->pool_cap = pool_cap;
+	}
+
+	memcpy(set->pool + set->pool_sz, name, len);
+	*slot = (struct suffix_slot){
+		.hash = hash,
+		.off = set->pool_sz,
+		.len = len,
+	};
+	set->pool_sz += len;
+	set->len++;
+
+	return 0;
+}
+
+int suffix_set_match(const struct suffix_set *set,
+		     const uint8_t *name, size_t len,
+		     size_t *offset, size_t *offlen) {
+	uint32_t h = FNV_OFFSET;
+	int found = 0;
+
+	if (set->len == 0) {
+		return 0;
+	}
+
+	for (size_t i = len; i > 0; i--) {
+		h = suffix_hash_step(h, name[i - 1]);
+
+		// Label starts
+		if (i - 1 == 0 || name[i - 2] == '.') {
+			const uint8_t *suffix = name + i - 1;
+			size_t suffix_len = len - i + 1;
+
+			if (suffix_set_find(set, h, suffix, suffix_len)->off != 0) {
+				*offset = i - 1;
+				*offlen = suffix_len;
+				found = 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+size_t suffix_set_memsize(const struct suffix_set *set) {
+	return sizeof(*set) + sizeof(struct suffix_slot) * set->cap +
+		set->pool_cap;
+}
@@ -0,0 +1,78 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SUFFIX_SET_H
+#define SUFFIX_SET_H
+
+/**
+ * Set of the domains matched as the name suffixes on the label
+ * boundaries: youtube.com matches youtube.com and www.youtube.com,
+ * but not notyoutube.com.
+ *
+ * The domains are kept in the open addressing hash table. The hash
+ * is taken over the reversed name, so walking the name from the right
+ * gives the hash of each label suffix in turn, and a lookup is one
+ * probe per label.
+ */
+
+#include "types.h"
+
+#define SUFFIX_SET_STARTSZ 16
+
+struct suffix_slot {
+	uint32_t hash;
+	// Offset of the name in the pool, 0 for the empty slot
+	uint32_t off;
+	uint32_t len;
+};
+
+struct suffix_set {
+	// Power of two
+	size_t cap;
+	size_t len;
+	struct suffix_slot *slots;
+
+	// Names without terminators, pool[0] is unused
+	uint8_t *pool;
+	size_t pool_sz;
+	size_t pool_cap;
+};
+
+int suffix_set_init(struct suffix_set *set);
+void suffix_set_destroy(struct suffix_set *set);
+
+/**
+ * Adds the domain. Adding the domain twice is a no-op.
+ */
+int suffix_set_add(struct suffix_set *set, const uint8_t *name, size_t len);
+
+/**
+ * Finds the longest domain of the set the name ends with on the label
+ * boundary. Returns 1 and the domain position in the name on match.
+ */
+int suffix_set_match(const struct suffix_set *set,
+		     const uint8_t *name, size_t len,
+		     size_t *offset, size_t *offlen);
+
+/**
+ * Bytes taken by the set.
+ */
+size_t suffix_set_memsize(const struct suffix_set *set);
+
+#endif /* SUFFIX_SET_H */
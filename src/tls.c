@@ -28,6 +28,20 @@
 #include <unistd.h>
 #endif
 
+int tls_match_domains(const struct section_config_t *section, int exclude,
+		      const uint8_t *name, size_t len,
+		      size_t *offset, size_t *offlen) {
+	if (section->sni_matcher == SNI_MATCHER_SUFFIX) {
+		return suffix_set_match(exclude ? &section->exclude_sni_suffixes :
+				&section->sni_suffixes, name, len, offset, offlen);
+	}
+
+	// It is safe for multithreading, so dp mutability is ok
+	return trie_process_str((struct trie_container *)(exclude ?
+			&section->exclude_sni_domains : &section->sni_domains),
+		name, len, TRIE_OPT_MAP_TO_END, offset, offlen);
+}
+
 int bruteforce_analyze_sni_str(
 	const struct section_config_t *section,
 	const uint8_t *data, size_t dlen,
@@ -51,7 +65,7 @@ int bruteforce_analyze_sni_str(
 	}
 
 	// It is safe for multithreading, so dp mutability is ok
-	ret = trie_process_str((struct trie_container *)&section->sni_domains, data, dlen, 0, &offset, &offlen);
+	ret = trie_process_str((struct trie_container *)&section->sni_domains, data, dlen, TRIE_OPT_PREFILTER, &offset, &offlen);
 	if (ret) {
 		vrd->target_sni = 1;
 		vrd->sni_len = offlen;
@@ -75,9 +89,8 @@ static int analyze_sni_str(
 		goto check_domain;
 	}
 
-	// It is safe for multithreading, so dp mutability is ok
-	ret = trie_process_str((struct trie_container *)&section->sni_domains, 
-			(const uint8_t *)sni_name, sni_len, TRIE_OPT_MAP_TO_END, &offset, &offlen);
+	ret = tls_match_domains(section, 0,
+			(const uint8_t *)sni_name, sni_len, &offset, &offlen);
 	if (ret) {
 		vrd->target_sni = 1;
 		vrd->target_sni_ptr = (const uint8_t *)sni_name + offset;
@@ -87,9 +100,8 @@ static int analyze_sni_str(
 check_domain:
 	if (vrd->target_sni == 1) {
 
-		// It is safe for multithreading, so dp mutability is ok
-		ret = trie_process_str((struct trie_container *)&section->exclude_sni_domains, 
-				(const uint8_t *)sni_name, sni_len, TRIE_OPT_MAP_TO_END, &offset, &offlen);
+		ret = tls_match_domains(section, 1,
+				(const uint8_t *)sni_name, sni_len, &offset, &offlen);
 		if (ret) {
 			vrd->target_sni = 0;
 			lgdebug("Excluded SNI: %.*s", 
@@ -100,9 +112,20 @@ check_domain:
 	return 0;
 }
 
-int analyze_tls_message(
-	const struct section_config_t *section,
-	const uint8_t *message_data, 
+void tls_match_sni(const struct section_config_t *section,
+		   struct tls_verdict *vrd) {
+	vrd->target_sni = 0;
+	vrd->target_sni_ptr = vrd->sni_ptr;
+	vrd->target_sni_len = vrd->sni_len;
+
+	if (vrd->sni_ptr == NULL)
+		return;
+
+	analyze_sni_str(section, (const char *)vrd->sni_ptr, vrd->sni_len, vrd);
+}
+
+int tls_message_find_sni(
+	const uint8_t *message_data,
 	size_t message_length,
 	struct tls_verdict *tlsv
 ) {
@@ -197,7 +220,6 @@ int analyze_tls_message(
 		tlsv->target_sni_ptr = tlsv->sni_ptr;
 		tlsv->target_sni_len = tlsv->sni_len;
 
-		analyze_sni_str(section, sni_name, sni_len, tlsv);
 		return TLS_MESSAGE_ANALYZE_FOUND;
 
 nextExtension:
@@ -210,27 +232,26 @@ invalid:
 	return TLS_MESSAGE_ANALYZE_INVALID;
 }
 
-/**
- * Processes tls payload of the tcp request.
- * 
- * data Payload data of TCP.
- * dlen Length of `data`.
- */
-struct tls_verdict analyze_tls_data(
+int analyze_tls_message(
 	const struct section_config_t *section,
-	const uint8_t *data, 
-	size_t dlen) 
-{
-	struct tls_verdict vrd = {0};
+	const uint8_t *message_data,
+	size_t message_length,
+	struct tls_verdict *tlsv
+) {
+	int ret = tls_message_find_sni(message_data, message_length, tlsv);
+
+	if (ret == TLS_MESSAGE_ANALYZE_FOUND)
+		tls_match_sni(section, tlsv);
 
+	return ret;
+}
+
+int tls_find_sni(const uint8_t *data, size_t dlen, struct tls_verdict *vrd) {
 	const uint8_t *data_end = data + dlen;
 	const uint8_t *message_ptr = data;
-	int ret;
+	int ret = TLS_MESSAGE_ANALYZE_GOTO_NEXT;
 
-	if (section->sni_detection == SNI_DETECTION_BRUTE) {
-		bruteforce_analyze_sni_str(section, data, dlen, &vrd);
-		goto out;
-	}
+	*vrd = (struct tls_verdict){0};
 
 	while (message_ptr + 5 < data_end) {
 		uint8_t tls_content_type = *message_ptr;
@@ -254,11 +275,10 @@ struct tls_verdict analyze_tls_data(
 		if (tls_content_type != TLS_CONTENT_TYPE_HANDSHAKE) 
 			goto nextMessage;
 
-		ret = analyze_tls_message(
-			section,
+		ret = tls_message_find_sni(
 			tls_message_data,
 			tls_message_length,
-			&vrd
+			vrd
 		);
 
 		switch (ret) {
@@ -276,6 +296,28 @@ nextMessage:
 	}
 
 out:
+	return ret;
+}
+
+/**
+ * Processes tls payload of the tcp request.
+ *
+ * data Payload data of TCP.
+ * dlen Length of `data`.
+ */
+struct tls_verdict analyze_tls_data(
+	const struct section_config_t *section,
+	const uint8_t *data,
+	size_t dlen)
+{
+	struct tls_verdict vrd = {0};
+
+	if (section->sni_detection == SNI_DETECTION_BRUTE) {
+		bruteforce_analyze_sni_str(section, data, dlen, &vrd);
+	} else if (tls_find_sni(data, dlen, &vrd) == TLS_MESSAGE_ANALYZE_FOUND) {
+		tls_match_sni(section, &vrd);
+	}
+
 	return vrd;
 }
 
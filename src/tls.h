@@ -45,6 +45,31 @@ struct tls_verdict {
 #define TLS_MESSAGE_ANALYZE_FOUND	0
 #define TLS_MESSAGE_ANALYZE_GOTO_NEXT	1
 
+/**
+ * Finds the SNI of TLS Client Hello message without matching it
+ * against the domains. sni_ptr stays NULL if there is no SNI.
+ * Returns TLS_MESSAGE_ANALYZE_* status.
+ */
+int tls_message_find_sni(
+	const uint8_t *message_data,
+	size_t message_length,
+	struct tls_verdict *tlsv
+);
+
+/**
+ * Finds the Client Hello SNI in the TLS records of the TCP payload.
+ * Returns TLS_MESSAGE_ANALYZE_FOUND if the SNI is found.
+ */
+int tls_find_sni(const uint8_t *data, size_t dlen, struct tls_verdict *vrd);
+
+/**
+ * Matches the SNI found by tls_find_sni or tls_message_find_sni
+ * against the section domains and sets the target fields of vrd.
+ * The SNI is parsed once per packet and matched by every section.
+ */
+void tls_match_sni(const struct section_config_t *section,
+		   struct tls_verdict *vrd);
+
 /**
  * Analyzes each TLS Client Hello message (inside TLS Record or QUIC CRYPTO FRAME)
  */
@@ -55,6 +80,15 @@ int analyze_tls_message(
 	struct tls_verdict *tlsv
 );
 
+/**
+ * Matches the name against the section sni_domains, or exclude_sni_domains
+ * if exclude is set, with the section --sni-matcher.
+ * Returns 1 and the matched domain position in the name on match.
+ */
+int tls_match_domains(const struct section_config_t *section, int exclude,
+		      const uint8_t *name, size_t len,
+		      size_t *offset, size_t *offlen);
+
 /**
  * Tries to bruteforce over the packet and match domains as plain text
  */
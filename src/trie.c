@@ -26,30 +26,53 @@
 
 #include "trie.h"
 
+#if !defined(KERNEL_SPACE) && defined(__SSE2__)
+#define TRIE_PREFILTER_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+// Built for the CPUs without AVX2 too, picked at runtime
+#define TRIE_PREFILTER_AVX2
+#include <immintrin.h>
+#endif
+#elif !defined(KERNEL_SPACE) && defined(__ARM_NEON) && defined(__aarch64__)
+#define TRIE_PREFILTER_NEON
+#include <arm_neon.h>
+#endif
+
 int trie_init(struct trie_container *trie) {
-	void *vx = malloc(sizeof(struct trie_vertex) * TRIE_STARTSZ);
-	if (vx == NULL) {
+	void *nodes = malloc(sizeof(struct trie_node) * TRIE_STARTSZ);
+	if (nodes == NULL) {
 		return -ENOMEM;
 	}
-	trie->vx = vx;
+	*trie = (struct trie_container){0};
+	trie->nodes = nodes;
 	trie->arrsz = TRIE_STARTSZ;
 	trie->sz = 1;
 
-	struct trie_vertex *trx = trie->vx;
-	trx->p = trx->link = -1;
-	trx->leaf = 0;
-	trx->depth = 0;
-	trx->pch = 0;
-	memset(trx->go, 0xff, sizeof(trie->vx[0].go));
+	trie->nodes[0] = (struct trie_node){0};
 
 	return 0;
 }
 
+static void trie_compact_free(struct trie_compact *cx) {
+	free(cx->first);
+	free(cx->ch);
+	free(cx->link);
+	free(cx->out);
+	free(cx->depth);
+	*cx = (struct trie_compact){0};
+}
+
 void trie_destroy(struct trie_container *trie) {
 	trie->arrsz = 0;
 	trie->sz = 0;
+	trie->finalized = 0;
+	free(trie->nodes);
+	trie->nodes = NULL;
 	free(trie->vx);
 	trie->vx = NULL;
+	trie_compact_free(&trie->cx);
+	trie->pf = (struct trie_prefilter){0};
 }
 
 /**
@@ -58,20 +81,20 @@ void trie_destroy(struct trie_container *trie) {
  * Returns new vertex index or ret < 0 on error
  *
  */
-static int trie_push_vertex(struct trie_container *trie) {
-	if (trie->sz == NMAX - 1) {
+static int64_t trie_push_vertex(struct trie_container *trie) {
+	if (trie->sz == TRIE_COMPACT_NMAX) {
 		return -EINVAL;
 	}
 
 	if (trie->arrsz == trie->sz) { // realloc
-		void *pt = realloc(trie->vx, 
-		     sizeof(struct trie_vertex) * trie->arrsz * 2);
+		void *pt = realloc(trie->nodes,
+		     sizeof(struct trie_node) * trie->arrsz * 2);
 		if (pt == NULL) {
 			return -ENOMEM;
 		}
 
 		trie->arrsz *= 2;
-		trie->vx = pt;
+		trie->nodes = pt;
 	}
 
 	return trie->sz++;
@@ -80,12 +103,13 @@ static int trie_push_vertex(struct trie_container *trie) {
 
 int trie_add_string(struct trie_container *trie, 
 	       const uint8_t *str, size_t strlen) {
-	if (trie == NULL || trie->vx == NULL) {
+	if (trie == NULL || trie->nodes == NULL || trie->finalized ||
+		strlen > UINT16_MAX) {
 		return -EINVAL;
 	}
 
-	int v = 0;
-	int nv;
+	uint32_t v = 0;
+	int64_t nv;
 
 	for (size_t i = 0; i < strlen; ++i) {
 		uint8_t c = str[i];
@@ -93,61 +117,681 @@ int trie_add_string(struct trie_container *trie,
 			return -EINVAL;
 		}
 
-		if (trie->vx[v].go[c] == -1) {
+		// Children are kept sorted, so BFS numbers the edges in order
+		uint32_t prev = 0;
+		uint32_t u = trie->nodes[v].child;
+		while (u != 0 && trie->nodes[u].ch < c) {
+			prev = u;
+			u = trie->nodes[u].sibling;
+		}
+
+		if (u == 0 || trie->nodes[u].ch != c) {
 			nv = trie_push_vertex(trie);
 			if (nv < 0) {
 				return nv;
 			}
-			struct trie_vertex *tvx = trie->vx + nv;
 
-			memset(tvx->go, 0xff, sizeof(tvx->go));
-			tvx->link = -1;
-			tvx->p = v;
-			tvx->depth = trie->vx[v].depth + 1;
-			tvx->leaf = 0;
-			tvx->pch = c;
-			trie->vx[v].go[c] = nv;
+			trie->nodes[nv] = (struct trie_node){
+				.child = 0,
+				.sibling = u,
+				.ch = c,
+				.leaf = 0,
+				.depth = trie->nodes[v].depth + 1,
+			};
+
+			// The root is never a sibling
+			if (prev == 0) {
+				trie->nodes[v].child = nv;
+			} else {
+				trie->nodes[prev].sibling = nv;
+			}
+			u = nv;
 		}
-		v = trie->vx[v].go[c];
+		v = u;
 	}
 	
 	if (v != 0) {
-		trie->vx[v].leaf = 1;
+		trie->nodes[v].leaf = 1;
 	}
 
 	return 0;
 }
 
-static int trie_go(struct trie_container *trie,
-	int v, uint8_t c);
+/**
+ * Numbers the vertexes in BFS order. order[i] is the node of vertex i,
+ * first[i] is the index of its first edge.
+ */
+static void trie_bfs_order(const struct trie_container *trie,
+			   uint32_t *order, uint32_t *first) {
+	size_t tail = 1;
+
+	order[0] = 0;
+	for (size_t head = 0; head < trie->sz; head++) {
+		first[head] = tail - 1;
+
+		for (uint32_t u = trie->nodes[order[head]].child; u != 0;
+			u = trie->nodes[u].sibling) {
+			order[tail++] = u;
+		}
+	}
+	first[trie->sz] = trie->sz - 1;
+}
+
+static int trie_finalize_full(struct trie_container *trie,
+			      const uint32_t *order, const uint32_t *first) {
+	struct trie_vertex *vx;
 
-static int trie_get_link(struct trie_container *trie,
-	     int v) {
-	struct trie_vertex *tvx = trie->vx + v;
+	if (trie->sz > NMAX) {
+		return -E2BIG;
+	}
 
-	if (tvx->link == -1) {
-		if (v == 0 || tvx->p == 0) {
-			tvx->link = 0;
+	vx = malloc(sizeof(struct trie_vertex) * trie->sz);
+	if (vx == NULL) {
+		return -ENOMEM;
+	}
+
+	for (size_t v = 0; v < trie->sz; v++) {
+		const struct trie_node *node = trie->nodes + order[v];
+
+		vx[v].depth = node->depth;
+		vx[v].out = node->leaf ? v : 0;
+		memset(vx[v].go, 0xff, sizeof(vx[v].go));
+
+		for (uint32_t e = first[v]; e < first[v + 1]; e++) {
+			vx[v].go[trie->nodes[order[e + 1]].ch] = e + 1;
+		}
+	}
+
+	// The root children link to the root
+	vx[0].link = 0;
+	for (int c = 0; c < TRIE_ALPHABET; c++) {
+		if (vx[0].go[c] == -1) {
+			vx[0].go[c] = 0;
 		} else {
-			tvx->link = trie_go(trie, 
-				trie_get_link(trie, tvx->p), tvx->pch);
+			vx[vx[0].go[c]].link = 0;
+		}
+	}
+
+	// Suffix link of the vertex is less deep, so it is done before
+	for (size_t v = 1; v < trie->sz; v++) {
+		struct trie_vertex *tvx = vx + v;
+		const struct trie_vertex *lvx = vx + tvx->link;
+
+		if (tvx->out == 0) {
+			tvx->out = lvx->out;
+		}
+
+		for (int c = 0; c < TRIE_ALPHABET; c++) {
+			if (tvx->go[c] == -1) {
+				tvx->go[c] = lvx->go[c];
+			} else {
+				vx[tvx->go[c]].link = lvx->go[c];
+			}
+		}
+	}
+
+	trie->vx = vx;
+	return 0;
+}
+
+static uint32_t trie_compact_go(const struct trie_compact *cx,
+				uint32_t v, uint8_t c) {
+	while (v != 0) {
+		uint32_t lo = cx->first[v];
+		uint32_t hi = cx->first[v + 1];
+
+		while (lo < hi) {
+			uint32_t mid = lo + (hi - lo) / 2;
+
+			if (cx->ch[mid] < c) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		if (lo < cx->first[v + 1] && cx->ch[lo] == c) {
+			return lo + 1;
+		}
+
+		v = cx->link[v];
+	}
+
+	return cx->root[c];
+}
+
+static int trie_finalize_compact(struct trie_container *trie,
+				 uint32_t *order, uint32_t *first) {
+	struct trie_compact cx = {0};
+	size_t sz = trie->sz;
+
+	cx.first = first;
+	// At least one byte, the trie may have no edges
+	cx.ch = malloc(sz);
+	cx.link = malloc(sizeof(uint32_t) * sz);
+	cx.out = malloc(sizeof(uint32_t) * sz);
+	cx.depth = malloc(sizeof(uint16_t) * sz);
+	if (cx.ch == NULL || cx.link == NULL ||
+		cx.out == NULL || cx.depth == NULL) {
+		cx.first = NULL;
+		trie_compact_free(&cx);
+		return -ENOMEM;
+	}
+
+	for (size_t v = 0; v < sz; v++) {
+		const struct trie_node *node = trie->nodes + order[v];
+
+		if (v != 0) {
+			cx.ch[v - 1] = node->ch;
+		}
+		cx.depth[v] = node->depth;
+		cx.out[v] = node->leaf ? v : 0;
+	}
+
+	for (uint32_t e = cx.first[0]; e < cx.first[1]; e++) {
+		cx.root[cx.ch[e]] = e + 1;
+	}
+
+	cx.link[0] = 0;
+	for (size_t v = 0; v < sz; v++) {
+		for (uint32_t e = cx.first[v]; e < cx.first[v + 1]; e++) {
+			uint32_t u = e + 1;
+
+			cx.link[u] = v == 0 ? 0 :
+				trie_compact_go(&cx, cx.link[v], cx.ch[e]);
+			if (cx.out[u] == 0) {
+				cx.out[u] = cx.out[cx.link[u]];
+			}
+		}
+	}
+
+	trie->cx = cx;
+	return 0;
+}
+
+static int trie_prefilter_build(struct trie_container *trie);
+
+int trie_finalize(struct trie_container *trie, int layout) {
+	uint32_t *order, *first;
+	int ret;
+
+	if (trie == NULL) {
+		return -EINVAL;
+	}
+
+	if (trie->finalized) {
+		return 0;
+	}
+
+	// Not initialized, nothing to build
+	if (trie->nodes == NULL) {
+		return 0;
+	}
+
+	ret = trie_prefilter_build(trie);
+	if (ret < 0) {
+		return ret;
+	}
+
+	order = malloc(sizeof(uint32_t) * trie->sz);
+	first = malloc(sizeof(uint32_t) * (trie->sz + 1));
+	if (order == NULL || first == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	trie_bfs_order(trie, order, first);
+
+	if (layout == TRIE_LAYOUT_COMPACT) {
+		ret = trie_finalize_compact(trie, order, first);
+		// Taken by the compact layout
+		if (ret == 0)
+			first = NULL;
+	} else {
+		ret = trie_finalize_full(trie, order, first);
+	}
+
+	if (ret < 0) {
+		goto out;
+	}
+
+	trie->layout = layout;
+	trie->finalized = 1;
+	free(trie->nodes);
+	trie->nodes = NULL;
+	trie->arrsz = 0;
+
+out:
+	free(order);
+	free(first);
+	return ret;
+}
+
+int trie_foreach_string(const struct trie_container *trie,
+	int (*cb)(void *ctx, const uint8_t *str, size_t strlen), void *ctx) {
+	uint32_t *stack;
+	uint8_t *buf;
+	size_t maxdepth = 0;
+	size_t top = 0;
+	int ret = 0;
+
+	if (trie == NULL || trie->nodes == NULL) {
+		return trie != NULL && trie->finalized ? -EINVAL : 0;
+	}
+
+	for (size_t v = 0; v < trie->sz; v++) {
+		if (trie->nodes[v].depth > maxdepth) {
+			maxdepth = trie->nodes[v].depth;
 		}
 	}
 
-	return tvx->link;
+	// Preorder keeps at most one pending sibling per depth
+	stack = malloc(sizeof(uint32_t) * (maxdepth + 1));
+	buf = malloc(maxdepth + 1);
+	if (stack == NULL || buf == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (trie->nodes[0].child != 0) {
+		stack[top++] = trie->nodes[0].child;
+	}
+
+	while (top > 0) {
+		const struct trie_node *node = trie->nodes + stack[--top];
+
+		buf[node->depth - 1] = node->ch;
+		if (node->leaf) {
+			ret = cb(ctx, buf, node->depth);
+			if (ret < 0) {
+				goto out;
+			}
+		}
+
+		if (node->sibling != 0) {
+			stack[top++] = node->sibling;
+		}
+		if (node->child != 0) {
+			stack[top++] = node->child;
+		}
+	}
+
+	ret = 0;
+out:
+	free(stack);
+	free(buf);
+	return ret;
+}
+
+static inline int trie_bit(const uint8_t *bitmap, uint8_t c) {
+	return (bitmap[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline void trie_set_bit(uint8_t *bitmap, uint8_t c) {
+	bitmap[c >> 3] |= 1 << (c & 7);
+}
+
+static inline int trie_is_anchor(const struct trie_prefilter *pf, uint8_t c) {
+	for (int i = 0; i < pf->anchors_len; i++) {
+		if (pf->anchors[i] == c) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+struct trie_anchor_count {
+	const struct trie_prefilter *pf;
+	// Patterns without the anchors chosen so far
+	size_t uncovered;
+	// Of them, the patterns containing the byte
+	size_t counts[256];
+	size_t maxlen;
+};
+
+static int trie_anchor_count_cb(void *ctx, const uint8_t *str, size_t strlen) {
+	struct trie_anchor_count *ac = ctx;
+	uint8_t seen[256 / 8] = {0};
+
+	if (strlen > ac->maxlen) {
+		ac->maxlen = strlen;
+	}
+
+	for (size_t i = 0; i < strlen; i++) {
+		if (trie_is_anchor(ac->pf, str[i])) {
+			return 0;
+		}
+	}
+
+	ac->uncovered++;
+	for (size_t i = 0; i < strlen; i++) {
+		if (!trie_bit(seen, str[i])) {
+			trie_set_bit(seen, str[i]);
+			ac->counts[str[i]]++;
+		}
+	}
+
+	return 0;
 }
 
-static int trie_go(struct trie_container *trie, int v, uint8_t c) {
-	struct trie_vertex *tvx = trie->vx + v;
+static int trie_anchor_follow_cb(void *ctx, const uint8_t *str, size_t strlen) {
+	struct trie_prefilter *pf = ctx;
 
-	if (tvx->go[c] == -1) {
-		tvx->go[c] = v == 0 ? 0 : 
-		trie_go(trie, trie_get_link(trie, v), c);
+	for (size_t i = 0; i < strlen; i++) {
+		if (!trie_is_anchor(pf, str[i])) {
+			continue;
+		}
+
+		if (i + 1 == strlen) {
+			pf->follow_any = 1;
+		} else {
+			trie_set_bit(pf->follow, str[i + 1]);
+		}
 	}
 
-	return tvx->go[c];
+	return 0;
 }
 
+/**
+ * Picks the anchors greedily, each one covers the most of the patterns
+ * left. The domains usually share the dot, so it is the only anchor.
+ */
+static int trie_prefilter_build(struct trie_container *trie) {
+	struct trie_prefilter pf = {0};
+	struct trie_anchor_count *ac;
+	int ret = 0;
+
+	trie->pf = pf;
+
+	ac = malloc(sizeof(*ac));
+	if (ac == NULL) {
+		return -ENOMEM;
+	}
+
+	while (1) {
+		int best = 0;
+
+		*ac = (struct trie_anchor_count){.pf = &pf};
+		ret = trie_foreach_string(trie, trie_anchor_count_cb, ac);
+		if (ret < 0) {
+			goto out;
+		}
+
+		if (ac->uncovered == 0) {
+			break;
+		}
+
+		// Too many patterns without the common bytes
+		if (pf.anchors_len == TRIE_PREFILTER_ANCHORS) {
+			goto out;
+		}
+
+		for (int c = 1; c < 256; c++) {
+			if (ac->counts[c] > ac->counts[best]) {
+				best = c;
+			}
+		}
+		pf.anchors[pf.anchors_len++] = best;
+	}
+
+	// No patterns
+	if (pf.anchors_len == 0) {
+		goto out;
+	}
+
+	ret = trie_foreach_string(trie, trie_anchor_follow_cb, &pf);
+	if (ret < 0) {
+		goto out;
+	}
+
+	pf.maxlen = ac->maxlen;
+	pf.enabled = 1;
+	trie->pf = pf;
+
+out:
+	free(ac);
+	return ret;
+}
+
+static size_t trie_find_anchor_scalar(const struct trie_prefilter *pf,
+				      const uint8_t *str, size_t i, size_t end) {
+	for (; i < end; i++) {
+		if (trie_is_anchor(pf, str[i])) {
+			return i;
+		}
+	}
+
+	return end;
+}
+
+#ifdef TRIE_PREFILTER_AVX2
+__attribute__((target("avx2")))
+static size_t trie_find_anchor_avx2(const struct trie_prefilter *pf,
+				    const uint8_t *str, size_t i, size_t end) {
+	__m256i anchors[TRIE_PREFILTER_ANCHORS];
+
+	for (int k = 0; k < pf->anchors_len; k++) {
+		anchors[k] = _mm256_set1_epi8(pf->anchors[k]);
+	}
+
+	for (; i + 32 <= end; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+		__m256i m = _mm256_cmpeq_epi8(v, anchors[0]);
+		uint32_t mask;
+
+		for (int k = 1; k < pf->anchors_len; k++) {
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, anchors[k]));
+		}
+
+		mask = _mm256_movemask_epi8(m);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return trie_find_anchor_scalar(pf, str, i, end);
+}
+#endif
+
+#ifdef TRIE_PREFILTER_SSE2
+static size_t trie_find_anchor_sse2(const struct trie_prefilter *pf,
+				    const uint8_t *str, size_t i, size_t end) {
+	__m128i anchors[TRIE_PREFILTER_ANCHORS];
+
+	for (int k = 0; k < pf->anchors_len; k++) {
+		anchors[k] = _mm_set1_epi8(pf->anchors[k]);
+	}
+
+	for (; i + 16 <= end; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+		__m128i m = _mm_cmpeq_epi8(v, anchors[0]);
+		uint32_t mask;
+
+		for (int k = 1; k < pf->anchors_len; k++) {
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, anchors[k]));
+		}
+
+		mask = _mm_movemask_epi8(m);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return trie_find_anchor_scalar(pf, str, i, end);
+}
+#endif
+
+#ifdef TRIE_PREFILTER_NEON
+static size_t trie_find_anchor_neon(const struct trie_prefilter *pf,
+				    const uint8_t *str, size_t i, size_t end) {
+	uint8x16_t anchors[TRIE_PREFILTER_ANCHORS];
+
+	for (int k = 0; k < pf->anchors_len; k++) {
+		anchors[k] = vdupq_n_u8(pf->anchors[k]);
+	}
+
+	for (; i + 16 <= end; i += 16) {
+		uint8x16_t v = vld1q_u8(str + i);
+		uint8x16_t m = vceqq_u8(v, anchors[0]);
+		uint64_t mask;
+
+		for (int k = 1; k < pf->anchors_len; k++) {
+			m = vorrq_u8(m, vceqq_u8(v, anchors[k]));
+		}
+
+		// 4 bits per byte, NEON has no movemask
+		mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (mask != 0) {
+			return i + (__builtin_ctzll(mask) >> 2);
+		}
+	}
+
+	return trie_find_anchor_scalar(pf, str, i, end);
+}
+#endif
+
+/**
+ * Returns the position of the first anchor in [i, end) or end.
+ */
+static size_t trie_find_anchor(const struct trie_prefilter *pf,
+			       const uint8_t *str, size_t i, size_t end) {
+#if defined(TRIE_PREFILTER_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		return trie_find_anchor_avx2(pf, str, i, end);
+	}
+#endif
+#if defined(TRIE_PREFILTER_SSE2)
+	return trie_find_anchor_sse2(pf, str, i, end);
+#elif defined(TRIE_PREFILTER_NEON)
+	return trie_find_anchor_neon(pf, str, i, end);
+#else
+	return trie_find_anchor_scalar(pf, str, i, end);
+#endif
+}
+
+/**
+ * Anchor at i may be inside a pattern.
+ */
+static inline int trie_anchor_hit(const struct trie_prefilter *pf,
+				  const uint8_t *str, size_t i, size_t strlen) {
+	if (pf->follow_any) {
+		return 1;
+	}
+
+	return i + 1 < strlen && trie_bit(pf->follow, str[i + 1]);
+}
+
+/**
+ * A pattern with the anchor at i lies in [i - maxlen + 1, i + maxlen).
+ * The windows of the close anchors are merged and each window is run
+ * through the automaton from the root. A match crossing the window
+ * would have an anchor inside it, so nothing is missed, and the first
+ * match found ends the earliest, as in the whole string search.
+ */
+static int trie_prefiltered_process_str(
+	struct trie_container *trie,
+	const uint8_t *str, size_t strlen,
+	size_t *offset, size_t *offlen
+) {
+	const struct trie_prefilter *pf = &trie->pf;
+	size_t i = 0;
+
+	while ((i = trie_find_anchor(pf, str, i, strlen)) < strlen) {
+		size_t start, end;
+
+		if (!trie_anchor_hit(pf, str, i, strlen)) {
+			i++;
+			continue;
+		}
+
+		start = i + 1 >= pf->maxlen ? i + 1 - pf->maxlen : 0;
+		end = strlen - i > pf->maxlen ? i + pf->maxlen : strlen;
+
+		for (i++; (i = trie_find_anchor(pf, str, i, end)) < end; i++) {
+			if (trie_anchor_hit(pf, str, i, strlen)) {
+				end = strlen - i > pf->maxlen ? i + pf->maxlen : strlen;
+			}
+		}
+
+		if (trie_process_str(trie, str + start, end - start, 0,
+				offset, offlen)) {
+			*offset += start;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+size_t trie_memsize(const struct trie_container *trie) {
+	size_t sz = sizeof(*trie);
+
+	if (!trie->finalized) {
+		return sz + sizeof(struct trie_node) * trie->arrsz;
+	}
+
+	if (trie->layout == TRIE_LAYOUT_COMPACT) {
+		return sz + (sizeof(uint32_t) * 3 + sizeof(uint16_t) + 1) * trie->sz +
+			sizeof(uint32_t);
+	}
+
+	return sz + sizeof(struct trie_vertex) * trie->sz;
+}
+
+static uint32_t trie_node_child(const struct trie_container *trie,
+				uint32_t v, uint8_t c) {
+	uint32_t u = trie->nodes[v].child;
+
+	while (u != 0 && trie->nodes[u].ch < c) {
+		u = trie->nodes[u].sibling;
+	}
+
+	return u != 0 && trie->nodes[u].ch == c ? u : 0;
+}
+
+/**
+ * Search in the trie not finalized yet. Walks the trie from each
+ * position of the string, so it is slow, but writes nothing.
+ * The match is the same as the automaton finds: the earliest end
+ * and the longest pattern with this end.
+ */
+static int trie_nodes_process_str(
+	const struct trie_container *trie,
+	const uint8_t *str, size_t strlen,
+	int map_to_end,
+	size_t *offset, size_t *offlen
+) {
+	size_t end = strlen;
+	size_t len = 0;
+
+	for (size_t j = 0; j < strlen; j++) {
+		uint32_t v = 0;
+
+		for (size_t i = j; i < strlen && i < end; i++) {
+			v = trie_node_child(trie, v, str[i]);
+			if (v == 0) {
+				break;
+			}
+
+			// The earlier start has the longer pattern
+			if (trie->nodes[v].leaf && (!map_to_end || i == strlen - 1)) {
+				end = i;
+				len = i - j + 1;
+				break;
+			}
+		}
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+
+	*offset = end + 1 - len;
+	*offlen = len;
+	return 1;
+}
 
 int trie_process_str(
 	struct trie_container *trie,
@@ -155,38 +799,61 @@ int trie_process_str(
 	int flags,
 	size_t *offset, size_t *offlen
 ) {
-	if (trie == NULL || trie->vx == NULL) {
+	if (trie == NULL || (!trie->finalized && trie->nodes == NULL)) {
 		return 0;
 	}
 
-	int v = 0;
+	int map_to_end = (flags & TRIE_OPT_MAP_TO_END) == TRIE_OPT_MAP_TO_END;
+
+	if (!trie->finalized) {
+		return trie_nodes_process_str(trie, str, strlen, map_to_end,
+			offset, offlen);
+	}
+
+	if ((flags & TRIE_OPT_PREFILTER) && !map_to_end && trie->pf.enabled) {
+		return trie_prefiltered_process_str(trie, str, strlen,
+			offset, offlen);
+	}
+
+	uint32_t v = 0;
+	uint32_t out = 0;
 	size_t i = 0;
 	uint8_t c;
-	int len;
+	size_t len;
 
-	for (; i < strlen; ++i) {
-		c = str[i];
-		if (c >= TRIE_ALPHABET) {
-			v = 0;
-			continue;
+	if (trie->layout == TRIE_LAYOUT_COMPACT) {
+		const struct trie_compact *cx = &trie->cx;
+
+		for (; i < strlen; ++i) {
+			c = str[i];
+			v = c < TRIE_ALPHABET ? trie_compact_go(cx, v, c) : 0;
+			out = cx->out[v];
+
+			if (out != 0 && (!map_to_end || i == strlen - 1)) {
+				++i;
+				break;
+			}
 		}
 
-		v = trie->vx[v].go[c] != -1 ? trie->vx[v].go[c] : 
-			trie_go(trie, v, str[i]);
+		len = out != 0 ? cx->depth[out] : 0;
+	} else {
+		const struct trie_vertex *vx = trie->vx;
 
-		if (trie->vx[v].leaf && 
-			((flags & TRIE_OPT_MAP_TO_END) != TRIE_OPT_MAP_TO_END ||
-			i == strlen - 1)
-		) {
-			++i;
-			break;
+		for (; i < strlen; ++i) {
+			c = str[i];
+			v = c < TRIE_ALPHABET ? vx[v].go[c] : 0;
+			out = vx[v].out;
+
+			if (out != 0 && (!map_to_end || i == strlen - 1)) {
+				++i;
+				break;
+			}
 		}
+
+		len = out != 0 ? vx[out].depth : 0;
 	}
 
-	len = trie->vx[v].depth;
-	if (	trie->vx[v].leaf &&
-		i >= len
-	) {
+	if (out != 0 && i >= len) {
 		size_t sp = i - len;
 		*offset = sp;
 		*offlen = len;
@@ -30,10 +30,16 @@
  * This algorithm allows us to search inside the string
  * for a list of patterns in the linear time.
  *
- * The algorithm will lazily initialize itself while 
- * youtubeUnblock works. Lazy initializations considered 
- * safe for multithreading and operate without atomicity 
- * or synchronization primitives.
+ * The strings are added to the plain trie of linked children.
+ * trie_finalize turns it to the automaton of the chosen layout
+ * once all the patterns are added. The finalized trie is read-only,
+ * so the queue threads share it without writes.
+ *
+ * TRIE_LAYOUT_FULL keeps the whole transitions table, one step
+ * per character but 128 pushes for each vertex.
+ * TRIE_LAYOUT_COMPACT keeps only the trie edges, sorted by the
+ * vertex in BFS order, and follows the suffix links on a miss.
+ * It is about 15 bytes per vertex and has no vertexes limit.
  *
  */
 
@@ -44,22 +50,79 @@
 
 // ASCII alphabet
 #define TRIE_ALPHABET 128
-// Maximum of vertexes in the trie
+// Maximum of vertexes in the full layout
 #define NMAX ((1 << 15) - 1)
+// Maximum of vertexes in the compact layout
+#define TRIE_COMPACT_NMAX (UINT32_MAX - 1)
+
+enum {
+	TRIE_LAYOUT_FULL,
+	TRIE_LAYOUT_COMPACT,
+};
+
+/**
+ * Vertex of the trie before it is finalized.
+ * Vertex 0 is the root, so 0 child or sibling means none.
+ */
+struct trie_node {
+	uint32_t child; // first child, children are sorted by ch
+	uint32_t sibling; // next child of the parent
+	uint8_t ch; // vertex char
+	uint8_t leaf; // boolean flag
+	uint16_t depth; // depth of tree (length of substring)
+};
 
 struct trie_vertex {
-	int leaf; // boolean flag
 	int depth; // depth of tree (length of substring)
-	int p; // parent
-	uint8_t pch; // vertex char
 	int link; // sufflink
-	int16_t go[TRIE_ALPHABET]; // dynamically filled pushes
+	int out; // nearest leaf by sufflinks, 0 if none
+	int16_t go[TRIE_ALPHABET]; // pushes
+};
+
+/**
+ * Edges of vertex v are [first[v], first[v + 1]) and edge e
+ * leads to vertex e + 1, since the children of each vertex
+ * are numbered in a row by BFS.
+ */
+struct trie_compact {
+	uint32_t *first;
+	uint8_t *ch; // edge char
+	uint32_t *link; // sufflink
+	uint32_t *out; // nearest leaf by sufflinks, 0 if none
+	uint16_t *depth;
+	// Dense transitions of the root, where most of misses end
+	uint32_t root[TRIE_ALPHABET];
 };
  
+#define TRIE_PREFILTER_ANCHORS 4
+
+/**
+ * Candidates of the unanchored search. Each pattern contains
+ * one of the anchor bytes, so a match lies within maxlen around
+ * an anchor, and only these windows are run through the automaton.
+ */
+struct trie_prefilter {
+	// boolean flag, unset if the anchors do not cover the patterns
+	int enabled;
+	uint8_t anchors[TRIE_PREFILTER_ANCHORS];
+	int anchors_len;
+	// Bitmap of the bytes following an anchor in the patterns
+	uint8_t follow[256 / 8];
+	// boolean flag, some pattern ends with an anchor
+	int follow_any;
+	size_t maxlen;
+};
+
 struct trie_container {
-	struct trie_vertex *vx;
+	struct trie_node *nodes; // freed by trie_finalize
 	size_t arrsz;
-	size_t sz;
+	size_t sz; // vertexes number
+	// boolean flag, set by trie_finalize
+	int finalized;
+	int layout; // TRIE_LAYOUT_*
+	struct trie_vertex *vx;
+	struct trie_compact cx;
+	struct trie_prefilter pf;
 };
 
 #define TRIE_STARTSZ 32
@@ -69,10 +132,36 @@ void trie_destroy(struct trie_container *trie);
 int trie_add_string(struct trie_container *trie, 
 	       const uint8_t *str, size_t strlen);
 
+/**
+ * Builds the automaton of TRIE_LAYOUT_* layout with all
+ * the pushes and the suffix and output links.
+ * No strings may be added to the finalized trie.
+ */
+int trie_finalize(struct trie_container *trie, int layout);
+
+/**
+ * Calls cb for each string added to the trie, until cb returns
+ * a negative value, which is returned then.
+ * Only the trie not finalized yet keeps the strings.
+ */
+int trie_foreach_string(const struct trie_container *trie,
+	int (*cb)(void *ctx, const uint8_t *str, size_t strlen), void *ctx);
+
+/**
+ * Bytes taken by the trie.
+ */
+size_t trie_memsize(const struct trie_container *trie);
+
 /**
  * Aligns the pattern to the end 
  */
 #define TRIE_OPT_MAP_TO_END (1 << 1)
+/**
+ * Runs the automaton only around the prefilter candidates.
+ * The result is the same, the long strings are searched faster.
+ * Not used with TRIE_OPT_MAP_TO_END.
+ */
+#define TRIE_OPT_PREFILTER (1 << 2)
 
 /**
  * Searches the string for the patterns.
@@ -80,6 +169,9 @@ int trie_add_string(struct trie_container *trie,
  * offset, offlen are destination variables with 
  * offset of the given string and length of target.
  *
+ * The trie not finalized yet is searched by the slow walk
+ * from each position of the string.
+ *
  * returns 1 if target found, 0 otherwise
  */
 int trie_process_str(
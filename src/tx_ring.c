@@ -0,0 +1,452 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "tx_ring.h"
+#include "route_cache.h"
+#include "utils.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/rtnetlink.h>
+#include <linux/virtio_net.h>
+
+// The frame data follows the aligned header when PACKET_TX_HAS_OFF is unset
+#define TX_RING_DATA_OFF TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
+#define TX_RING_MAX_PKT (TX_RING_FRAME_SIZE - TX_RING_DATA_OFF - ETH_HLEN)
+
+// Not defined by netinet/tcp.h
+#define TX_TH_CWR 0x80
+
+// Ethernet, IP and TCP headers of the GSO packet
+#define TX_GSO_HDRS_MAX (ETH_HLEN + 60 + 60)
+
+struct tx_ring {
+	int fd;
+	int ifindex;
+	uint32_t mark;
+	uint8_t src_mac[ETH_ALEN];
+
+	uint8_t *map;
+	size_t map_len;
+	unsigned int head;
+	// Frames written since the last kick
+	int pending;
+	// PACKET_VNET_HDR socket for the GSO packets, -1 if not supported
+	int gso_fd;
+};
+
+/**
+ * Returns the route of the destination out of the ring interface,
+ * if the next hop address is known.
+ */
+static const struct route_entry *tx_route_get(struct tx_ring *ring,
+					      int family, const uint8_t *addr) {
+	struct route_entry *re = route_cache_get(family, addr);
+
+	if (re == NULL || re->type != RTN_UNICAST || re->oif != ring->ifindex)
+		return NULL;
+
+	if (route_cache_neigh(re) < 0)
+		return NULL;
+
+	return re;
+}
+
+int tx_ring_put(struct tx_ring *ring, const uint8_t *pkt, size_t pktlen) {
+	const uint8_t *daddr;
+	uint16_t proto;
+	int family;
+
+	switch (netproto_version(pkt, pktlen)) {
+	case IP4VERSION:
+		if (pktlen < sizeof(struct iphdr))
+			return 0;
+		family = AF_INET;
+		proto = ETH_P_IP;
+		daddr = pkt + offsetof(struct iphdr, daddr);
+		break;
+	case IP6VERSION:
+		if (pktlen < sizeof(struct ip6_hdr))
+			return 0;
+		family = AF_INET6;
+		proto = ETH_P_IPV6;
+		daddr = pkt + offsetof(struct ip6_hdr, ip6_dst);
+		break;
+	default:
+		return 0;
+	}
+
+	if (pktlen > TX_RING_MAX_PKT)
+		return 0;
+
+	const struct route_entry *re = tx_route_get(ring, family, daddr);
+	if (re == NULL)
+		return 0;
+
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr *)
+		(ring->map + ring->head * TX_RING_FRAME_SIZE);
+
+	if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) !=
+		TP_STATUS_AVAILABLE) {
+		lgtrace_addp("tx ring full");
+		tx_ring_kick(ring);
+		return 0;
+	}
+
+	uint8_t *frame = (uint8_t *)hdr + TX_RING_DATA_OFF;
+	struct ethhdr *eth = (struct ethhdr *)frame;
+
+	memcpy(eth->h_dest, re->mac, ETH_ALEN);
+	memcpy(eth->h_source, ring->src_mac, ETH_ALEN);
+	eth->h_proto = htons(proto);
+	memcpy(frame + ETH_HLEN, pkt, pktlen);
+	hdr->tp_len = ETH_HLEN + pktlen;
+
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	ring->head = (ring->head + 1) % TX_RING_FRAMES;
+	ring->pending++;
+
+	return pktlen;
+}
+
+int tx_ring_kick(struct tx_ring *ring) {
+	int ret;
+
+	if (ring->pending == 0)
+		return 0;
+
+	ring->pending = 0;
+	// Does not wait for the frames to leave the ring
+	if (send(ring->fd, NULL, 0, MSG_DONTWAIT) < 0) {
+		ret = -errno;
+		lgerror(ret, "tx ring send");
+		return ret;
+	}
+
+	return 0;
+}
+
+static uint32_t csum_add(uint32_t sum, const uint8_t *data, size_t len) {
+	for (size_t i = 0; i + 1 < len; i += 2)
+		sum += (data[i] << 8) | data[i + 1];
+
+	return sum;
+}
+
+/**
+ * Folded, not inverted pseudo header sum expected in the TCP checksum
+ * field by the checksum offload.
+ */
+static uint16_t tcp_pseudo_csum(const uint8_t *iph, int family,
+				size_t tcp_len) {
+	uint32_t sum = IPPROTO_TCP + tcp_len;
+
+	if (family == AF_INET) {
+		sum = csum_add(sum, iph + offsetof(struct iphdr, saddr), 8);
+	} else {
+		sum = csum_add(sum, iph + offsetof(struct ip6_hdr, ip6_src), 32);
+	}
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum;
+}
+
+int tx_ring_send_gso(struct tx_ring *ring, const uint8_t *pkt, size_t pktlen,
+		     size_t seglen) {
+	uint8_t hdrs[TX_GSO_HDRS_MAX];
+	const uint8_t *daddr;
+	size_t iph_len;
+	uint16_t proto;
+	int family;
+
+	if (ring->gso_fd < 0)
+		return 0;
+
+	switch (netproto_version(pkt, pktlen)) {
+	case IP4VERSION: {
+		const struct iphdr *iph = (const struct iphdr *)pkt;
+
+		if (pktlen < sizeof(struct iphdr) || iph->protocol != IPPROTO_TCP ||
+			ntohs(iph->frag_off) & (IP_MF | IP_OFFMASK))
+			return 0;
+		family = AF_INET;
+		proto = ETH_P_IP;
+		iph_len = iph->ihl * 4;
+		daddr = pkt + offsetof(struct iphdr, daddr);
+		break;
+	}
+	case IP6VERSION: {
+		const struct ip6_hdr *iph = (const struct ip6_hdr *)pkt;
+
+		// Extension headers are left to the segmenter
+		if (pktlen < sizeof(struct ip6_hdr) || iph->ip6_nxt != IPPROTO_TCP)
+			return 0;
+		family = AF_INET6;
+		proto = ETH_P_IPV6;
+		iph_len = sizeof(struct ip6_hdr);
+		daddr = pkt + offsetof(struct ip6_hdr, ip6_dst);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	if (pktlen < iph_len + sizeof(struct tcphdr))
+		return 0;
+
+	const struct tcphdr *tcph = (const struct tcphdr *)(pkt + iph_len);
+	size_t hdrs_len = iph_len + tcph->doff * 4;
+
+	if (tcph->doff < 5 || pktlen <= hdrs_len || seglen <= hdrs_len ||
+		ETH_HLEN + hdrs_len > sizeof(hdrs))
+		return 0;
+
+	const struct route_entry *re = tx_route_get(ring, family, daddr);
+	if (re == NULL)
+		return 0;
+
+	struct ethhdr *eth = (struct ethhdr *)hdrs;
+	memcpy(eth->h_dest, re->mac, ETH_ALEN);
+	memcpy(eth->h_source, ring->src_mac, ETH_ALEN);
+	eth->h_proto = htons(proto);
+	memcpy(hdrs + ETH_HLEN, pkt, hdrs_len);
+
+	struct tcphdr *seg_tcph = (struct tcphdr *)(hdrs + ETH_HLEN + iph_len);
+	seg_tcph->check = htons(tcp_pseudo_csum(pkt, family, pktlen - iph_len));
+
+	struct virtio_net_hdr vnet = {
+		.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+		.gso_type = family == AF_INET ?
+			VIRTIO_NET_HDR_GSO_TCPV4 : VIRTIO_NET_HDR_GSO_TCPV6,
+		.hdr_len = ETH_HLEN + hdrs_len,
+		.gso_size = seglen - hdrs_len,
+		.csum_start = ETH_HLEN + iph_len,
+		.csum_offset = offsetof(struct tcphdr, check),
+	};
+	// CWR is kept on the first segment only
+	if (tcph->th_flags & TX_TH_CWR)
+		vnet.gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+
+	struct iovec iov[] = {
+		{ .iov_base = &vnet, .iov_len = sizeof(vnet) },
+		{ .iov_base = hdrs, .iov_len = ETH_HLEN + hdrs_len },
+		{ .iov_base = (uint8_t *)pkt + hdrs_len, .iov_len = pktlen - hdrs_len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = sizeof(iov) / sizeof(*iov),
+	};
+
+	tx_ring_kick(ring);
+
+	if (sendmsg(ring->gso_fd, &msg, MSG_DONTWAIT) < 0) {
+		lgerror(-errno, "tx ring gso send");
+		return 0;
+	}
+
+	return pktlen;
+}
+
+/**
+ * Opens the PACKET_VNET_HDR socket on the ring interface.
+ */
+static int tx_gso_open(struct tx_ring *ring, uint32_t mark, int qdisc_bypass) {
+	int one = 1;
+	int fd;
+	int ret;
+
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one)) < 0 ||
+		(qdisc_bypass && setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS,
+			&one, sizeof(one)) < 0) ||
+		(mark && setsockopt(fd, SOL_SOCKET, SO_MARK,
+			&mark, sizeof(mark)) < 0)) {
+		goto close_fd;
+	}
+
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = 0,
+		.sll_ifindex = ring->ifindex,
+	};
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		goto close_fd;
+
+	ring->gso_fd = fd;
+	return 0;
+
+close_fd:
+	ret = -errno;
+	close(fd);
+	return ret;
+}
+
+int tx_ring_open(struct tx_ring **pring, const char *ifname,
+		 uint32_t mark, int qdisc_bypass) {
+	struct tx_ring *ring;
+	struct ifreq ifr = {0};
+	int one = 1;
+	int ret;
+
+	ring = calloc(1, sizeof(struct tx_ring));
+	if (ring == NULL)
+		return -ENOMEM;
+
+	ring->mark = mark;
+	ring->gso_fd = -1;
+	ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (ring->fd < 0) {
+		ret = -errno;
+		lgerror(ret, "Unable to create packet socket");
+		goto free_ring;
+	}
+
+	int version = TPACKET_V2;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION,
+			&version, sizeof(version)) < 0) {
+		ret = -errno;
+		lgerror(ret, "setsockopt(PACKET_VERSION)");
+		goto close_fd;
+	}
+
+	// Skip the malformed frames instead of stopping on them
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_LOSS,
+			&one, sizeof(one)) < 0) {
+		ret = -errno;
+		lgerror(ret, "setsockopt(PACKET_LOSS)");
+		goto close_fd;
+	}
+
+	if (qdisc_bypass && setsockopt(ring->fd, SOL_PACKET,
+			PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+		ret = -errno;
+		lgerror(ret, "setsockopt(PACKET_QDISC_BYPASS)");
+		goto close_fd;
+	}
+
+	if (mark && setsockopt(ring->fd, SOL_SOCKET, SO_MARK,
+			&mark, sizeof(mark)) < 0) {
+		ret = -errno;
+		lgerror(ret, "setsockopt(SO_MARK, %u) failed", mark);
+		goto close_fd;
+	}
+
+	struct tpacket_req req = {
+		.tp_block_size = TX_RING_BLOCK_SIZE,
+		.tp_block_nr = TX_RING_FRAMES * TX_RING_FRAME_SIZE /
+			TX_RING_BLOCK_SIZE,
+		.tp_frame_size = TX_RING_FRAME_SIZE,
+		.tp_frame_nr = TX_RING_FRAMES,
+	};
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING,
+			&req, sizeof(req)) < 0) {
+		ret = -errno;
+		lgerror(ret, "setsockopt(PACKET_TX_RING)");
+		goto close_fd;
+	}
+
+	ring->map_len = (size_t)TX_RING_FRAMES * TX_RING_FRAME_SIZE;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ret = -errno;
+		lgerror(ret, "tx ring mmap");
+		goto close_fd;
+	}
+
+	ring->ifindex = if_nametoindex(ifname);
+	if (ring->ifindex == 0) {
+		ret = -errno;
+		lgerror(ret, "Unable to find interface %s", ifname);
+		goto unmap;
+	}
+
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(ring->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		ret = -errno;
+		lgerror(ret, "Unable to get %s address", ifname);
+		goto unmap;
+	}
+
+	if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+		ret = -EPROTONOSUPPORT;
+		lgerr("%s is not an Ethernet interface", ifname);
+		goto unmap;
+	}
+	memcpy(ring->src_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		// Nothing is received on the socket
+		.sll_protocol = 0,
+		.sll_ifindex = ring->ifindex,
+	};
+	if (bind(ring->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		ret = -errno;
+		lgerror(ret, "Unable to bind packet socket to %s", ifname);
+		goto unmap;
+	}
+
+	// Larger packets are split in userspace without it
+	if ((ret = tx_gso_open(ring, mark, qdisc_bypass)) < 0) {
+		lgwarning("GSO packet socket is not available: %s", strerror(-ret));
+	}
+
+	*pring = ring;
+	return 0;
+
+unmap:
+	munmap(ring->map, ring->map_len);
+close_fd:
+	close(ring->fd);
+free_ring:
+	free(ring);
+	return ret;
+}
+
+void tx_ring_close(struct tx_ring *ring) {
+	if (ring == NULL)
+		return;
+
+	tx_ring_kick(ring);
+	if (ring->gso_fd >= 0)
+		close(ring->gso_fd);
+	munmap(ring->map, ring->map_len);
+	close(ring->fd);
+	free(ring);
+}
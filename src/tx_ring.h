@@ -0,0 +1,79 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TX_RING_H
+#define TX_RING_H
+
+/**
+ * AF_PACKET backend of the raw packets sending.
+ *
+ * The IP packets are framed with the Ethernet header of the next hop
+ * and written to a TPACKET_V2 TX_RING mapped on the egress interface,
+ * so neither the route lookup nor the netfilter output hooks are passed
+ * again. The frames written between two kicks are sent with one send().
+ *
+ * The next hop MAC address is taken from the kernel route and
+ * neighbor tables through the route cache of the thread. The packets
+ * the ring can not take (routed to another interface, the neighbor is
+ * not resolved yet, the ring is full) are left to the raw socket.
+ *
+ * TCP packets larger than the MTU are sent past the ring, on a socket
+ * with PACKET_VNET_HDR: the kernel gets the whole packet with GSO and
+ * checksum offload metadata and splits it itself.
+ */
+
+#include "types.h"
+
+#define TX_RING_FRAME_SIZE 2048
+#define TX_RING_FRAMES 256
+// Multiple of the page size on all the platforms
+#define TX_RING_BLOCK_SIZE (TX_RING_FRAME_SIZE * 32)
+
+struct tx_ring;
+
+/**
+ * Maps the ring on the Ethernet interface ifname.
+ * The frames get the mark and skip the qdisc if qdisc_bypass is set.
+ */
+int tx_ring_open(struct tx_ring **ring, const char *ifname,
+		 uint32_t mark, int qdisc_bypass);
+void tx_ring_close(struct tx_ring *ring);
+
+/**
+ * Writes the IP packet to the ring.
+ * Returns pktlen, or 0 if the packet should go through the raw socket.
+ * The caller kicks the ring before that, so the packets keep the order.
+ * The frame is sent on the next tx_ring_kick.
+ */
+int tx_ring_put(struct tx_ring *ring, const uint8_t *pkt, size_t pktlen);
+
+/**
+ * Sends all the frames written since the last kick.
+ */
+int tx_ring_kick(struct tx_ring *ring);
+
+/**
+ * Sends the TCP packet as one GSO packet the kernel splits to segments
+ * of at most seglen bytes. The ring is kicked first to keep the order.
+ * Returns pktlen, or 0 if the caller should split the packet.
+ */
+int tx_ring_send_gso(struct tx_ring *ring, const uint8_t *pkt, size_t pktlen,
+		     size_t seglen);
+
+#endif /* TX_RING_H */
@@ -0,0 +1,227 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#ifdef USE_IO_URING
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode,
+				 void *arg, unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *r, unsigned entries) {
+	struct io_uring_params p = {0};
+	int ret;
+
+	*r = (struct uring){0};
+
+	r->fd = sys_io_uring_setup(entries, &p);
+	if (r->fd < 0) {
+		return -errno;
+	}
+
+	// Kernels older than 5.4 are not worth the separate CQ mapping
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		close(r->fd);
+		return -EINVAL;
+	}
+
+	size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+
+	r->ring_ptr = mmap(NULL, r->ring_sz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->ring_ptr == MAP_FAILED) {
+		ret = -errno;
+		close(r->fd);
+		return ret;
+	}
+
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		ret = -errno;
+		munmap(r->ring_ptr, r->ring_sz);
+		close(r->fd);
+		return ret;
+	}
+
+	uint8_t *ring = r->ring_ptr;
+	r->sq_head = (unsigned *)(ring + p.sq_off.head);
+	r->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	r->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(ring + p.sq_off.array);
+	r->sqe_tail = *r->sq_tail;
+
+	r->cq_head = (unsigned *)(ring + p.cq_off.head);
+	r->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	r->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	return 0;
+}
+
+void uring_destroy(struct uring *r) {
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->ring_ptr != NULL)
+		munmap(r->ring_ptr, r->ring_sz);
+	close(r->fd);
+	*r = (struct uring){0};
+	r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+	if (r->sqe_tail - head > r->sq_mask)
+		return NULL;
+
+	unsigned idx = r->sqe_tail & r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	r->sq_array[idx] = idx;
+	r->sqe_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+int uring_submit(struct uring *r, unsigned wait_nr) {
+	// Also counts SQEs left unconsumed by an interrupted call
+	unsigned to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	int ret;
+
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+	do {
+		ret = sys_io_uring_enter(r->fd, to_submit, wait_nr,
+			   wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	} while (ret < 0 && errno == EINTR && wait_nr == 0);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r) {
+	unsigned head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r) {
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buf_ring_init(struct uring *r, struct uring_buf_ring *br,
+			unsigned entries, size_t buf_size, uint16_t bgid) {
+	int ret;
+
+	*br = (struct uring_buf_ring){0};
+	br->entries = entries;
+	br->bgid = bgid;
+	br->buf_size = buf_size;
+	br->br_sz = entries * sizeof(struct io_uring_buf);
+
+	br->br = mmap(NULL, br->br_sz, PROT_READ | PROT_WRITE,
+	       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br->br == MAP_FAILED) {
+		br->br = NULL;
+		return -errno;
+	}
+
+	br->bufs = mmap(NULL, entries * buf_size, PROT_READ | PROT_WRITE,
+		 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br->bufs == MAP_FAILED) {
+		ret = -errno;
+		munmap(br->br, br->br_sz);
+		return ret;
+	}
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uint64_t)(uintptr_t)br->br,
+		.ring_entries = entries,
+		.bgid = bgid,
+	};
+	if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		ret = -errno;
+		munmap(br->bufs, entries * buf_size);
+		munmap(br->br, br->br_sz);
+		return ret;
+	}
+
+	for (unsigned i = 0; i < entries; i++) {
+		uring_buf_ring_recycle(br, i);
+	}
+
+	return 0;
+}
+
+void uring_buf_ring_destroy(struct uring *r, struct uring_buf_ring *br) {
+	struct io_uring_buf_reg reg = {
+		.bgid = br->bgid,
+	};
+
+	if (br->br == NULL)
+		return;
+
+	sys_io_uring_register(r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	munmap(br->bufs, br->entries * br->buf_size);
+	munmap(br->br, br->br_sz);
+	br->br = NULL;
+}
+
+void uring_buf_ring_recycle(struct uring_buf_ring *br, uint16_t bid) {
+	uint16_t tail = br->br->tail;
+	struct io_uring_buf *buf = &br->br->bufs[tail & (br->entries - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_buf(br, bid);
+	buf->len = br->buf_size;
+	buf->bid = bid;
+
+	__atomic_store_n(&br->br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* USE_IO_URING */
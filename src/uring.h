@@ -0,0 +1,107 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef URING_H
+#define URING_H
+
+/**
+ * Minimal io_uring wrapper over raw syscalls.
+ * Built only with USE_IO_URING, so no liburing dependency is needed.
+ */
+
+#ifdef USE_IO_URING
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	// Local tail, published to the kernel on submit
+	unsigned sqe_tail;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *ring_ptr;
+	size_t ring_sz;
+	size_t sqes_sz;
+};
+
+/**
+ * Provided buffers ring. The kernel picks the buffer for
+ * each received message by itself.
+ */
+struct uring_buf_ring {
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	unsigned entries;
+	uint16_t bgid;
+	uint8_t *bufs;
+	size_t buf_size;
+};
+
+/**
+ * Returns -ENOSYS, -EPERM or -EINVAL if io_uring is not supported
+ * by the kernel or disabled.
+ */
+int uring_init(struct uring *r, unsigned entries);
+void uring_destroy(struct uring *r);
+
+/**
+ * Returns zeroed SQE or NULL if the submission queue is full.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+/**
+ * Submits all the prepared SQEs and waits for at least wait_nr completions.
+ */
+int uring_submit(struct uring *r, unsigned wait_nr);
+
+/**
+ * Returns the next completion or NULL. Call uring_cqe_seen when done.
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+
+int uring_buf_ring_init(struct uring *r, struct uring_buf_ring *br,
+			unsigned entries, size_t buf_size, uint16_t bgid);
+void uring_buf_ring_destroy(struct uring *r, struct uring_buf_ring *br);
+
+static inline uint8_t *uring_buf_ring_buf(struct uring_buf_ring *br,
+					  uint16_t bid) {
+	return br->bufs + (size_t)bid * br->buf_size;
+}
+
+/**
+ * Gives the buffer back to the kernel.
+ */
+void uring_buf_ring_recycle(struct uring_buf_ring *br, uint16_t bid);
+
+#endif /* USE_IO_URING */
+
+#endif /* URING_H */
@@ -570,6 +570,90 @@ int tcp_frag(const uint8_t *pkt, size_t buflen, size_t payload_offset,
 	return 0;
 }
 
+#define TCP_SEG_FLAGS_OFF 13
+#define TCP_SEG_FIN 0x01
+#define TCP_SEG_PSH 0x08
+#define TCP_SEG_CWR 0x80
+
+int tcp_segment(const uint8_t *pkt, size_t pktlen,
+		uint8_t *seg, size_t seg_buflen,
+		int (*send_seg)(const uint8_t *seg, size_t seglen)) {
+	void *hdr;
+	size_t hdr_len;
+	struct tcphdr *tcph;
+	size_t tcph_len;
+	size_t plen;
+	const uint8_t *payload;
+	int ret;
+
+	if ((ret = tcp_payload_split((uint8_t *)pkt, pktlen,
+				&hdr, &hdr_len,
+				&tcph, &tcph_len,
+				(uint8_t **)&payload, &plen)) < 0) {
+		lgerror(ret, "tcp_segment: tcp_payload_split");
+		return -EINVAL;
+	}
+
+	int ipvx = netproto_version(pkt, pktlen);
+
+	if (ipvx == IP4VERSION) {
+		struct iphdr *iphdr = hdr;
+		if (ntohs(iphdr->frag_off) & (IP_MF | IP_OFFMASK)) {
+			lgerror(-EINVAL, "tcp_segment: ip4: ip fragmentation is set");
+			return -EINVAL;
+		}
+	}
+
+	size_t hdrs_len = hdr_len + tcph_len;
+	if (seg_buflen <= hdrs_len)
+		return -EINVAL;
+
+	size_t mss = seg_buflen - hdrs_len;
+	struct tcphdr *seg_tcph = (void *)(seg + hdr_len);
+	uint32_t seq = ntohl(tcph->seq);
+	uint16_t ip_id = 0;
+	int sent = 0;
+	// CWR, FIN and PSH are not bit fields of the userspace tcphdr
+	uint8_t flags = ((const uint8_t *)tcph)[TCP_SEG_FLAGS_OFF];
+	uint8_t *seg_flags = (uint8_t *)seg_tcph + TCP_SEG_FLAGS_OFF;
+
+	memcpy(seg, hdr, hdrs_len);
+	if (ipvx == IP4VERSION)
+		ip_id = ntohs(((struct iphdr *)hdr)->id);
+
+	for (size_t off = 0; off < plen; off += mss) {
+		size_t seg_plen = plen - off < mss ? plen - off : mss;
+		size_t seg_len = hdrs_len + seg_plen;
+
+		memcpy(seg + hdrs_len, payload + off, seg_plen);
+
+		if (ipvx == IP4VERSION) {
+			struct iphdr *seg_iph = (void *)seg;
+			seg_iph->tot_len = htons(seg_len);
+			seg_iph->id = htons(ip_id++);
+			set_ip_checksum(seg_iph, hdr_len);
+		} else {
+			struct ip6_hdr *seg_iph = (void *)seg;
+			seg_iph->ip6_plen = htons(seg_len - hdr_len);
+		}
+
+		seg_tcph->seq = htonl(seq + off);
+		seg_flags[0] = flags;
+		if (off != 0)
+			seg_flags[0] &= ~TCP_SEG_CWR;
+		if (off + seg_plen != plen)
+			seg_flags[0] &= ~(TCP_SEG_FIN | TCP_SEG_PSH);
+		set_tcp_checksum(seg_tcph, seg, hdr_len);
+
+		if ((ret = send_seg(seg, seg_len)) < 0)
+			return ret;
+
+		sent += ret;
+	}
+
+	return sent;
+}
+
 void z_function(const char *str, int *zbuf, size_t len) {
 	zbuf[0] = len;
 
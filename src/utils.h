@@ -49,6 +49,18 @@ int tcp_frag(const uint8_t *pkt, size_t pktlen,
 			uint8_t *seg1, size_t *s1len, 
 			uint8_t *seg2, size_t *s2len);
 
+/**
+ * Splits the TCP packet to segments of at most seg_buflen bytes
+ * in a single pass. Every segment is built in seg and passed to send_seg
+ * before the next one overwrites it, so the headers are copied once and
+ * nothing is allocated. FIN and PSH are kept on the last segment only,
+ * CWR on the first one.
+ * Returns the sum of send_seg results or the first error.
+ */
+int tcp_segment(const uint8_t *pkt, size_t pktlen,
+		uint8_t *seg, size_t seg_buflen,
+		int (*send_seg)(const uint8_t *seg, size_t seglen));
+
 
 /**
  * Splits the raw packet payload to ip header and ip payload.
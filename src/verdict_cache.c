@@ -0,0 +1,283 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef KERNEL_SPACE
+#error "Verdict cache is userspace only"
+#endif
+
+#include "verdict_cache.h"
+#include "utils.h"
+
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/ip6.h>
+
+struct vcache_entry {
+	struct vcache_key key;
+	// Monotonic seconds, 0 for the empty entry
+	uint32_t expires;
+	// CLOCK reference bit
+	uint8_t ref;
+
+	uint8_t target;
+	uint16_t sni_off;
+	uint16_t sni_len;
+	uint16_t target_sni_off;
+	uint16_t target_sni_len;
+	uint8_t sni[VCACHE_SNI_MAX];
+};
+
+struct vcache_set {
+	struct vcache_entry ways[VCACHE_WAYS];
+	// CLOCK hand
+	uint8_t hand;
+};
+
+static unsigned int vcache_ttl = 0;
+static __thread struct vcache_set *thread_vcache = NULL;
+
+void vcache_set_ttl(unsigned int ttl) {
+	vcache_ttl = ttl;
+}
+
+int vcache_enabled(void) {
+	return vcache_ttl != 0;
+}
+
+void vcache_thread_destroy(void) {
+	free(thread_vcache);
+	thread_vcache = NULL;
+}
+
+static uint32_t vcache_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	// Never 0, so 0 marks the empty entries
+	return ts.tv_sec + 1;
+}
+
+int vcache_key_build(struct vcache_key *key, const void *iph, size_t iph_len,
+		     uint8_t proto, uint16_t dport,
+		     const struct section_config_t *section) {
+	*key = (struct vcache_key){0};
+
+	switch (netproto_version(iph, iph_len)) {
+	case IP4VERSION:
+		if (iph_len < sizeof(struct iphdr))
+			return -EINVAL;
+		key->family = AF_INET;
+		memcpy(key->addr, &((const struct iphdr *)iph)->daddr, 4);
+		break;
+	case IP6VERSION:
+		if (iph_len < sizeof(struct ip6_hdr))
+			return -EINVAL;
+		key->family = AF_INET6;
+		memcpy(key->addr, &((const struct ip6_hdr *)iph)->ip6_dst, 16);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	key->proto = proto;
+	key->port = dport;
+	key->section = CONFIG_SECTION_NUMBER(section);
+
+	return 0;
+}
+
+static int vcache_key_eq(const struct vcache_key *a, const struct vcache_key *b) {
+	return a->port == b->port && a->family == b->family &&
+		a->proto == b->proto && a->section == b->section &&
+		!memcmp(a->addr, b->addr, sizeof(a->addr));
+}
+
+// FNV-1a
+static uint32_t vcache_hash(const struct vcache_key *key) {
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < sizeof(key->addr); i++)
+		h = (h ^ key->addr[i]) * 16777619u;
+	h = (h ^ key->port) * 16777619u;
+	h = (h ^ key->proto) * 16777619u;
+	h = (h ^ (uint32_t)key->section) * 16777619u;
+
+	return h;
+}
+
+static struct vcache_set *vcache_set_of(const struct vcache_key *key) {
+	if (thread_vcache == NULL) {
+		thread_vcache = calloc(VCACHE_SETS, sizeof(struct vcache_set));
+		if (thread_vcache == NULL)
+			return NULL;
+	}
+
+	return &thread_vcache[vcache_hash(key) % VCACHE_SETS];
+}
+
+static struct vcache_entry *vcache_find(const struct vcache_key *key) {
+	struct vcache_set *set;
+	uint32_t now = vcache_now();
+
+	if (!vcache_ttl || (set = vcache_set_of(key)) == NULL)
+		return NULL;
+
+	for (int i = 0; i < VCACHE_WAYS; i++) {
+		struct vcache_entry *e = &set->ways[i];
+
+		if (e->expires > now && vcache_key_eq(&e->key, key)) {
+			e->ref = 1;
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns the entry of the key, or the victim chosen by CLOCK.
+ */
+static struct vcache_entry *vcache_slot(const struct vcache_key *key) {
+	struct vcache_set *set;
+	uint32_t now = vcache_now();
+
+	if (!vcache_ttl || (set = vcache_set_of(key)) == NULL)
+		return NULL;
+
+	for (int i = 0; i < VCACHE_WAYS; i++) {
+		struct vcache_entry *e = &set->ways[i];
+
+		if (e->expires > now && vcache_key_eq(&e->key, key))
+			return e;
+	}
+
+	for (int i = 0; i < VCACHE_WAYS; i++) {
+		struct vcache_entry *e = &set->ways[i];
+
+		if (e->expires <= now)
+			return e;
+	}
+
+	while (1) {
+		struct vcache_entry *e = &set->ways[set->hand];
+
+		set->hand = (set->hand + 1) % VCACHE_WAYS;
+		if (!e->ref)
+			return e;
+		e->ref = 0;
+	}
+}
+
+static void vcache_count(int hit) {
+	if (hit) {
+		++global_stats.vcache_hits;
+	} else {
+		++global_stats.vcache_misses;
+	}
+}
+
+int vcache_tls_lookup(const struct vcache_key *key,
+		      const uint8_t *payload, size_t payload_len,
+		      struct tls_verdict *vrd) {
+	struct vcache_entry *e = vcache_find(key);
+
+	if (e == NULL) {
+		if (vcache_ttl)
+			vcache_count(0);
+		return 0;
+	}
+
+	if (payload_len == 0 || payload[0] != TLS_CONTENT_TYPE_HANDSHAKE ||
+		e->sni_off + e->sni_len > payload_len ||
+		memcmp(payload + e->sni_off, e->sni, e->sni_len)) {
+		vcache_count(0);
+		return 0;
+	}
+
+	*vrd = (struct tls_verdict){
+		.sni_ptr = payload + e->sni_off,
+		.sni_len = e->sni_len,
+		.target_sni = e->target,
+		.target_sni_ptr = payload + e->target_sni_off,
+		.target_sni_len = e->target_sni_len,
+	};
+	vcache_count(1);
+
+	return 1;
+}
+
+void vcache_tls_store(const struct vcache_key *key, const uint8_t *payload,
+		      const struct tls_verdict *vrd) {
+	struct vcache_entry *e;
+
+	// Nothing to confirm the hit with
+	if (vrd->sni_len <= 0 || vrd->sni_len > VCACHE_SNI_MAX)
+		return;
+
+	if ((e = vcache_slot(key)) == NULL)
+		return;
+
+	e->key = *key;
+	e->expires = vcache_now() + vcache_ttl;
+	e->ref = 1;
+	e->target = vrd->target_sni;
+	e->sni_off = vrd->sni_ptr - payload;
+	e->sni_len = vrd->sni_len;
+	memcpy(e->sni, vrd->sni_ptr, vrd->sni_len);
+	if (vrd->target_sni) {
+		e->target_sni_off = vrd->target_sni_ptr - payload;
+		e->target_sni_len = vrd->target_sni_len;
+	} else {
+		e->target_sni_off = 0;
+		e->target_sni_len = 0;
+	}
+}
+
+int vcache_quic_lookup(const struct vcache_key *key) {
+	struct vcache_entry *e;
+
+	if (!vcache_ttl)
+		return 0;
+
+	e = vcache_find(key);
+	vcache_count(e != NULL);
+
+	return e != NULL;
+}
+
+int vcache_target_lookup(const struct vcache_key *key) {
+	struct vcache_entry *e = vcache_find(key);
+
+	return e != NULL && e->target;
+}
+
+void vcache_quic_store(const struct vcache_key *key) {
+	struct vcache_entry *e = vcache_slot(key);
+
+	if (e == NULL)
+		return;
+
+	*e = (struct vcache_entry){0};
+	e->key = *key;
+	e->expires = vcache_now() + vcache_ttl;
+	e->ref = 1;
+	e->target = 1;
+}
@@ -0,0 +1,94 @@
+/*
+  youtubeUnblock - https://github.com/Waujito/youtubeUnblock
+
+  Copyright (C) 2024-2025 Vadim Vetrov <vetrovvd@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef VERDICT_CACHE_H
+#define VERDICT_CACHE_H
+
+/**
+ * Per-thread cache of the section verdicts by the destination.
+ *
+ * TLS entries keep the SNI with its offset in the payload. A hit
+ * is confirmed by the same SNI bytes at the same offset of the new
+ * ClientHello, so the ClientHello walk and the domains matching
+ * are skipped without guessing.
+ * The SNI of QUIC Initial is encrypted, so only the target verdicts
+ * are kept for QUIC: a wrong hit drops or fakes a QUIC connection
+ * the browser falls back to TCP from.
+ *
+ * The cache is set associative with CLOCK replacement inside a set.
+ */
+
+#include "types.h"
+#include "config.h"
+#include "tls.h"
+
+// SNI longer than this is not cached
+#define VCACHE_SNI_MAX 96
+
+#define VCACHE_SETS 256
+#define VCACHE_WAYS 4
+
+struct vcache_key {
+	uint8_t addr[16];
+	uint16_t port;
+	uint8_t family;
+	uint8_t proto;
+	int section;
+};
+
+/**
+ * Sets entries time to live in seconds. 0 disables the cache.
+ */
+void vcache_set_ttl(unsigned int ttl);
+int vcache_enabled(void);
+
+/**
+ * Frees the cache of the calling thread.
+ */
+void vcache_thread_destroy(void);
+
+/**
+ * Builds the key from the IP header and the transport destination port.
+ */
+int vcache_key_build(struct vcache_key *key, const void *iph, size_t iph_len,
+		     uint8_t proto, uint16_t dport,
+		     const struct section_config_t *section);
+
+/**
+ * Returns 1 and fills vrd with the pointers into payload on hit.
+ */
+int vcache_tls_lookup(const struct vcache_key *key,
+		      const uint8_t *payload, size_t payload_len,
+		      struct tls_verdict *vrd);
+void vcache_tls_store(const struct vcache_key *key, const uint8_t *payload,
+		      const struct tls_verdict *vrd);
+
+/**
+ * Returns 1 if the destination was a QUIC target.
+ */
+int vcache_quic_lookup(const struct vcache_key *key);
+void vcache_quic_store(const struct vcache_key *key);
+
+/**
+ * Returns 1 if the destination was a target of either protocol.
+ * Nothing in the payload is checked and the hit is not counted.
+ */
+int vcache_target_lookup(const struct vcache_key *key);
+
+#endif /* VERDICT_CACHE_H */
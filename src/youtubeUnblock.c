@@ -46,6 +46,9 @@
 #include <linux/netfilter.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/sock_diag.h>
+#include <sched.h>
 #include <signal.h>
 
 #include "config.h"
@@ -53,12 +56,56 @@
 #include "args.h"
 #include "utils.h"
 #include "logging.h"
+#include "delay_scheduler.h"
+#include "uring.h"
+#include "nft.h"
+#include "bpf_prefilter.h"
+#include "dns.h"
+#include "verdict_cache.h"
+#include "tx_ring.h"
+#include "pmtu.h"
+#include "route_cache.h"
+#include "shed.h"
 
-pthread_mutex_t rawsocket_lock;
-int rawsocket = -2;
+/**
+ * Per-thread raw sockets. Opened by every queue thread and by
+ * the delay scheduler thread, so the send path takes no locks.
+ */
+static __thread int thread_rawsocket = -1;
+static __thread int thread_raw6socket = -1;
+// Set with the packet backend, the raw sockets take the rest
+static __thread struct tx_ring *thread_tx_ring = NULL;
+
+#define RAW_BATCH_SIZE 32
+// Slots are allocated for the usual packets and grown for the larger ones
+#define RAW_BATCH_PKT_MIN 2048
+
+struct raw_batch_pkt {
+	uint8_t *data;
+	size_t cap;
+	size_t len;
+	struct sockaddr_storage daddr;
+	socklen_t daddr_len;
+};
+
+/**
+ * Per-thread arena of raw packets to be sent with sendmmsg.
+ * Filled by send_raw_socket between begin_raw_batch and flush_raw_batch.
+ */
+struct raw_batch {
+	int active;
+	int len;
+	struct raw_batch_pkt pkts[RAW_BATCH_SIZE];
+	struct mmsghdr msgs[RAW_BATCH_SIZE];
+	struct iovec iovs[RAW_BATCH_SIZE];
+};
+
+static __thread struct raw_batch *thread_raw_batch = NULL;
+// Set by the io_uring loop: the batch is sent together with the verdicts
+static __thread int thread_raw_batch_deferred = 0;
 
-pthread_mutex_t raw6socket_lock;
-int raw6socket = -2;
+// Set by the queue threads when the targets are learned
+static __thread struct nft_learner *thread_learner = NULL;
 
 static struct config_t *cur_config = NULL;
 
@@ -97,112 +144,228 @@ static int close_socket(struct mnl_socket **nl) {
 	return 0;
 }
 
-static int open_raw_socket(void) {
-	if (rawsocket != -2) {
-		errno = EALREADY;
-		lgerror(-errno, "Raw socket is already opened");
-		return -1;
-	}
-	
-	rawsocket = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
-	if (rawsocket == -1) {
+/**
+ * Opens raw socket of the family marked with the youtubeUnblock mark.
+ */
+static int open_marked_raw_socket(int family) {
+	int sock = socket(family, SOCK_RAW, IPPROTO_RAW);
+	if (sock == -1) {
 		lgerror(-errno, "Unable to create raw socket");
 		return -1;
 	}
 
 	int mark = cur_config->mark;
-	if (setsockopt(rawsocket, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) < 0)
+	if (setsockopt(sock, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) < 0)
 	{
 		lgerror(-errno, "setsockopt(SO_MARK, %d) failed", mark);
+		close(sock);
 		return -1;
 	}
 
-	int mst = pthread_mutex_init(&rawsocket_lock, NULL);
-	if (mst) {
-		lgerror(-errno, "Mutex err: %d", mst);
-		close(rawsocket);
-		errno = mst;
+	return sock;
+}
+
+static void close_thread_raw_sockets(void);
 
+/**
+ * Opens raw sockets for the calling thread.
+ */
+static int open_thread_raw_sockets(void) {
+	thread_rawsocket = open_marked_raw_socket(AF_INET);
+	if (thread_rawsocket == -1) {
 		return -1;
 	}
 
+	if (cur_config->use_ipv6) {
+		thread_raw6socket = open_marked_raw_socket(AF_INET6);
+		if (thread_raw6socket == -1) {
+			close(thread_rawsocket);
+			thread_rawsocket = -1;
+			return -1;
+		}
+	}
 
-	return rawsocket;
-}
-
-static int close_raw_socket(void) {
-	if (rawsocket < 0) {
-		errno = EALREADY;
-		lgerror(-errno, "Raw socket is not set");
-		return -1;
+	// AVAILABLE_MTU is used and the TX ring is passed by without it
+	if (route_cache_thread_init(cur_config->mark) < 0) {
+		lgwarning("Route lookups are not available");
 	}
 
-	if (close(rawsocket)) {
-		lgerror(-errno, "Unable to close raw socket");
-		pthread_mutex_destroy(&rawsocket_lock);
-		return -1;
+	if (cur_config->raw_backend == RAW_BACKEND_PACKET) {
+		int ret = tx_ring_open(&thread_tx_ring, cur_config->tx_iface,
+				       cur_config->mark, cur_config->qdisc_bypass);
+		if (ret < 0) {
+			lgerror(ret, "Unable to map TX ring on %s",
+				cur_config->tx_iface);
+			close_thread_raw_sockets();
+			return -1;
+		}
 	}
 
-	pthread_mutex_destroy(&rawsocket_lock);
+	// Batching is optional: without the arena packets are sent one by one
+	thread_raw_batch = calloc(1, sizeof(struct raw_batch));
+	if (thread_raw_batch == NULL) {
+		lgerror(-ENOMEM, "Raw batch allocation error");
+	}
 
-	rawsocket = -2;
 	return 0;
 }
 
-static int open_raw6_socket(void) {
-	if (raw6socket != -2) {
-		errno = EALREADY;
-		lgerror(-errno, "Raw socket is already opened");
-		return -1;
+static void raw_batch_free(struct raw_batch *rb) {
+	if (rb == NULL)
+		return;
+
+	for (int i = 0; i < RAW_BATCH_SIZE; i++) {
+		free(rb->pkts[i].data);
 	}
-	
-	raw6socket = socket(AF_INET6, SOCK_RAW, IPPROTO_RAW);
-	if (rawsocket == -1) {
-		lgerror(-errno, "Unable to create raw socket");
-		return -1;
+	free(rb);
+}
+
+static void close_thread_raw_sockets(void) {
+	raw_batch_free(thread_raw_batch);
+	thread_raw_batch = NULL;
+
+	tx_ring_close(thread_tx_ring);
+	thread_tx_ring = NULL;
+
+	route_cache_thread_destroy();
+
+	if (thread_rawsocket >= 0) {
+		close(thread_rawsocket);
+		thread_rawsocket = -1;
 	}
 
-	int mark = cur_config->mark;
-	if (setsockopt(raw6socket, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) < 0)
-	{
-		lgerror(-errno, "setsockopt(SO_MARK, %d) failed", mark);
-		return -1;
+	if (thread_raw6socket >= 0) {
+		close(thread_raw6socket);
+		thread_raw6socket = -1;
+	}
+}
+
+/**
+ * Sends all the packets of the family queued in the batch
+ * with as few sendmmsg calls as possible.
+ */
+static int raw_batch_send_family(struct raw_batch *rb, int family) {
+	int sock = family == AF_INET ? thread_rawsocket : thread_raw6socket;
+	int n = 0;
+	int ret = 0;
+
+	for (int i = 0; i < rb->len; i++) {
+		struct raw_batch_pkt *rpkt = &rb->pkts[i];
+		if (rpkt->daddr.ss_family != family)
+			continue;
+
+		rb->iovs[n].iov_base = rpkt->data;
+		rb->iovs[n].iov_len = rpkt->len;
+		rb->msgs[n].msg_hdr = (struct msghdr){
+			.msg_name = &rpkt->daddr,
+			.msg_namelen = rpkt->daddr_len,
+			.msg_iov = &rb->iovs[n],
+			.msg_iovlen = 1,
+		};
+		n++;
 	}
 
-	int mst = pthread_mutex_init(&raw6socket_lock, NULL);
-	if (mst) {
-		lgerror(-errno, "Mutex err: %d", mst);
-		close(raw6socket);
+	int off = 0;
+	while (off < n) {
+		int sent = sendmmsg(sock, rb->msgs + off, n - off, MSG_DONTWAIT);
+		if (sent < 0) {
+			// Skip the failed packet and go on with the rest
+			ret = -errno;
+			lgerror(ret, "sendmmsg");
+			off++;
+			continue;
+		}
 
-		return -1;
+		off += sent;
 	}
 
+	return ret;
+}
+
+static int raw_batch_send(struct raw_batch *rb) {
+	int ret = 0;
+	int fret;
+
+	if (rb->len == 0)
+		return 0;
+
+	fret = raw_batch_send_family(rb, AF_INET);
+	if (fret < 0)
+		ret = fret;
 
-	return raw6socket;
+	fret = raw_batch_send_family(rb, AF_INET6);
+	if (fret < 0)
+		ret = fret;
+
+	rb->len = 0;
+
+	return ret;
 }
 
-static int close_raw6_socket(void) {
-	if (raw6socket < 0) {
-		errno = EALREADY;
-		lgerror(-errno, "Raw socket is not set");
-		return -1;
+/**
+ * Queues the packet to the thread batch if the batch is active.
+ * Returns 0 if the packet should be sent immediately.
+ */
+static int raw_batch_put(const uint8_t *pkt, size_t pktlen,
+			 const void *daddr, socklen_t daddr_len) {
+	struct raw_batch *rb = thread_raw_batch;
+
+	if (rb == NULL || !rb->active)
+		return 0;
+
+	if (rb->len == RAW_BATCH_SIZE) {
+		raw_batch_send(rb);
 	}
 
-	if (close(raw6socket)) {
-		lgerror(-errno, "Unable to close raw socket");
-		pthread_mutex_destroy(&rawsocket_lock);
-		return -1;
+	struct raw_batch_pkt *rpkt = &rb->pkts[rb->len];
+	if (rpkt->cap < pktlen) {
+		size_t cap = pktlen > RAW_BATCH_PKT_MIN ? pktlen : RAW_BATCH_PKT_MIN;
+		uint8_t *data = realloc(rpkt->data, cap);
+
+		if (data == NULL) {
+			// Sent right away after the queued ones
+			raw_batch_send(rb);
+			return 0;
+		}
+
+		rpkt->data = data;
+		rpkt->cap = cap;
 	}
 
-	pthread_mutex_destroy(&raw6socket_lock);
+	rb->len++;
+	memcpy(rpkt->data, pkt, pktlen);
+	rpkt->len = pktlen;
+	memcpy(&rpkt->daddr, daddr, daddr_len);
+	rpkt->daddr_len = daddr_len;
 
-	raw6socket = -2;
-	return 0;
+	return pktlen;
+}
+
+static void begin_raw_batch(void) {
+	if (thread_raw_batch != NULL) {
+		thread_raw_batch->active = 1;
+	}
+}
+
+static int flush_raw_batch(void) {
+	struct raw_batch *rb = thread_raw_batch;
+
+	if (rb == NULL || !rb->active)
+		return 0;
+
+	rb->active = 0;
+	if (thread_tx_ring != NULL)
+		tx_ring_kick(thread_tx_ring);
+
+	if (thread_raw_batch_deferred)
+		return 0;
+
+	return raw_batch_send(rb);
 }
 
 static int send_raw_ipv4(const uint8_t *pkt, size_t pktlen) {
 	int ret;
-	if (pktlen > AVAILABLE_MTU) return -ENOMEM;
+	if (pktlen > MAX_SEND_MTU) return -ENOMEM;
 
 	struct iphdr *iph;
 
@@ -221,16 +384,15 @@ static int send_raw_ipv4(const uint8_t *pkt, size_t pktlen) {
 		}
 	};
 
-	if (cur_config->threads != 1)
-		pthread_mutex_lock(&rawsocket_lock);
+	int sent = raw_batch_put(pkt, pktlen, &daddr, sizeof(daddr));
+	if (sent > 0) {
+		return sent;
+	}
 
-	int sent = sendto(rawsocket, 
-	    pkt, pktlen, MSG_DONTWAIT, 
+	sent = sendto(thread_rawsocket,
+	    pkt, pktlen, MSG_DONTWAIT,
 	    (struct sockaddr *)&daddr, sizeof(daddr));
 
-	if (cur_config->threads != 1)
-		pthread_mutex_unlock(&rawsocket_lock);
-
 	/* The function will return -errno on error as well as errno value set itself */
 	if (sent < 0) sent = -errno;
 
@@ -239,7 +401,7 @@ static int send_raw_ipv4(const uint8_t *pkt, size_t pktlen) {
 
 static int send_raw_ipv6(const uint8_t *pkt, size_t pktlen) {
 	int ret;
-	if (pktlen > AVAILABLE_MTU) return -ENOMEM;
+	if (pktlen > MAX_SEND_MTU) return -ENOMEM;
 
 	struct ip6_hdr *iph;
 
@@ -256,74 +418,77 @@ static int send_raw_ipv6(const uint8_t *pkt, size_t pktlen) {
 		.sin6_addr = iph->ip6_dst
 	};
 
-	if (cur_config->threads != 1)
-		pthread_mutex_lock(&rawsocket_lock);
+	int sent = raw_batch_put(pkt, pktlen, &daddr, sizeof(daddr));
+	if (sent > 0) {
+		lgtrace_addp("rawsocket queued %d", sent);
+		return sent;
+	}
 
-	int sent = sendto(raw6socket, 
-	    pkt, pktlen, MSG_DONTWAIT, 
+	sent = sendto(thread_raw6socket,
+	    pkt, pktlen, MSG_DONTWAIT,
 	    (struct sockaddr *)&daddr, sizeof(daddr));
 
 	lgtrace_addp("rawsocket sent %d", sent);
 
-	if (cur_config->threads != 1)
-		pthread_mutex_unlock(&rawsocket_lock);
-
 	/* The function will return -errno on error as well as errno value set itself */
 	if (sent < 0) sent = -errno;
 
 	return sent;
 }
 
+/**
+ * The ring frames and the raw socket packets leave in the order they
+ * are sent: the packets held on one path are let out before the other
+ * path is taken, so at most one of them holds packets.
+ */
+static void raw_batch_send_held(void) {
+	if (thread_raw_batch != NULL && thread_raw_batch->len != 0)
+		raw_batch_send(thread_raw_batch);
+}
+
 static int send_raw_socket(const uint8_t *pkt, size_t pktlen) {
+	size_t seglen = pmtu_segment_len(pkt, pktlen);
 	int ret;
 
-	if (pktlen > AVAILABLE_MTU) {
-		lgtrace("Split packet!");
-
-		size_t buff1_size = pktlen;
-		uint8_t *buff1 = malloc(buff1_size);
-		if (buff1 == NULL) {
-			lgerror(-ENOMEM, "Allocation error");
-			return -ENOMEM;
-		}
-		size_t buff2_size = pktlen;
-		uint8_t *buff2 = malloc(buff2_size);
-		if (buff2 == NULL) {
-			lgerror(-ENOMEM, "Allocation error");
-			free(buff1);
-			return -ENOMEM;
-		}
-
-		if ((ret = tcp_frag(pkt, pktlen, AVAILABLE_MTU-128,
-			buff1, &buff1_size, buff2, &buff2_size)) < 0) {
-
-			goto erret_lc;
+	if (seglen) {
+		if (thread_tx_ring != NULL)
+			raw_batch_send_held();
+
+		// Handed to the kernel in one piece, split by GSO
+		if (thread_tx_ring != NULL &&
+			(ret = tx_ring_send_gso(thread_tx_ring, pkt, pktlen,
+						seglen)) > 0) {
+			++global_stats.sent_counter;
+			++global_stats.tx_ring_counter;
+			lgtrace_addp("tx ring gso %d", ret);
+			return ret;
 		}
 
-		int sent = 0;
-		ret = send_raw_socket(buff1, buff1_size);
+		lgtrace("Split packet!");
 
-		if (ret >= 0) sent += ret;
-		else {
-			goto erret_lc;
-		}
+		uint8_t seg[MAX_SEND_MTU];
+		return tcp_segment(pkt, pktlen, seg, seglen, send_raw_socket);
+	}
+	
+	++global_stats.sent_counter;
 
-		ret = send_raw_socket(buff2, buff2_size);
-		if (ret >= 0) sent += ret;
-		else {
-			goto erret_lc;
-		}
+	if (thread_tx_ring != NULL &&
+		(ret = tx_ring_put(thread_tx_ring, pkt, pktlen)) > 0) {
+		++global_stats.tx_ring_counter;
+		// The frame waits for the kick, the held raw packets do not
+		raw_batch_send_held();
+		// The whole batch is kicked by flush_raw_batch
+		if (thread_raw_batch == NULL || !thread_raw_batch->active)
+			tx_ring_kick(thread_tx_ring);
 
-		free(buff1);
-		free(buff2);
-		return sent;
-erret_lc:
-		free(buff1);
-		free(buff2);
+		lgtrace_addp("tx ring queued %d", ret);
 		return ret;
 	}
-	
-	++global_stats.sent_counter;
+
+	// Too large for a frame or not routed out of the ring interface
+	if (thread_tx_ring != NULL)
+		tx_ring_kick(thread_tx_ring);
+
 	int ipvx = netproto_version(pkt, pktlen);
 
 	if (ipvx == IP4VERSION) {
@@ -561,91 +726,398 @@ static int yct_payload_parse(const void *payload,
 }
 
 
+/**
+ * Verdicts gathered over one mnl_cb_run pass.
+ * Consecutive ACCEPTs are squashed into a single NFQNL_MSG_VERDICT_BATCH,
+ * all other verdicts are put as standalone messages.
+ * The whole batch is sent with one syscall.
+ */
+struct verdict_batch {
+	struct mnl_nlmsg_batch *b;
+	char *buf;
+	// The last packet id of pending ACCEPT run
+	uint32_t accept_id;
+	// Number of packets in pending ACCEPT run
+	int accept_run;
+};
+
+// Fits one netlink message with the whole packet
+#define BUF_SIZE (0xffff + (MNL_SOCKET_BUFFER_SIZE / 2))
+
+// The batch sends itself when this limit is exceeded
+#define VERDICT_BATCH_LIMIT MNL_SOCKET_BUFFER_SIZE
+// Space for the limit and the overflowing message
+#define VERDICT_BATCH_BUFSIZE (VERDICT_BATCH_LIMIT + BUF_SIZE)
+
 // Per-queue data. Passed to queue_cb.
 struct queue_data {
 	struct mnl_socket **_nl;
 	int queue_num;
+	// Packet callback of the queue
+	mnl_cb_t cb;
+	// NULL if verdicts batching is disabled
+	struct verdict_batch *vbatch;
+	// BUF_SIZE buffer for standalone verdicts
+	char *verdict_buf;
+	// MAX_PACKET_SIZE buffer for the modified packet
+	uint8_t *mangle_buf;
 };
 
+static int verdict_batch_init(struct verdict_batch *vb) {
+	vb->buf = malloc(VERDICT_BATCH_BUFSIZE);
+	if (vb->buf == NULL) {
+		return -ENOMEM;
+	}
+
+	vb->b = mnl_nlmsg_batch_start(vb->buf, VERDICT_BATCH_LIMIT);
+	if (vb->b == NULL) {
+		free(vb->buf);
+		return -ENOMEM;
+	}
+
+	vb->accept_run = 0;
+	vb->accept_id = 0;
+
+	return 0;
+}
+
+static void verdict_batch_destroy(struct verdict_batch *vb) {
+	mnl_nlmsg_batch_stop(vb->b);
+	free(vb->buf);
+	vb->b = NULL;
+	vb->buf = NULL;
+}
+
+static int verdict_batch_send(struct mnl_socket *nl, struct verdict_batch *vb) {
+	if (mnl_nlmsg_batch_is_empty(vb->b))
+		return 0;
+
+	// Deferred raw packets must leave before the verdicts of their packets
+	if (thread_raw_batch != NULL) {
+		raw_batch_send(thread_raw_batch);
+	}
+
+	if (mnl_socket_sendto(nl, mnl_nlmsg_batch_head(vb->b),
+			mnl_nlmsg_batch_size(vb->b)) < 0) {
+		lgerror(-errno, "mnl_socket_send");
+		mnl_nlmsg_batch_reset(vb->b);
+		return -1;
+	}
+	++global_stats.verdict_batch_counter;
+
+	mnl_nlmsg_batch_reset(vb->b);
+	return 0;
+}
+
 /**
- * Used to accept unsupported packets (GSOs)
+ * Moves to the next message slot. Sends the batch if it is full.
  */
-static int fallback_accept_packet(uint32_t id, struct queue_data qdata) {
-	char buf[MNL_SOCKET_BUFFER_SIZE];
+static int verdict_batch_next(struct mnl_socket *nl, struct verdict_batch *vb) {
+	if (!mnl_nlmsg_batch_next(vb->b)) {
+		// mnl_nlmsg_batch_reset will keep the overflowed message
+		return verdict_batch_send(nl, vb);
+	}
+
+	return 0;
+}
+
+static int verdict_batch_put_accept_run(struct mnl_socket *nl,
+				int queue_num, struct verdict_batch *vb) {
 	struct nlmsghdr *verdnlh;
-        verdnlh = nfq_nlmsg_put(buf, NFQNL_MSG_VERDICT, qdata.queue_num);
-        nfq_nlmsg_verdict_put(verdnlh, id, NF_ACCEPT);
 
-        if (mnl_socket_sendto(*qdata._nl, verdnlh, verdnlh->nlmsg_len) < 0) {
-                lgerror(-errno, "mnl_socket_send");
-                return MNL_CB_ERROR;
-        }
+	if (vb->accept_run == 0)
+		return 0;
 
-        return MNL_CB_OK;
+	if (vb->accept_run == 1) {
+		verdnlh = nfq_nlmsg_put(mnl_nlmsg_batch_current(vb->b),
+			  NFQNL_MSG_VERDICT, queue_num);
+	} else {
+		verdnlh = nfq_nlmsg_put(mnl_nlmsg_batch_current(vb->b),
+			  NFQNL_MSG_VERDICT_BATCH, queue_num);
+	}
+	// For the batch verdict id is the highest id the verdict applies to.
+	nfq_nlmsg_verdict_put(verdnlh, vb->accept_id, NF_ACCEPT);
+	vb->accept_run = 0;
+
+	return verdict_batch_next(nl, vb);
 }
 
+/**
+ * Flushes pending ACCEPT run and sends the batch
+ */
+static int verdict_batch_flush(struct mnl_socket *nl,
+			       int queue_num, struct verdict_batch *vb) {
+	int ret;
 
-struct dps_t {
-	uint8_t *pkt;
-	size_t pktlen;
-	// Time for the packet in milliseconds
-	uint32_t timer;
-};
-// Note that the thread will automatically release dps_t and pkt_buff
-void *delay_packet_send_fn(void *data) {
-	struct dps_t *dpdt = data;
+	ret = verdict_batch_put_accept_run(nl, queue_num, vb);
+	if (ret < 0)
+		return ret;
 
-	uint8_t *pkt = dpdt->pkt;
-	size_t pktlen = dpdt->pktlen;
+	return verdict_batch_send(nl, vb);
+}
 
-	usleep(dpdt->timer * 1000);
-	int ret = send_raw_socket(pkt, pktlen);
-	if (ret < 0) {
-		errno = -ret;
-		lgerror(-errno, "send delayed raw packet");
+static void verdict_put(struct nlmsghdr *verdnlh,
+			uint32_t id, int verdict,
+			const uint8_t *payload, size_t payload_len,
+			uint32_t ct_mark) {
+	struct nlattr *nest;
+
+	nfq_nlmsg_verdict_put(verdnlh, id, verdict);
+	if (payload != NULL) {
+		nfq_nlmsg_verdict_put_pkt(verdnlh, payload, payload_len);
 	}
 
-	free(pkt);
-	free(dpdt);
-	return NULL;
+	if (ct_mark != 0) {
+		nest = mnl_attr_nest_start(verdnlh, NFQA_CT);
+		mnl_attr_put_u32(verdnlh, CTA_MARK, htonl(ct_mark));
+		// Other bits of the connmark are kept
+		mnl_attr_put_u32(verdnlh, CTA_MARK_MASK, htonl(ct_mark));
+		mnl_attr_nest_end(verdnlh, nest);
+	}
+}
+
+/**
+ * Sets the verdict for the packet. If batching is enabled, the verdict
+ * is postponed until verdict_batch_flush.
+ *
+ * If payload is not NULL, the packet is replaced with it.
+ * If ct_mark is not 0, its bits are set in the connection mark.
+ */
+static int queue_verdict_pkt(const struct queue_data *qdata,
+			 uint32_t id, int verdict,
+			 const uint8_t *payload, size_t payload_len,
+			 uint32_t ct_mark) {
+	struct verdict_batch *vb = qdata->vbatch;
+	struct nlmsghdr *verdnlh;
+	int ret;
+
+	if (vb == NULL) {
+		verdnlh = nfq_nlmsg_put(qdata->verdict_buf,
+			NFQNL_MSG_VERDICT, qdata->queue_num);
+		verdict_put(verdnlh, id, verdict, payload, payload_len, ct_mark);
+
+		if (mnl_socket_sendto(*qdata->_nl, verdnlh, verdnlh->nlmsg_len) < 0) {
+			lgerror(-errno, "mnl_socket_send");
+			return MNL_CB_ERROR;
+		}
+
+		return MNL_CB_OK;
+	}
+
+	if (verdict == NF_ACCEPT && payload == NULL && ct_mark == 0) {
+		vb->accept_id = id;
+		vb->accept_run++;
+		return MNL_CB_OK;
+	}
+
+	/**
+	 * Batch verdict applies to all the packets with lower id,
+	 * so the ACCEPT run should be terminated before any other verdict.
+	 */
+	ret = verdict_batch_put_accept_run(*qdata->_nl, qdata->queue_num, vb);
+	if (ret < 0)
+		return MNL_CB_ERROR;
+
+	verdnlh = nfq_nlmsg_put(mnl_nlmsg_batch_current(vb->b),
+			 NFQNL_MSG_VERDICT, qdata->queue_num);
+	verdict_put(verdnlh, id, verdict, payload, payload_len, ct_mark);
+
+	ret = verdict_batch_next(*qdata->_nl, vb);
+	if (ret < 0)
+		return MNL_CB_ERROR;
+
+	return MNL_CB_OK;
+}
+
+static int queue_verdict(const struct queue_data *qdata,
+			 uint32_t id, int verdict) {
+	return queue_verdict_pkt(qdata, id, verdict, NULL, 0, 0);
+}
+
+/**
+ * Used to accept unsupported packets (GSOs)
+ */
+static int fallback_accept_packet(uint32_t id, const struct queue_data *qdata) {
+	return queue_verdict(qdata, id, NF_ACCEPT);
 }
 
+
 int delay_packet_send(const unsigned char *data, size_t data_len, unsigned int delay_ms) {
 	int ret;
 
-	struct dps_t *dpdt = malloc(sizeof(struct dps_t));
-	if (dpdt == NULL) {
-		return -ENOMEM;
+	ret = dsched_submit(data, data_len, delay_ms);
+	if (ret == -ENOBUFS) {
+		// All the slots are busy, do not lose the packet
+		lgdebug("Delay scheduler is full, send packet immediately");
+		return send_raw_socket(data, data_len);
+	}
+	if (ret < 0) {
+		return ret;
 	}
-	*dpdt = (struct dps_t){0};
 
-	dpdt->pkt = malloc(data_len);
-	if (dpdt->pkt == NULL) {
-		free(dpdt);
-		return -ENOMEM;
+	lgtrace_addp("Scheduled packet send after %d ms", delay_ms);
+
+	return 0;
+}
+
+/**
+ * Queues the destination of the target packet to be added
+ * to the targets sets.
+ */
+static void learn_target(const uint8_t *pkt, size_t pktlen) {
+	int ret;
+
+	switch (netproto_version(pkt, pktlen)) {
+	case IP4VERSION:
+		if (pktlen < sizeof(struct iphdr))
+			return;
+		ret = nft_learner_add(thread_learner, AF_INET,
+			&((const struct iphdr *)pkt)->daddr, 0);
+		break;
+	case IP6VERSION:
+		if (pktlen < sizeof(struct ip6_hdr))
+			return;
+		ret = nft_learner_add(thread_learner, AF_INET6,
+			&((const struct ip6_hdr *)pkt)->ip6_dst, 0);
+		break;
+	default:
+		return;
 	}
-	memcpy(dpdt->pkt, data, data_len);
 
-	dpdt->pktlen = data_len;
-	dpdt->timer = delay_ms;
-	pthread_t thr = {0};
-	ret = pthread_create(&thr, NULL, delay_packet_send_fn, dpdt);
-	if (ret != 0) {
-		free(dpdt->pkt);
-		free(dpdt);
-		return -ret;
+	if (ret < 0) {
+		lgerror(ret, "Unable to send the learned targets");
+		return;
 	}
 
-	ret = pthread_detach(thr);
+	global_stats.learn_counter += ret;
+}
 
-	lgtrace_addp("Scheduled packet send after %d ms", delay_ms);
+/**
+ * Sends the targets learned over the receive batch.
+ */
+static void learned_targets_flush(void) {
+	int ret;
+
+	if (thread_learner == NULL)
+		return;
+
+	if ((ret = nft_learner_flush(thread_learner)) < 0) {
+		lgerror(ret, "Unable to send the learned targets");
+	}
+}
+
+static __thread struct shed_state thread_shed = {0};
+
+static void shed_timestamp(const struct nlattr *attr) {
+	const struct nfqnl_msg_packet_timestamp *ts;
+	struct timespec now;
+	int64_t usec;
+
+	if (mnl_attr_get_payload_len(attr) < sizeof(*ts))
+		return;
+
+	ts = mnl_attr_get_payload(attr);
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	usec = ((int64_t)now.tv_sec - (int64_t)be64toh(ts->sec)) * 1000000 +
+		now.tv_nsec / 1000 - (int64_t)be64toh(ts->usec);
+	shed_sample_latency(&thread_shed, usec);
+}
+
+/**
+ * Bytes waiting in the receive queue of the socket, 0 if unknown.
+ */
+static size_t shed_socket_backlog(int fd) {
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+		len <= SK_MEMINFO_RMEM_ALLOC * sizeof(uint32_t)) {
+		return 0;
+	}
+
+	return meminfo[SK_MEMINFO_RMEM_ALLOC];
+}
+
+/**
+ * Switches the shedding after the receive batch of msgs_len messages
+ * with bytes in total, read from fd at start.
+ */
+static void shed_batch_done(int fd, int msgs_len, size_t bytes,
+			    const struct timespec *start) {
+	struct shed_batch batch = {
+		.msgs_len = msgs_len,
+		.bytes = bytes,
+	};
+	struct timespec now;
+
+	if (!cur_config->shed_latency_budget)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	batch.busy_nsec = ((int64_t)now.tv_sec - start->tv_sec) * 1000000000 +
+		now.tv_nsec - start->tv_nsec;
+	batch.backlog = shed_socket_backlog(fd);
+
+	switch (shed_update(&thread_shed, &batch,
+		     cur_config->shed_latency_budget, cur_config->recv_batch)) {
+	case SHED_ENTER:
+		++global_stats.shed_enter_counter;
+		lginfo("Queue delay %ld us is over the budget, shedding the load",
+			(long)shed_delay(&thread_shed));
+		break;
+	case SHED_LEAVE:
+		++global_stats.shed_leave_counter;
+		lginfo("Queue delay %ld us, the load shedding stopped",
+			(long)shed_delay(&thread_shed));
+		break;
+	}
+}
+
+static void shed_batch_start(struct timespec *start) {
+	if (cur_config->shed_latency_budget)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/**
+ * While the load is shed only the destinations cached as the targets
+ * are processed, the rest is accepted unparsed.
+ */
+static int shed_keep_packet(const uint8_t *pkt, size_t pktlen) {
+	void *iph;
+	size_t iph_len;
+	struct tcphdr *tcph;
+	struct udphdr *udph;
+	struct vcache_key key;
+	uint8_t proto;
+	uint16_t dport;
+
+	if (!vcache_enabled())
+		return 0;
+
+	if (tcp_payload_split((uint8_t *)pkt, pktlen, &iph, &iph_len,
+			&tcph, NULL, NULL, NULL) == 0) {
+		proto = IPPROTO_TCP;
+		dport = tcph->dest;
+	} else if (udp_payload_split((uint8_t *)pkt, pktlen, &iph, &iph_len,
+			&udph, NULL, NULL) == 0) {
+		proto = IPPROTO_UDP;
+		dport = udph->dest;
+	} else {
+		return 0;
+	}
+
+	ITER_CONFIG_SECTIONS(cur_config, section) {
+		if (vcache_key_build(&key, iph, iph_len, proto, dport, section) == 0 &&
+			vcache_target_lookup(&key)) {
+			return 1;
+		}
+	}
 
 	return 0;
 }
 
 static int queue_cb(const struct nlmsghdr *nlh, void *data) {
-	char buf[MNL_SOCKET_BUFFER_SIZE];
-	
 	struct queue_data *qdata = data;
 
 	struct nfqnl_msg_packet_hdr *ph = NULL;
@@ -653,7 +1125,6 @@ static int queue_cb(const struct nlmsghdr *nlh, void *data) {
 	struct packet_data packet = {0};
 	struct ytb_conntrack *yct = &packet.yct;
 	struct nfgenmsg *nfg;
-	struct nlmsghdr *verdnlh;
 	int ret;
 	uint16_t l3num;	
 	uint32_t id;
@@ -664,6 +1135,10 @@ static int queue_cb(const struct nlmsghdr *nlh, void *data) {
                 lgerror(-errno, "Attr parse");
                 return MNL_CB_ERROR;
         }
+
+	if (attr[NFQA_TIMESTAMP] != NULL && cur_config->shed_latency_budget) {
+		shed_timestamp(attr[NFQA_TIMESTAMP]);
+	}
  
         if (attr[NFQA_PACKET_HDR] == NULL) {
 		errno = ENODATA;
@@ -684,17 +1159,24 @@ static int queue_cb(const struct nlmsghdr *nlh, void *data) {
 	if (attr[NFQA_CAP_LEN] != NULL &&
 		ntohl(mnl_attr_get_u32(attr[NFQA_CAP_LEN])) != packet.payload_len) {
 		lgerr("The packet was truncated! Skip!");
-		return fallback_accept_packet(id, *qdata);
+		return fallback_accept_packet(id, qdata);
 	}
 
 	if (attr[NFQA_MARK] != NULL) {
 		// Skip packets sent by rawsocket to escape infinity loop.
 		if (CHECK_BITFIELD(ntohl(mnl_attr_get_u32(attr[NFQA_MARK])),
 				cur_config->mark)) {
-			return fallback_accept_packet(id, *qdata);
+			return fallback_accept_packet(id, qdata);
 		}
 	}
 
+	if (thread_shed.active &&
+		!shed_keep_packet(packet.payload, packet.payload_len)) {
+		// Joins the ACCEPT run when the verdicts are batched
+		++global_stats.shed_counter;
+		return fallback_accept_packet(id, qdata);
+	}
+
 	if (attr[NFQA_CT] != NULL) {
 		ret = yct_payload_parse(
 			mnl_attr_get_payload(attr[NFQA_CT]),
@@ -711,33 +1193,608 @@ static int queue_cb(const struct nlmsghdr *nlh, void *data) {
 	}
 
 ct_out:
-	verdnlh = nfq_nlmsg_put(buf, NFQNL_MSG_VERDICT, qdata->queue_num);
+	packet.can_mangle = 1;
+	packet.mangled_payload = qdata->mangle_buf;
+	packet.mangled_payload_bufsize = MAX_PACKET_SIZE;
+	// Raw batches are flushed by process_packet and verdict_batch_send
+	packet.verdict_after_raw = 1;
 
 	ret = process_packet(cur_config, &packet);
 
 	++global_stats.packet_counter;
 
+	if (packet.target_matched && thread_learner != NULL) {
+		learn_target(packet.payload, packet.payload_len);
+	}
+
+	/**
+	 * Marked connection skips the queue in the firewall rules.
+	 * The mark is set only for packets with the conntrack entry.
+	 */
+	uint32_t ct_mark = 0;
+	if (cur_config->connmark_offload && packet.flow_decided &&
+		attr[NFQA_CT] != NULL) {
+		ct_mark = cur_config->connmark_offload;
+		++global_stats.offload_counter;
+	}
+
 	switch (ret) {
 		case PKT_DROP:
 			++global_stats.target_counter;
-			nfq_nlmsg_verdict_put(verdnlh, id, NF_DROP);
-			break;
+			return queue_verdict_pkt(qdata, id, NF_DROP,
+				NULL, 0, ct_mark);
+		case PKT_ACCEPT_MANGLED:
+			++global_stats.target_counter;
+			return queue_verdict_pkt(qdata, id, NF_ACCEPT,
+				packet.mangled_payload, packet.mangled_payload_len,
+				ct_mark);
 		default:
-			nfq_nlmsg_verdict_put(verdnlh, id, NF_ACCEPT);
-			break;
+			return queue_verdict_pkt(qdata, id, NF_ACCEPT,
+				NULL, 0, ct_mark);
 	}
+}
 
-        if (mnl_socket_sendto(*qdata->_nl, verdnlh, verdnlh->nlmsg_len) < 0) {
-                lgerror(-errno, "mnl_socket_send");
-                return MNL_CB_ERROR;
-        }
-	
-	return MNL_CB_OK;
+
+// Clients may connect a bit after the record expires in the cache
+#define DNS_TTL_SLACK 60
+
+/**
+ * Learns the addresses of the response if the asked name
+ * is a target of some section.
+ */
+static void learn_dns_response(const uint8_t *pkt, size_t pktlen) {
+	const uint8_t *data;
+	size_t dlen;
+	struct dns_response resp;
+	int ret;
+
+	ret = udp_payload_split((uint8_t *)pkt, pktlen, NULL, NULL, NULL,
+			 (uint8_t **)&data, &dlen);
+	if (ret < 0)
+		return;
+
+	if (dns_parse_response(data, dlen, &resp) < 0)
+		return;
+
+	// There is no IPv6 targets set to add them to
+	if (!cur_config->use_ipv6)
+		dns_drop_family(&resp, AF_INET6);
+
+	if (resp.answers_len == 0)
+		return;
+
+	ITER_CONFIG_SECTIONS(cur_config, section) {
+		if (!section->tls_enabled &&
+			section->udp_filter_quic == UDP_FILTER_QUIC_DISABLED) {
+			continue;
+		}
+
+		if (dns_name_is_target(section, resp.qname, resp.qname_len))
+			goto learn;
+	}
+
+	return;
+
+learn:
+	lgdebug("DNS target %s: %d addresses", resp.qname, resp.answers_len);
+
+	for (int i = 0; i < resp.answers_len; i++) {
+		const struct dns_addr_answer *ans = &resp.answers[i];
+		uint64_t timeout = ((uint64_t)ans->ttl + DNS_TTL_SLACK) * 1000;
+
+		ret = nft_learner_add(thread_learner, ans->family, ans->addr, timeout);
+		if (ret < 0) {
+			lgerror(ret, "Unable to send the learned targets");
+			return;
+		}
+
+		global_stats.learn_counter += ret;
+	}
 }
 
-#define BUF_SIZE (0xffff + (MNL_SOCKET_BUFFER_SIZE / 2))
+/**
+ * DNS responses are only looked at, the verdict is always accept.
+ */
+static int dns_queue_cb(const struct nlmsghdr *nlh, void *data) {
+	struct queue_data *qdata = data;
+	struct nfqnl_msg_packet_hdr *ph;
+	struct nlattr *attr[NFQA_MAX+1] = {0};
+	uint32_t id;
+
+	if (nfq_nlmsg_parse(nlh, attr) < 0) {
+		lgerror(-errno, "Attr parse");
+		return MNL_CB_ERROR;
+	}
+
+	if (attr[NFQA_PACKET_HDR] == NULL) {
+		errno = ENODATA;
+		lgerror(-errno, "Metaheader not set");
+		return MNL_CB_ERROR;
+	}
+
+	ph = mnl_attr_get_payload(attr[NFQA_PACKET_HDR]);
+	id = ntohl(ph->packet_id);
+
+	if (attr[NFQA_PAYLOAD] != NULL && thread_learner != NULL) {
+		learn_dns_response(mnl_attr_get_payload(attr[NFQA_PAYLOAD]),
+			mnl_attr_get_payload_len(attr[NFQA_PAYLOAD]));
+	}
+
+	return queue_verdict(qdata, id, NF_ACCEPT);
+}
+
+#define QUEUE_STATS_FILE "/proc/net/netfilter/nfnetlink_queue"
+// How often the kernel queue stats are read, in seconds
+#define QUEUE_STATS_INTERVAL 5
+
+/**
+ * Sums up kernel drop counters of youtubeUnblock queues into global_stats.
+ *
+ * Each line of the file describes one queue:
+ * queue_num portid queue_total copy_mode copy_range
+ * queue_dropped user_dropped id_sequence 1
+ */
+static int read_queue_drop_stats(void) {
+	unsigned long queue_dropped = 0;
+	unsigned long user_dropped = 0;
+	char line[256];
+
+	FILE *f = fopen(QUEUE_STATS_FILE, "r");
+	if (f == NULL) {
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned int qnum;
+		unsigned long qdropped, udropped;
+
+		if (sscanf(line, "%u %*u %*u %*u %*u %lu %lu",
+			&qnum, &qdropped, &udropped) != 3) {
+			continue;
+		}
+
+		if (qnum < cur_config->queue_start_num ||
+			qnum >= cur_config->queue_start_num + cur_config->threads) {
+			continue;
+		}
+
+		queue_dropped += qdropped;
+		user_dropped += udropped;
+	}
+
+	fclose(f);
+
+	global_stats.queue_dropped = queue_dropped;
+	global_stats.queue_user_dropped = user_dropped;
+
+	return 0;
+}
+
+/**
+ * Sets netlink socket receive buffer. SO_RCVBUFFORCE overrides
+ * net.core.rmem_max but requires CAP_NET_ADMIN, so falls back to SO_RCVBUF.
+ */
+static int set_queue_rcvbuf(struct mnl_socket *nl, int size) {
+	int fd = mnl_socket_get_fd(nl);
+	int effsize;
+	socklen_t optlen = sizeof(effsize);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0) {
+		lgdebug("SO_RCVBUFFORCE failed: %s, trying SO_RCVBUF", strerror(errno));
+
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+			lgerror(-errno, "setsockopt(SO_RCVBUF, %d)", size);
+			return -errno;
+		}
+	}
 
-int init_queue(int queue_num) {
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &effsize, &optlen) == 0) {
+		// The kernel doubles the value for the bookkeeping overhead
+		lginfo("Queue receive buffer is set to %d bytes", effsize);
+	}
+
+	return 0;
+}
+
+/**
+ * Per-thread ring of receive buffers.
+ * Drained from the netlink socket with one recvmmsg call.
+ */
+struct recv_ring {
+	int size;
+	char *bufs;
+	struct iovec *iovs;
+	struct mmsghdr *msgs;
+	struct sockaddr_nl *addrs;
+};
+
+static void recv_ring_destroy(struct recv_ring *ring) {
+	free(ring->bufs);
+	free(ring->iovs);
+	free(ring->msgs);
+	free(ring->addrs);
+	ring->bufs = NULL;
+	ring->iovs = NULL;
+	ring->msgs = NULL;
+	ring->addrs = NULL;
+}
+
+static int recv_ring_init(struct recv_ring *ring, int size) {
+	*ring = (struct recv_ring){0};
+	ring->size = size;
+	ring->bufs = malloc((size_t)size * BUF_SIZE);
+	ring->iovs = calloc(size, sizeof(struct iovec));
+	ring->msgs = calloc(size, sizeof(struct mmsghdr));
+	ring->addrs = calloc(size, sizeof(struct sockaddr_nl));
+
+	if (ring->bufs == NULL || ring->iovs == NULL ||
+		ring->msgs == NULL || ring->addrs == NULL) {
+		recv_ring_destroy(ring);
+		return -ENOMEM;
+	}
+
+	for (int i = 0; i < size; i++) {
+		ring->iovs[i].iov_base = ring->bufs + (size_t)i * BUF_SIZE;
+		ring->iovs[i].iov_len = BUF_SIZE;
+	}
+
+	return 0;
+}
+
+/**
+ * Waits for at least one message and drains up to ring->size
+ * messages without blocking.
+ *
+ * Returns the number of received messages or -errno.
+ */
+static int recv_ring_fill(struct mnl_socket *nl, struct recv_ring *ring) {
+	int ret;
+
+	for (int i = 0; i < ring->size; i++) {
+		ring->msgs[i].msg_hdr = (struct msghdr){
+			.msg_name = &ring->addrs[i],
+			.msg_namelen = sizeof(struct sockaddr_nl),
+			.msg_iov = &ring->iovs[i],
+			.msg_iovlen = 1,
+		};
+		ring->msgs[i].msg_len = 0;
+	}
+
+	ret = recvmmsg(mnl_socket_get_fd(nl), ring->msgs, ring->size,
+		MSG_WAITFORONE, NULL);
+	if (ret < 0) {
+		return -errno;
+	}
+
+	++global_stats.recv_batch_counter;
+	global_stats.recv_msg_counter += ret;
+
+	return ret;
+}
+
+/**
+ * Same validation as mnl_socket_recvfrom does.
+ */
+static int recv_ring_msg_valid(const struct recv_ring *ring, int i) {
+	const struct mmsghdr *msg = &ring->msgs[i];
+
+	if (msg->msg_hdr.msg_namelen != sizeof(struct sockaddr_nl)) {
+		return -EINVAL;
+	}
+	if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+		return -ENOSPC;
+	}
+	// Drop messages not originated by the kernel
+	if (ring->addrs[i].nl_pid != 0) {
+		return -ENOMSG;
+	}
+
+	return 0;
+}
+
+static int queue_process_msg(void *buf, size_t len, uint32_t portid,
+			     struct queue_data *qdata) {
+	int ret;
+
+	ret = mnl_cb_run(buf, len, 0, portid, qdata->cb, qdata);
+	if (ret < 0) {
+		lgerror(ret, "mnl_cb_run");
+		if (ret == -EPERM) {
+			lgerr("Probably another instance of youtubeUnblock with the same queue number is running");
+		} else {
+			lgerr("Make sure the nfnetlink_queue kernel module is loaded");
+		}
+	}
+
+	return ret;
+}
+
+static void queue_poll_stats(int stats_reader, time_t *stats_time) {
+	int ret;
+
+	if (stats_reader && time(NULL) - *stats_time >= QUEUE_STATS_INTERVAL) {
+		*stats_time = time(NULL);
+		if ((ret = read_queue_drop_stats()) < 0) {
+			lgerror(ret, "Unable to read %s", QUEUE_STATS_FILE);
+		}
+	}
+}
+
+#ifdef USE_IO_URING
+
+#define URING_ENTRIES 128
+// Minimal number of provided receive buffers
+#define URING_MIN_RECV_BUFS 8
+#define URING_UD_RECV 1
+#define URING_UD_TX 2
+// queue_loop_uring return value when io_uring is not usable
+#define URING_FALLBACK 1
+
+struct uring_recv_cqe {
+	int32_t res;
+	uint32_t flags;
+};
+
+/**
+ * io_uring queue loop state.
+ *
+ * A multishot receive stays posted on the netlink socket.
+ * After each batch of received messages the deferred raw packets
+ * and the verdict batch are submitted as one linked chain.
+ * Receive completions are not processed while the chain is
+ * in flight, since it owns the raw and verdict buffers.
+ */
+struct uring_queue {
+	struct uring ring;
+	struct uring_buf_ring br;
+	int nlfd;
+	// Submitted TX requests not completed yet
+	int tx_inflight;
+	// Receive completions waiting for the TX chain
+	struct uring_recv_cqe *pending;
+	int pending_len;
+	// Set after the first successful receive
+	int recv_works;
+};
+
+static int uring_arm_recv(struct uring_queue *uq) {
+	struct io_uring_sqe *sqe = uring_get_sqe(&uq->ring);
+	if (sqe == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = uq->nlfd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = uq->br.bgid;
+	sqe->user_data = URING_UD_RECV;
+
+	return 0;
+}
+
+/**
+ * Prepares the TX chain: raw packets in the batch order,
+ * then the verdict batch. IOSQE_IO_HARDLINK keeps the chain
+ * going when some raw packet fails.
+ */
+static int uring_prep_tx(struct uring_queue *uq, struct queue_data *qdata) {
+	struct raw_batch *rb = thread_raw_batch;
+	struct verdict_batch *vb = qdata->vbatch;
+	struct io_uring_sqe *sqe = NULL;
+	int ret;
+
+	for (int i = 0; i < rb->len; i++) {
+		struct raw_batch_pkt *rpkt = &rb->pkts[i];
+
+		sqe = uring_get_sqe(&uq->ring);
+		if (sqe == NULL)
+			return -EBUSY;
+
+		rb->iovs[i].iov_base = rpkt->data;
+		rb->iovs[i].iov_len = rpkt->len;
+		rb->msgs[i].msg_hdr = (struct msghdr){
+			.msg_name = &rpkt->daddr,
+			.msg_namelen = rpkt->daddr_len,
+			.msg_iov = &rb->iovs[i],
+			.msg_iovlen = 1,
+		};
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = rpkt->daddr.ss_family == AF_INET ?
+			thread_rawsocket : thread_raw6socket;
+		sqe->addr = (uint64_t)(uintptr_t)&rb->msgs[i].msg_hdr;
+		sqe->len = 1;
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe->user_data = URING_UD_TX;
+		uq->tx_inflight++;
+	}
+
+	ret = verdict_batch_put_accept_run(*qdata->_nl, qdata->queue_num, vb);
+	if (ret < 0)
+		return ret;
+
+	if (mnl_nlmsg_batch_is_empty(vb->b)) {
+		// The last link is not followed by anything
+		if (sqe != NULL)
+			sqe->flags = 0;
+		return 0;
+	}
+
+	sqe = uring_get_sqe(&uq->ring);
+	if (sqe == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = uq->nlfd;
+	sqe->addr = (uint64_t)(uintptr_t)mnl_nlmsg_batch_head(vb->b);
+	sqe->len = mnl_nlmsg_batch_size(vb->b);
+	sqe->user_data = URING_UD_TX;
+	uq->tx_inflight++;
+	++global_stats.verdict_batch_counter;
+
+	return 0;
+}
+
+static void uring_tx_done(struct queue_data *qdata) {
+	thread_raw_batch->len = 0;
+	mnl_nlmsg_batch_reset(qdata->vbatch->b);
+}
+
+/**
+ * Handles one receive completion.
+ * Returns URING_FALLBACK if multishot receive is not supported.
+ */
+static int uring_handle_recv(struct uring_queue *uq,
+			     const struct uring_recv_cqe *rcqe,
+			     uint32_t portid, struct queue_data *qdata) {
+	int ret = 0;
+
+	if (rcqe->res < 0) {
+		if (rcqe->res == -EINVAL && !uq->recv_works) {
+			lgerror(rcqe->res, "io_uring multishot receive is not supported, falling back to recvmmsg");
+			return URING_FALLBACK;
+		}
+		if (rcqe->res != -ENOBUFS) {
+			lgerror(rcqe->res, "io_uring recv");
+			return rcqe->res;
+		}
+
+		// Either the socket or the provided buffers were overrun
+		if (cur_config->queue_drop_stats)
+			++global_stats.enobufs_counter;
+	} else if (rcqe->flags & IORING_CQE_F_BUFFER) {
+		uint16_t bid = rcqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+		uq->recv_works = 1;
+		++global_stats.recv_msg_counter;
+		if (rcqe->res > 0) {
+			ret = queue_process_msg(uring_buf_ring_buf(&uq->br, bid),
+				  rcqe->res, portid, qdata);
+		}
+		uring_buf_ring_recycle(&uq->br, bid);
+		if (ret < 0)
+			return ret;
+	}
+
+	// Multishot receive was terminated, post it again
+	if (!(rcqe->flags & IORING_CQE_F_MORE)) {
+		return uring_arm_recv(uq);
+	}
+
+	return 0;
+}
+
+/**
+ * Runs the queue on io_uring. Never returns on success.
+ * Returns URING_FALLBACK if io_uring is not usable, so the
+ * caller should go on with the recvmmsg loop.
+ */
+static int queue_loop_uring(struct mnl_socket *nl, uint32_t portid,
+			    struct queue_data *qdata, int stats_reader) {
+	struct uring_queue uq = {0};
+	struct io_uring_cqe *cqe;
+	time_t stats_time = 0;
+	unsigned int bufs_num = URING_MIN_RECV_BUFS;
+	int ret;
+
+	// Provided buffers ring size must be a power of 2
+	while (bufs_num < (unsigned int)cur_config->recv_batch)
+		bufs_num <<= 1;
+
+	ret = uring_init(&uq.ring, URING_ENTRIES);
+	if (ret < 0) {
+		lgerror(ret, "io_uring is not available, falling back to recvmmsg");
+		return URING_FALLBACK;
+	}
+
+	ret = uring_buf_ring_init(&uq.ring, &uq.br, bufs_num, BUF_SIZE, 0);
+	if (ret < 0) {
+		lgerror(ret, "io_uring provided buffers are not supported, falling back to recvmmsg");
+		ret = URING_FALLBACK;
+		goto die_ring;
+	}
+
+	// Each buffer yields at most one completion, plus the terminating one
+	uq.pending = calloc(bufs_num + 1, sizeof(struct uring_recv_cqe));
+	if (uq.pending == NULL) {
+		lgerror(-ENOMEM, "Allocation error");
+		ret = -ENOMEM;
+		goto die_bufs;
+	}
+
+	uq.nlfd = mnl_socket_get_fd(nl);
+	thread_raw_batch_deferred = 1;
+
+	if ((ret = uring_arm_recv(&uq)) < 0)
+		goto die;
+
+	lgdebug("Queue %d runs on io_uring", qdata->queue_num);
+
+	while (1) {
+		ret = uring_submit(&uq.ring, 1);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0) {
+			lgerror(ret, "io_uring_enter");
+			goto die;
+		}
+
+		while ((cqe = uring_peek_cqe(&uq.ring)) != NULL) {
+			if (cqe->user_data == URING_UD_TX) {
+				if (cqe->res < 0 && cqe->res != -ECANCELED) {
+					lgerror(cqe->res, "io_uring send");
+				}
+				if (--uq.tx_inflight == 0)
+					uring_tx_done(qdata);
+			} else {
+				uq.pending[uq.pending_len++] = (struct uring_recv_cqe){
+					.res = cqe->res,
+					.flags = cqe->flags,
+				};
+			}
+			uring_cqe_seen(&uq.ring);
+		}
+
+		if (uq.tx_inflight != 0 || uq.pending_len == 0)
+			continue;
+
+		struct timespec batch_start;
+		size_t batch_bytes = 0;
+		shed_batch_start(&batch_start);
+
+		for (int i = 0; i < uq.pending_len; i++) {
+			if (uq.pending[i].res > 0)
+				batch_bytes += uq.pending[i].res;
+			ret = uring_handle_recv(&uq, &uq.pending[i], portid, qdata);
+			if (ret != 0)
+				goto die;
+		}
+		shed_batch_done(uq.nlfd, uq.pending_len, batch_bytes, &batch_start);
+		uq.pending_len = 0;
+		++global_stats.recv_batch_counter;
+
+		if ((ret = uring_prep_tx(&uq, qdata)) < 0) {
+			lgerror(ret, "io_uring TX submission");
+			goto die;
+		}
+
+		learned_targets_flush();
+		queue_poll_stats(stats_reader, &stats_time);
+	}
+
+die:
+	thread_raw_batch_deferred = 0;
+	free(uq.pending);
+die_bufs:
+	uring_buf_ring_destroy(&uq.ring, &uq.br);
+die_ring:
+	uring_destroy(&uq.ring);
+	return ret;
+}
+
+#endif /* USE_IO_URING */
+
+int init_queue(int queue_num, mnl_cb_t cb) {
 	struct mnl_socket *nl;
 
 	if (open_socket(&nl)) {
@@ -824,45 +1881,176 @@ int init_queue(int queue_num) {
 		goto die;
 	}
 
+	if (cur_config->queue_maxlen) {
+		nlh = nfq_nlmsg_put(buf, NFQNL_MSG_CONFIG, queue_num);
+		nfq_nlmsg_cfg_put_qmaxlen(nlh, cur_config->queue_maxlen);
+
+		if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
+			lgerror(-errno, "mnl_socket_send");
+			goto die;
+		}
+	}
+
+	if (cur_config->queue_rcvbuf) {
+		if (set_queue_rcvbuf(nl, cur_config->queue_rcvbuf) < 0) {
+			goto die;
+		}
+	}
 
+	int ret = 1;
 	/* ENOBUFS is signalled to userspace when packets were lost
           * on kernel side.  In most cases, userspace isn't interested
           * in this information, so turn it off.
           */
-	int ret = 1;
-	mnl_socket_setsockopt(nl, NETLINK_NO_ENOBUFS, &ret, sizeof(int));
+	if (!cur_config->queue_drop_stats) {
+		mnl_socket_setsockopt(nl, NETLINK_NO_ENOBUFS, &ret, sizeof(int));
+	}
+	/**
+	 * NFQA_TIMESTAMP is set on the packets only while some socket
+	 * asks for the receive timestamps.
+	 */
+	if (cur_config->shed_latency_budget) {
+		if (setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_TIMESTAMP,
+				&ret, sizeof(ret)) < 0) {
+			lgerror(-errno, "setsockopt(SO_TIMESTAMP)");
+			goto die;
+		}
+
+		uint32_t meminfo[SK_MEMINFO_VARS];
+		socklen_t meminfo_len = sizeof(meminfo);
+		if (getsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_MEMINFO,
+				meminfo, &meminfo_len) < 0) {
+			lginfo("WARNING: The queue backlog is unknown without SO_MEMINFO, "
+				"the load shedding is decided by the packet timestamps only");
+		}
+	}
+
+	// Only one thread reads kernel stats for all the queues
+	int stats_reader = cur_config->queue_drop_stats &&
+		queue_num == cur_config->queue_start_num;
+	time_t stats_time = 0;
 
+	struct recv_ring ring = {0};
+	struct verdict_batch vbatch;
+	// Config messages are sent already, so buf is free to be used for verdicts
 	struct queue_data qdata = {
 		._nl = &nl,
-		.queue_num = queue_num
+		.queue_num = queue_num,
+		.cb = cb,
+		.vbatch = NULL,
+		.verdict_buf = buf,
+		.mangle_buf = NULL,
 	};
 
+	qdata.mangle_buf = malloc(MAX_PACKET_SIZE);
+	if (qdata.mangle_buf == NULL) {
+		lgerror(-ENOMEM, "Allocation error");
+		goto die;
+	}
+
+	// io_uring loop sends the verdicts only in batches
+	if (cur_config->batch_verdicts || cur_config->io_uring) {
+		if ((ret = verdict_batch_init(&vbatch)) < 0) {
+			lgerror(ret, "Verdict batch allocation error");
+			goto die_mangle;
+		}
+		qdata.vbatch = &vbatch;
+	}
+
+	if ((ret = recv_ring_init(&ring, cur_config->recv_batch)) < 0) {
+		lgerror(ret, "Receive ring allocation error");
+		goto die_batch;
+	}
+
+	struct nft_learner learner;
+	if (cur_config->nft_learn_timeout) {
+		if ((ret = nft_learner_init(&learner)) < 0) {
+			lgerror(ret, "Unable to open the targets learner socket");
+			goto die_ring;
+		}
+		thread_learner = &learner;
+	}
+
 	lginfo("Queue %d started", qdata.queue_num);
 
+#ifdef USE_IO_URING
+	if (cur_config->io_uring) {
+		ret = queue_loop_uring(nl, portid, &qdata, stats_reader);
+		if (ret != URING_FALLBACK) {
+			goto die_learner;
+		}
+	}
+#endif
+
 	while (1) {
-		ret = mnl_socket_recvfrom(nl, buf, BUF_SIZE);
-		if (ret == -1) {
-			lgerror(-errno, "mnl_socket_recvfrom");
-			goto die;
+		int msgs_len = recv_ring_fill(nl, &ring);
+		if (msgs_len == -ENOBUFS && cur_config->queue_drop_stats) {
+			// Some messages were lost on the socket, the queue goes on
+			++global_stats.enobufs_counter;
+			continue;
+		}
+		if (msgs_len < 0) {
+			lgerror(msgs_len, "recvmmsg");
+			goto die_learner;
 		}
 
-		ret = mnl_cb_run(buf, ret, 0, portid, queue_cb, &qdata);
-		if (ret < 0) {
-			lgerror(ret, "mnl_cb_run");
-			if (ret == -EPERM) {
-				lgerr("Probably another instance of youtubeUnblock with the same queue number is running");
-			} else {
-				lgerr("Make sure the nfnetlink_queue kernel module is loaded");
+		struct timespec batch_start;
+		size_t batch_bytes = 0;
+		shed_batch_start(&batch_start);
+
+		for (int i = 0; i < msgs_len; i++) {
+			batch_bytes += ring.msgs[i].msg_len;
+			ret = recv_ring_msg_valid(&ring, i);
+			if (ret < 0) {
+				lgerror(ret, "Netlink message dropped");
+				continue;
 			}
-			goto die;
+
+			ret = queue_process_msg(ring.iovs[i].iov_base,
+					ring.msgs[i].msg_len, portid, &qdata);
+			if (ret < 0) {
+				goto die_learner;
+			}
+		}
+
+		if (qdata.vbatch != NULL &&
+			verdict_batch_flush(nl, queue_num, qdata.vbatch) < 0) {
+			goto die_learner;
 		}
+
+		shed_batch_done(mnl_socket_get_fd(nl), msgs_len, batch_bytes,
+			  &batch_start);
+		learned_targets_flush();
+		queue_poll_stats(stats_reader, &stats_time);
 	}
 
 
+	if (thread_learner != NULL) {
+		nft_learner_destroy(thread_learner);
+		thread_learner = NULL;
+	}
+	vcache_thread_destroy();
+	recv_ring_destroy(&ring);
+	if (qdata.vbatch != NULL)
+		verdict_batch_destroy(qdata.vbatch);
+	free(qdata.mangle_buf);
 	free(buf);
 	close_socket(&nl);
 	return 0;
 
+die_learner:
+	if (thread_learner != NULL) {
+		nft_learner_destroy(thread_learner);
+		thread_learner = NULL;
+	}
+	vcache_thread_destroy();
+die_ring:
+	recv_ring_destroy(&ring);
+die_batch:
+	if (qdata.vbatch != NULL)
+		verdict_batch_destroy(qdata.vbatch);
+die_mangle:
+	free(qdata.mangle_buf);
 die:
 	free(buf);
 die_alloc:
@@ -881,24 +2069,133 @@ struct queue_res {
 };
 static struct queue_res defqres = {0};
 
-static struct queue_res threads_reses[MAX_THREADS];
+// Allocated for config->threads entries
+static struct queue_res *threads_reses;
+
+/**
+ * Applies cpu affinity and scheduling policy to the calling queue thread.
+ *
+ * Should be called before any thread buffers are allocated:
+ * with the default first-touch policy the kernel puts the pages
+ * to the NUMA node of the cpu the thread runs on.
+ */
+static int setup_queue_thread(int i) {
+	int ret;
+
+	if (cur_config->cpu_affinity_len != 0) {
+		int cpu = cur_config->cpu_affinity[i % cur_config->cpu_affinity_len];
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (ret != 0) {
+			lgerror(-ret, "Unable to pin thread %d to CPU %d", i, cpu);
+			return -ret;
+		}
+
+		lginfo("Thread %d is pinned to CPU %d", i, cpu);
+	}
+
+	if (cur_config->sched_fifo_prio != 0) {
+		struct sched_param param = {
+			.sched_priority = cur_config->sched_fifo_prio
+		};
+
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret != 0) {
+			lgerror(-ret, "Unable to set SCHED_FIFO priority %d for thread %d",
+				cur_config->sched_fifo_prio, i);
+			return -ret;
+		}
+
+		lginfo("Thread %d runs with SCHED_FIFO priority %d",
+			i, cur_config->sched_fifo_prio);
+	}
+
+	return 0;
+}
 
 void *init_queue_wrapper(void *qdconf) {
 	struct queue_conf *qconf = qdconf;
 	struct queue_res *thres = threads_reses + qconf->i;
+
+	if ((thres->status = setup_queue_thread(qconf->i)) < 0) {
+		return thres;
+	}
+
+	if (open_thread_raw_sockets() < 0) {
+		thres->status = -1;
+		lgerr("Thread %d: unable to open raw sockets", qconf->i);
+		return thres;
+	}
 	
-	thres->status = init_queue(qconf->queue_num);
+	thres->status = init_queue(qconf->queue_num, queue_cb);
+
+	close_thread_raw_sockets();
 
 	lgerror(thres->status, "Thread %d exited with status %d", qconf->i, thres->status);
 
 	return thres;
 }
 
+static void *dns_queue_wrapper(void *arg) {
+	int ret;
+
+	ret = init_queue(cur_config->dns_queue_num, dns_queue_cb);
+	if (ret < 0) {
+		lgerror(ret, "DNS queue %d exited, targets are learned from SNI only",
+			cur_config->dns_queue_num);
+	}
+
+	return NULL;
+}
+
 struct instance_config_t instance_config = {
 	.send_raw_packet = send_raw_socket,
 	.send_delayed_packet = delay_packet_send,
+	.begin_raw_batch = begin_raw_batch,
+	.flush_raw_batch = flush_raw_batch,
+	.path_mtu = pmtu_get,
 };
 
+// Set when the rules are installed, so they are removed on exit
+static int nft_installed = 0;
+
+static int install_nft_rules(const struct config_t *config) {
+	struct nft_ruleset rs;
+	int ret;
+
+	ret = nft_ruleset_compile(config, &rs);
+	if (ret < 0)
+		return ret;
+
+	ret = nft_rules_install(&rs);
+	if (ret < 0) {
+		lgerror(ret, "Unable to install nftables rules");
+		lgerr("Make sure the kernel supports nf_tables with queue and ct expressions");
+	} else {
+		lginfo("nftables table inet %s installed", NFT_TABLE_NAME);
+		nft_installed = 1;
+	}
+
+	nft_ruleset_destroy(&rs);
+	return ret;
+}
+
+static void remove_nft_rules(void) {
+	int ret;
+
+	if (!nft_installed)
+		return;
+
+	nft_installed = 0;
+	if ((ret = nft_rules_remove()) < 0) {
+		lgerror(ret, "Unable to remove nftables table inet %s", NFT_TABLE_NAME);
+	}
+}
+
 void sigint_handler(int s) {
 	lginfo("youtubeUnblock stats: catched %ld packets, "
 		"processed %ld packets, "
@@ -906,6 +2203,63 @@ void sigint_handler(int s) {
 		global_stats.all_packet_counter, global_stats.packet_counter, 
 		global_stats.target_counter, global_stats.sent_counter);
 
+	if (cur_config != NULL && cur_config->batch_verdicts) {
+		lginfo("Verdicts sent in %ld batches",
+			global_stats.verdict_batch_counter);
+	}
+
+	if (cur_config != NULL && cur_config->recv_batch > 1 &&
+		global_stats.recv_batch_counter != 0) {
+		lginfo("Received %ld netlink messages in %ld batches, "
+			"average batch fill %ld.%02ld of %d",
+			global_stats.recv_msg_counter,
+			global_stats.recv_batch_counter,
+			global_stats.recv_msg_counter / global_stats.recv_batch_counter,
+			global_stats.recv_msg_counter * 100 /
+				global_stats.recv_batch_counter % 100,
+			cur_config->recv_batch);
+	}
+
+	if (cur_config != NULL && cur_config->connmark_offload) {
+		lginfo("Offloaded %ld connections with conntrack mark",
+			global_stats.offload_counter);
+	}
+
+	if (cur_config != NULL && cur_config->nft_learn_timeout) {
+		lginfo("Queued %ld target destinations to the nft sets",
+			global_stats.learn_counter);
+	}
+
+	if (cur_config != NULL && cur_config->raw_backend == RAW_BACKEND_PACKET) {
+		lginfo("Sent %ld of %ld packets through the TX ring",
+			global_stats.tx_ring_counter, global_stats.sent_counter);
+	}
+
+	if (cur_config != NULL && cur_config->verdict_cache_ttl) {
+		lginfo("Verdict cache: %ld hits, %ld misses",
+			global_stats.vcache_hits, global_stats.vcache_misses);
+	}
+
+	if (cur_config != NULL && cur_config->shed_latency_budget) {
+		lginfo("Load shedding: entered %ld times, left %ld times, "
+			"%ld packets accepted unprocessed",
+			global_stats.shed_enter_counter,
+			global_stats.shed_leave_counter,
+			global_stats.shed_counter);
+	}
+
+	if (cur_config != NULL && cur_config->queue_drop_stats) {
+		read_queue_drop_stats();
+		lginfo("Kernel queue stats: dropped %ld packets on full queue, "
+			"%ld packets failed to be delivered to userspace, "
+			"%ld ENOBUFS events",
+			global_stats.queue_dropped, global_stats.queue_user_dropped,
+			global_stats.enobufs_counter);
+	}
+
+	remove_nft_rules();
+	bpf_prefilter_detach();
+
 	exit(EXIT_SUCCESS);
 }
 
@@ -930,25 +2284,80 @@ int main(int argc, char *argv[]) {
 	signal(SIGINT, sigint_handler);
 	signal(SIGTERM, sigint_handler);
 
-	if (open_raw_socket() < 0) {
-		lgerror(-errno, "Unable to open raw socket");
+	pmtu_set_query(route_cache_path_mtu);
+
+	// Raw sockets are opened by the threads, check the permissions early
+	if (open_thread_raw_sockets() < 0) {
+		lgerr("Unable to open raw sockets");
 		exit(EXIT_FAILURE);
 	}
+	close_thread_raw_sockets();
 
-	if (config.use_ipv6) {
-		if (open_raw6_socket() < 0) {
-			lgerror(-errno, "Unable to open raw socket for ipv6");
-			close_raw_socket();
+	if (config.daemonize) {
+		daemon(0, config.noclose);
+	}
+
+	// Memory locks are not inherited by the daemon() child
+	if (config.mlockall) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			lgerror(-errno, "mlockall");
 			exit(EXIT_FAILURE);
 		}
+
+		lginfo("Process memory is locked");
 	}
 
-	if (config.daemonize) {
-		daemon(0, config.noclose);
+	struct dsched_ops dsched_ops = {
+		.thread_init = open_thread_raw_sockets,
+		.thread_exit = close_thread_raw_sockets,
+		.send = send_raw_socket,
+	};
+	if ((ret = dsched_start(&dsched_ops)) < 0) {
+		lgerror(ret, "Unable to start delay scheduler");
+		exit(EXIT_FAILURE);
 	}
 
 	struct queue_res *qres = &defqres;
 
+	if (config.bpf_prefilter_iface[0] != '\0') {
+		ret = bpf_prefilter_attach(config.bpf_prefilter_iface,
+			     config.bpf_prefilter_mark);
+		if (ret < 0) {
+			lgerr("Make sure the kernel supports BPF and clsact qdisc");
+			defqres.status = ret;
+			goto close_sched;
+		}
+
+		lginfo("BPF prefilter attached to %s ingress, mark %u",
+			config.bpf_prefilter_iface, config.bpf_prefilter_mark);
+	}
+
+	if (config.nft_rules && (ret = install_nft_rules(&config)) < 0) {
+		defqres.status = ret;
+		goto close_sched;
+	}
+
+	vcache_set_ttl(config.verdict_cache_ttl);
+
+	if (config.dns_queue_num >= 0) {
+		pthread_t dns_thread;
+
+		if ((ret = pthread_create(&dns_thread, NULL,
+				dns_queue_wrapper, NULL)) != 0) {
+			lgerror(-ret, "Unable to start DNS queue thread");
+			defqres.status = -ret;
+			goto close_sched;
+		}
+		pthread_detach(dns_thread);
+	}
+
+	threads_reses = calloc(config.threads, sizeof(struct queue_res));
+	if (threads_reses == NULL) {
+		lgerror(-ENOMEM, "Allocation error");
+		defqres.status = -ENOMEM;
+		goto close_sched;
+	}
+
 	if (config.threads == 1) {
 		struct queue_conf tconf = {
 			.i = 0,
@@ -957,10 +2366,21 @@ int main(int argc, char *argv[]) {
 
 		qres = init_queue_wrapper(&tconf);
 	} else {
-		lginfo("%d threads wil be used", config.threads);
+		lginfo("%d threads wil be used, queue num %d-%d", config.threads,
+			config.queue_start_num,
+			config.queue_start_num + config.threads - 1);
+
+		struct queue_conf *thread_confs =
+			calloc(config.threads, sizeof(struct queue_conf));
+		pthread_t *threads = calloc(config.threads, sizeof(pthread_t));
+		if (thread_confs == NULL || threads == NULL) {
+			lgerror(-ENOMEM, "Allocation error");
+			free(thread_confs);
+			free(threads);
+			qres->status = -ENOMEM;
+			goto close_sched;
+		}
 
-		struct queue_conf thread_confs[MAX_THREADS];
-		pthread_t threads[MAX_THREADS];
 		for (int i = 0; i < config.threads; i++) {
 			struct queue_conf *tconf = thread_confs + i;
 			pthread_t *thr = threads + i;
@@ -977,12 +2397,19 @@ int main(int argc, char *argv[]) {
 
 			qres = res;
 		}
+
+		free(thread_confs);
+		free(threads);
 	}
 
-	close_raw_socket();
-	if (config.use_ipv6)
-		close_raw6_socket();
+close_sched:
+	remove_nft_rules();
+	bpf_prefilter_detach();
+	dsched_stop();
 
-	return -qres->status;
+	ret = -qres->status;
+	free(threads_reses);
+
+	return ret;
 }
 
@@ -0,0 +1,159 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include <sys/socket.h>
+
+#include "config.h"
+#include "args.h"
+#include "dns.h"
+
+TEST_GROUP(DnsTest);
+
+TEST_SETUP(DnsTest)
+{
+}
+
+TEST_TEAR_DOWN(DnsTest)
+{
+}
+
+/**
+ * www.YouTube.com CNAME youtube-ui.l.google.com
+ * youtube-ui.l.google.com A 142.250.1.2
+ * youtube-ui.l.google.com AAAA 2a00:1450::1
+ */
+static const uint8_t dns_response[] =
+	"\x12\x34\x81\x80\x00\x01\x00\x03\x00\x00\x00\x00"
+	// Question at 12, com at 24
+	"\x03www\x07YouTube\x03" "com\x00" "\x00\x01\x00\x01"
+	// CNAME, the target name at 45
+	"\xc0\x0c\x00\x05\x00\x01\x00\x00\x01\x2c\x00\x16"
+	"\x0ayoutube-ui\x01l\x06google\xc0\x18"
+	"\xc0\x2d\x00\x01\x00\x01\x00\x00\x00\x3c\x00\x04"
+	"\x8e\xfa\x01\x02"
+	"\xc0\x2d\x00\x1c\x00\x01\x00\x00\x00\x78\x00\x10"
+	"\x2a\x00\x14\x50\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01";
+
+TEST(DnsTest, Test_parse_response)
+{
+	struct dns_response resp;
+	const uint8_t a4[] = {142, 250, 1, 2};
+	const uint8_t a6[] = {0x2a, 0x00, 0x14, 0x50, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 1};
+	int ret;
+
+	ret = dns_parse_response(dns_response, sizeof(dns_response) - 1, &resp);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_EQUAL_STRING("www.youtube.com", resp.qname);
+	TEST_ASSERT_EQUAL(15, resp.qname_len);
+	TEST_ASSERT_EQUAL(2, resp.answers_len);
+
+	TEST_ASSERT_EQUAL(AF_INET, resp.answers[0].family);
+	TEST_ASSERT_EQUAL_MEMORY(a4, resp.answers[0].addr, sizeof(a4));
+	TEST_ASSERT_EQUAL(60, resp.answers[0].ttl);
+
+	TEST_ASSERT_EQUAL(AF_INET6, resp.answers[1].family);
+	TEST_ASSERT_EQUAL_MEMORY(a6, resp.answers[1].addr, sizeof(a6));
+	TEST_ASSERT_EQUAL(120, resp.answers[1].ttl);
+}
+
+TEST(DnsTest, Test_drop_family)
+{
+	struct dns_response resp;
+	int ret;
+
+	ret = dns_parse_response(dns_response, sizeof(dns_response) - 1, &resp);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_EQUAL(1, dns_drop_family(&resp, AF_INET6));
+	TEST_ASSERT_EQUAL(1, resp.answers_len);
+	TEST_ASSERT_EQUAL(AF_INET, resp.answers[0].family);
+	TEST_ASSERT_EQUAL(60, resp.answers[0].ttl);
+
+	TEST_ASSERT_EQUAL(0, dns_drop_family(&resp, AF_INET));
+	TEST_ASSERT_EQUAL(0, resp.answers_len);
+}
+
+TEST(DnsTest, Test_malformed_response)
+{
+	struct dns_response resp;
+	uint8_t msg[sizeof(dns_response) - 1];
+	int ret;
+
+	// Truncated in the last answer
+	ret = dns_parse_response(dns_response, sizeof(dns_response) - 5, &resp);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+
+	// Query
+	memcpy(msg, dns_response, sizeof(msg));
+	msg[2] = 0x01;
+	msg[3] = 0x00;
+	ret = dns_parse_response(msg, sizeof(msg), &resp);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+
+	// Question name points to itself
+	memcpy(msg, dns_response, sizeof(msg));
+	msg[12] = 0xc0;
+	msg[13] = 0x0c;
+	ret = dns_parse_response(msg, sizeof(msg), &resp);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+}
+
+TEST(DnsTest, Test_name_is_target)
+{
+	struct config_t config;
+	char *argv[] = {"youtubeUnblock", "--silent",
+		"--exclude-domains=music.youtube.com"};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_TRUE(dns_name_is_target(config.first_section,
+		"www.youtube.com", 15));
+	TEST_ASSERT_FALSE(dns_name_is_target(config.first_section,
+		"example.com", 11));
+	TEST_ASSERT_FALSE(dns_name_is_target(config.first_section,
+		"music.youtube.com", 17));
+
+	free_config(&config);
+}
+
+TEST(DnsTest, Test_name_is_target_suffix_matcher)
+{
+	struct config_t config;
+	char *argv[] = {"youtubeUnblock", "--silent", "--sni-matcher=suffix",
+		"--sni-domains=youtube.com,googlevideo.com",
+		"--exclude-domains=music.youtube.com"};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_EQUAL(SNI_MATCHER_SUFFIX, config.first_section->sni_matcher);
+	TEST_ASSERT_NULL(config.first_section->sni_domains.vx);
+
+	TEST_ASSERT_TRUE(dns_name_is_target(config.first_section,
+		"www.youtube.com", 15));
+	TEST_ASSERT_TRUE(dns_name_is_target(config.first_section,
+		"rr1.googlevideo.com", 19));
+	TEST_ASSERT_FALSE(dns_name_is_target(config.first_section,
+		"notyoutube.com", 14));
+	TEST_ASSERT_FALSE(dns_name_is_target(config.first_section,
+		"music.youtube.com", 17));
+	TEST_ASSERT_TRUE(dns_name_is_target(config.first_section,
+		"xmusic.youtube.com", 18));
+
+	free_config(&config);
+}
+
+TEST_GROUP_RUNNER(DnsTest)
+{
+	RUN_TEST_CASE(DnsTest, Test_parse_response);
+	RUN_TEST_CASE(DnsTest, Test_drop_family);
+	RUN_TEST_CASE(DnsTest, Test_malformed_response);
+	RUN_TEST_CASE(DnsTest, Test_name_is_target);
+	RUN_TEST_CASE(DnsTest, Test_name_is_target_suffix_matcher);
+}
@@ -4,6 +4,8 @@
 struct instance_config_t instance_config = {
 	.send_raw_packet = NULL,
 	.send_delayed_packet = NULL,
+	.begin_raw_batch = NULL,
+	.flush_raw_batch = NULL,
 };
 
 static void RunAllTests(void)
@@ -11,6 +13,13 @@ static void RunAllTests(void)
 	RUN_TEST_GROUP(TLSTest)
 	RUN_TEST_GROUP(QuicTest);
 	RUN_TEST_GROUP(TrieTest);
+	RUN_TEST_GROUP(SuffixSetTest);
+	RUN_TEST_GROUP(NftTest);
+	RUN_TEST_GROUP(DnsTest);
+	RUN_TEST_GROUP(VerdictCacheTest);
+	RUN_TEST_GROUP(ShedTest);
+	RUN_TEST_GROUP(PmtuTest);
+	RUN_TEST_GROUP(UtilsTest);
 }
 
 int main(int argc, const char * argv[])
@@ -0,0 +1,191 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include "config.h"
+#include "args.h"
+#include "nft.h"
+
+TEST_GROUP(NftTest);
+
+TEST_SETUP(NftTest)
+{
+}
+
+TEST_TEAR_DOWN(NftTest)
+{
+}
+
+TEST(NftTest, Test_ranges_merge)
+{
+	struct dport_range ranges[] = {
+		{8443, 8443},
+		{100, 200},
+		{443, 443},
+		{150, 300},
+		{301, 310},
+		{442, 442},
+		{1000, 65535},
+		{2000, 3000},
+	};
+	int len;
+
+	len = nft_merge_port_ranges(ranges, sizeof(ranges) / sizeof(*ranges));
+	TEST_ASSERT_EQUAL(3, len);
+	TEST_ASSERT_EQUAL(100, ranges[0].start);
+	TEST_ASSERT_EQUAL(310, ranges[0].end);
+	TEST_ASSERT_EQUAL(442, ranges[1].start);
+	TEST_ASSERT_EQUAL(443, ranges[1].end);
+	TEST_ASSERT_EQUAL(1000, ranges[2].start);
+	TEST_ASSERT_EQUAL(65535, ranges[2].end);
+
+	TEST_ASSERT_EQUAL(0, nft_merge_port_ranges(ranges, 0));
+}
+
+TEST(NftTest, Test_default_config_compiles)
+{
+	struct config_t config;
+	struct nft_ruleset rs;
+	char *argv[] = {"youtubeUnblock", "--silent"};
+	int ret;
+
+	ret = yparse_args(&config, 2, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = nft_ruleset_compile(&config, &rs);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_TRUE(rs.tcp.enabled);
+	TEST_ASSERT_EQUAL(1, rs.tcp.ports_len);
+	TEST_ASSERT_EQUAL(443, rs.tcp.ports[0].start);
+	TEST_ASSERT_EQUAL(443, rs.tcp.ports[0].end);
+	TEST_ASSERT_EQUAL(config.connbytes_limit, rs.tcp.packets_limit);
+	// QUIC filtering is disabled by default
+	TEST_ASSERT_FALSE(rs.udp.enabled);
+	TEST_ASSERT_EQUAL(config.queue_start_num, rs.queue_start_num);
+	TEST_ASSERT_EQUAL(config.threads, rs.queue_total);
+
+	nft_ruleset_destroy(&rs);
+	free_config(&config);
+}
+
+TEST(NftTest, Test_sections_merge)
+{
+	struct config_t config;
+	struct nft_ruleset rs;
+	char *argv[] = {"youtubeUnblock", "--silent", "--threads=4",
+		"--fbegin", "--tcp-dport-filter=8443,400-500", "--fend",
+		"--fbegin", "--tls=disabled", "--udp-filter-quic=all",
+		"--udp-dport-filter=3478-3480", "--fend",
+	};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = nft_ruleset_compile(&config, &rs);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	// Default section 443 is merged into 400-500
+	TEST_ASSERT_TRUE(rs.tcp.enabled);
+	TEST_ASSERT_EQUAL(2, rs.tcp.ports_len);
+	TEST_ASSERT_EQUAL(400, rs.tcp.ports[0].start);
+	TEST_ASSERT_EQUAL(500, rs.tcp.ports[0].end);
+	TEST_ASSERT_EQUAL(8443, rs.tcp.ports[1].start);
+	TEST_ASSERT_EQUAL(8443, rs.tcp.ports[1].end);
+
+	TEST_ASSERT_TRUE(rs.udp.enabled);
+	TEST_ASSERT_EQUAL(2, rs.udp.ports_len);
+	TEST_ASSERT_EQUAL(443, rs.udp.ports[0].start);
+	TEST_ASSERT_EQUAL(3478, rs.udp.ports[1].start);
+	TEST_ASSERT_EQUAL(3480, rs.udp.ports[1].end);
+	// Not only QUIC, so the full limit is used
+	TEST_ASSERT_EQUAL(config.connbytes_limit, rs.udp.packets_limit);
+	TEST_ASSERT_EQUAL(4, rs.queue_total);
+
+	nft_ruleset_destroy(&rs);
+	free_config(&config);
+}
+
+TEST(NftTest, Test_quic_packets_limit)
+{
+	struct config_t config;
+	struct nft_ruleset rs;
+	char *argv[] = {"youtubeUnblock", "--silent", "--udp-filter-quic=parse",
+		"--no-dport-filter"};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = nft_ruleset_compile(&config, &rs);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	// Any port
+	TEST_ASSERT_EQUAL(1, rs.udp.ports_len);
+	TEST_ASSERT_EQUAL(0, rs.udp.ports[0].start);
+	TEST_ASSERT_EQUAL(65535, rs.udp.ports[0].end);
+	TEST_ASSERT_EQUAL(NFT_QUIC_PACKETS_LIMIT, rs.udp.packets_limit);
+
+	nft_ruleset_destroy(&rs);
+	free_config(&config);
+}
+
+TEST(NftTest, Test_prefilter_mark)
+{
+	struct config_t config;
+	struct nft_ruleset rs;
+	char *argv[] = {"youtubeUnblock", "--silent", "--udp-filter-quic=parse",
+		"--bpf-prefilter=lo", "--bpf-prefilter-mark=256",
+		"--fbegin", "--synfake=1", "--fend",
+	};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = nft_ruleset_compile(&config, &rs);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	// SYN packets are not marked by the prefilter
+	TEST_ASSERT_EQUAL(0, rs.tcp.prefilter_mark);
+	TEST_ASSERT_EQUAL(256, rs.udp.prefilter_mark);
+
+	nft_ruleset_destroy(&rs);
+	free_config(&config);
+}
+
+TEST(NftTest, Test_learn_targets)
+{
+	struct config_t config;
+	struct nft_ruleset rs;
+	char *argv[] = {"youtubeUnblock", "--silent", "--nft-rules",
+		"--nft-learn-targets=300", "--nft-targets-only",
+		"--dns-queue-num=600"};
+	int argc = sizeof(argv) / sizeof(*argv);
+	int ret;
+
+	ret = yparse_args(&config, argc, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = nft_ruleset_compile(&config, &rs);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_EQUAL(300, rs.learn_timeout);
+	TEST_ASSERT_TRUE(rs.targets_only);
+
+	nft_ruleset_destroy(&rs);
+	free_config(&config);
+}
+
+TEST_GROUP_RUNNER(NftTest)
+{
+	RUN_TEST_CASE(NftTest, Test_ranges_merge);
+	RUN_TEST_CASE(NftTest, Test_default_config_compiles);
+	RUN_TEST_CASE(NftTest, Test_sections_merge);
+	RUN_TEST_CASE(NftTest, Test_quic_packets_limit);
+	RUN_TEST_CASE(NftTest, Test_prefilter_mark);
+	RUN_TEST_CASE(NftTest, Test_learn_targets);
+}
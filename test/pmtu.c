@@ -0,0 +1,117 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "pmtu.h"
+
+TEST_GROUP(PmtuTest);
+
+static unsigned int stub_mtu;
+static int stub_ret;
+static int stub_family;
+static uint8_t stub_addr[16];
+
+static int stub_query(int family, const uint8_t *addr, unsigned int *mtu)
+{
+	stub_family = family;
+	memcpy(stub_addr, addr, family == AF_INET ? 4 : 16);
+	*mtu = stub_mtu;
+	return stub_ret;
+}
+
+static uint8_t pkt4[2000];
+static uint8_t pkt6[2000];
+
+TEST_SETUP(PmtuTest)
+{
+	struct iphdr *iph = (struct iphdr *)pkt4;
+	struct ip6_hdr *ip6h = (struct ip6_hdr *)pkt6;
+
+	*iph = (struct iphdr){
+		.version = 4,
+		.ihl = 5,
+		.protocol = IPPROTO_TCP,
+		.daddr = htonl(0x8efa0102),
+	};
+	*ip6h = (struct ip6_hdr){0};
+	ip6h->ip6_vfc = 6 << 4;
+	ip6h->ip6_nxt = IPPROTO_TCP;
+	ip6h->ip6_dst.s6_addr[0] = 0x2a;
+	ip6h->ip6_dst.s6_addr[15] = 1;
+
+	stub_mtu = 1500;
+	stub_ret = 0;
+	stub_family = 0;
+	pmtu_set_query(stub_query);
+}
+
+TEST_TEAR_DOWN(PmtuTest)
+{
+	pmtu_set_query(NULL);
+}
+
+TEST(PmtuTest, Test_route_mtu)
+{
+	const uint8_t daddr[] = {142, 250, 1, 2};
+
+	TEST_ASSERT_EQUAL(1500, pmtu_get(pkt4, sizeof(pkt4)));
+	TEST_ASSERT_EQUAL(AF_INET, stub_family);
+	TEST_ASSERT_EQUAL_MEMORY(daddr, stub_addr, sizeof(daddr));
+
+	TEST_ASSERT_EQUAL(1500, pmtu_get(pkt6, sizeof(pkt6)));
+	TEST_ASSERT_EQUAL(AF_INET6, stub_family);
+	TEST_ASSERT_EQUAL_MEMORY(&((struct ip6_hdr *)pkt6)->ip6_dst,
+		stub_addr, 16);
+}
+
+TEST(PmtuTest, Test_clamp)
+{
+	stub_mtu = 65536;
+	TEST_ASSERT_EQUAL(MAX_SEND_MTU, pmtu_get(pkt4, sizeof(pkt4)));
+
+	stub_mtu = 100;
+	TEST_ASSERT_EQUAL(576, pmtu_get(pkt4, sizeof(pkt4)));
+	TEST_ASSERT_EQUAL(1280, pmtu_get(pkt6, sizeof(pkt6)));
+}
+
+TEST(PmtuTest, Test_unknown_route)
+{
+	stub_ret = -ENETUNREACH;
+	TEST_ASSERT_EQUAL(AVAILABLE_MTU, pmtu_get(pkt4, sizeof(pkt4)));
+
+	// Not an IP packet, the query is not asked
+	stub_ret = 0;
+	stub_family = 0;
+	pkt4[0] = 0x50;
+	TEST_ASSERT_EQUAL(AVAILABLE_MTU, pmtu_get(pkt4, sizeof(pkt4)));
+	TEST_ASSERT_EQUAL(0, stub_family);
+
+	pmtu_set_query(NULL);
+	TEST_ASSERT_EQUAL(AVAILABLE_MTU, pmtu_get(pkt6, sizeof(pkt6)));
+}
+
+TEST(PmtuTest, Test_segment_len)
+{
+	stub_mtu = 1492;
+	TEST_ASSERT_EQUAL(0, pmtu_segment_len(pkt4, 1492));
+	TEST_ASSERT_EQUAL(1492, pmtu_segment_len(pkt4, 1493));
+
+	// Large route MTU does not let the packets over MAX_SEND_MTU
+	stub_mtu = 65536;
+	TEST_ASSERT_EQUAL(0, pmtu_segment_len(pkt6, sizeof(pkt6)));
+
+	stub_ret = -ENODEV;
+	TEST_ASSERT_EQUAL(AVAILABLE_MTU, pmtu_segment_len(pkt6, sizeof(pkt6)));
+}
+
+TEST_GROUP_RUNNER(PmtuTest)
+{
+	RUN_TEST_CASE(PmtuTest, Test_route_mtu);
+	RUN_TEST_CASE(PmtuTest, Test_clamp);
+	RUN_TEST_CASE(PmtuTest, Test_unknown_route);
+	RUN_TEST_CASE(PmtuTest, Test_segment_len);
+}
@@ -0,0 +1,136 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include "shed.h"
+
+TEST_GROUP(ShedTest);
+
+#define BUDGET 1000
+
+static struct shed_state state;
+
+TEST_SETUP(ShedTest)
+{
+	state = (struct shed_state){0};
+}
+
+TEST_TEAR_DOWN(ShedTest)
+{
+}
+
+/**
+ * Batch drained at 1 byte per microsecond, so the backlog in bytes
+ * is the queue wait in microseconds.
+ */
+static struct shed_batch batch(int msgs_len, size_t backlog)
+{
+	return (struct shed_batch){
+		.msgs_len = msgs_len,
+		.bytes = 1000,
+		.backlog = backlog,
+		.busy_nsec = 1000000,
+	};
+}
+
+/**
+ * Runs the same batch n times, returns the number of transitions.
+ */
+static int run(const struct shed_batch *b, int recv_batch, int n)
+{
+	int transitions = 0;
+
+	for (int i = 0; i < n; i++) {
+		if (shed_update(&state, b, BUDGET, recv_batch) != SHED_KEEP)
+			++transitions;
+	}
+
+	return transitions;
+}
+
+TEST(ShedTest, Test_disabled)
+{
+	struct shed_batch b = batch(1, 100000);
+
+	TEST_ASSERT_EQUAL(SHED_KEEP, shed_update(&state, &b, 0, 1));
+	TEST_ASSERT_FALSE(state.active);
+}
+
+TEST(ShedTest, Test_enter_by_backlog)
+{
+	struct shed_batch idle = batch(1, 0);
+	struct shed_batch busy = batch(1, 20000);
+
+	TEST_ASSERT_EQUAL(0, run(&idle, 1, 100));
+	TEST_ASSERT_FALSE(state.active);
+
+	TEST_ASSERT_EQUAL(SHED_ENTER, shed_update(&state, &busy, BUDGET, 1));
+	TEST_ASSERT_TRUE(state.active);
+	TEST_ASSERT_GREATER_THAN(BUDGET, shed_delay(&state));
+}
+
+TEST(ShedTest, Test_leave_hysteresis)
+{
+	struct shed_batch busy = batch(1, 20000);
+	struct shed_batch moderate = batch(1, 700);
+	struct shed_batch idle = batch(1, 0);
+
+	TEST_ASSERT_EQUAL(1, run(&busy, 1, 10));
+	TEST_ASSERT_TRUE(state.active);
+
+	// Under the budget, but over the half of it
+	TEST_ASSERT_EQUAL(0, run(&moderate, 1, 100));
+	TEST_ASSERT_TRUE(state.active);
+
+	TEST_ASSERT_EQUAL(1, run(&idle, 1, 100));
+	TEST_ASSERT_FALSE(state.active);
+	TEST_ASSERT_LESS_THAN(BUDGET / 2, shed_delay(&state));
+
+	// Not entered again until the budget is exceeded
+	TEST_ASSERT_EQUAL(0, run(&moderate, 1, 100));
+	TEST_ASSERT_FALSE(state.active);
+}
+
+TEST(ShedTest, Test_full_reads_hold)
+{
+	struct shed_batch busy = batch(32, 20000);
+	struct shed_batch full = batch(32, 0);
+	struct shed_batch sparse = batch(4, 0);
+
+	TEST_ASSERT_EQUAL(1, run(&busy, 32, 10));
+	TEST_ASSERT_TRUE(state.active);
+
+	// The backlog is gone, but every read fills the batch
+	TEST_ASSERT_EQUAL(0, run(&full, 32, 100));
+	TEST_ASSERT_TRUE(state.active);
+	TEST_ASSERT_LESS_THAN(BUDGET / 2, shed_delay(&state));
+
+	TEST_ASSERT_EQUAL(1, run(&sparse, 32, 100));
+	TEST_ASSERT_FALSE(state.active);
+}
+
+TEST(ShedTest, Test_timestamps)
+{
+	struct shed_batch idle = batch(1, 0);
+
+	shed_sample_latency(&state, -5);
+	shed_sample_latency(&state, SHED_MAX_SAMPLE + 1);
+	TEST_ASSERT_EQUAL(0, state.latency_samples);
+
+	for (int i = 0; i < 10; i++) {
+		shed_sample_latency(&state, 20000);
+	}
+	TEST_ASSERT_EQUAL(SHED_ENTER, shed_update(&state, &idle, BUDGET, 1));
+
+	// The latency fades out when no timestamps come
+	TEST_ASSERT_EQUAL(1, run(&idle, 1, 100));
+	TEST_ASSERT_FALSE(state.active);
+}
+
+TEST_GROUP_RUNNER(ShedTest)
+{
+	RUN_TEST_CASE(ShedTest, Test_disabled);
+	RUN_TEST_CASE(ShedTest, Test_enter_by_backlog);
+	RUN_TEST_CASE(ShedTest, Test_leave_hysteresis);
+	RUN_TEST_CASE(ShedTest, Test_full_reads_hold);
+	RUN_TEST_CASE(ShedTest, Test_timestamps);
+}
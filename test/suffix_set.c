@@ -0,0 +1,159 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include "suffix_set.h"
+#include "trie.h"
+
+TEST_GROUP(SuffixSetTest);
+
+TEST_SETUP(SuffixSetTest)
+{
+}
+
+TEST_TEAR_DOWN(SuffixSetTest)
+{
+}
+
+#define MATCH(set, name, offset, offlen) \
+	suffix_set_match(set, (const uint8_t *)name, sizeof(name) - 1, \
+		offset, offlen)
+
+TEST(SuffixSetTest, Test_label_boundaries)
+{
+	struct suffix_set set;
+	size_t offset, offlen;
+	int ret;
+
+	ret = suffix_set_init(&set);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = suffix_set_add(&set, (const uint8_t *)"youtube.com", 11);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = suffix_set_add(&set, (const uint8_t *)"l.google.com", 12);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "youtube.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, offset);
+	TEST_ASSERT_EQUAL(11, offlen);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "www.youtube.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(4, offset);
+	TEST_ASSERT_EQUAL(11, offlen);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "a.b.l.google.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(4, offset);
+
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "notyoutube.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "youtube.com.ru", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "google.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "xl.google.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "", &offset, &offlen));
+
+	suffix_set_destroy(&set);
+}
+
+TEST(SuffixSetTest, Test_longest_match)
+{
+	struct suffix_set set;
+	size_t offset, offlen;
+	int ret;
+
+	ret = suffix_set_init(&set);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = suffix_set_add(&set, (const uint8_t *)"com", 3);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = suffix_set_add(&set, (const uint8_t *)"youtube.com", 11);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = suffix_set_add(&set, (const uint8_t *)"youtube.com", 11);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_EQUAL(2, set.len);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "m.youtube.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(2, offset);
+	TEST_ASSERT_EQUAL(11, offlen);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "example.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(8, offset);
+	TEST_ASSERT_EQUAL(3, offlen);
+
+	suffix_set_destroy(&set);
+}
+
+TEST(SuffixSetTest, Test_grows)
+{
+	struct suffix_set set;
+	size_t offset, offlen;
+	char name[32];
+	int len;
+	int ret;
+
+	ret = suffix_set_init(&set);
+	TEST_ASSERT_EQUAL(0, ret);
+	for (int i = 0; i < 5000; i++) {
+		len = snprintf(name, sizeof(name), "d%d.example", i);
+		ret = suffix_set_add(&set, (const uint8_t *)name, len);
+		TEST_ASSERT_EQUAL(0, ret);
+	}
+	TEST_ASSERT_EQUAL(5000, set.len);
+
+	for (int i = 0; i < 5000; i++) {
+		len = snprintf(name, sizeof(name), "www.d%d.example", i);
+		ret = suffix_set_match(&set, (const uint8_t *)name, len,
+			&offset, &offlen);
+		TEST_ASSERT_EQUAL(1, ret);
+		TEST_ASSERT_EQUAL(4, offset);
+	}
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "d5000.example", &offset, &offlen));
+
+	suffix_set_destroy(&set);
+}
+
+static int collect_string(void *ctx, const uint8_t *str, size_t strlen)
+{
+	return suffix_set_add(ctx, str, strlen);
+}
+
+TEST(SuffixSetTest, Test_from_trie)
+{
+	struct trie_container trie;
+	struct suffix_set set;
+	size_t offset, offlen;
+	int ret;
+
+	ret = trie_init(&trie);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_add_string(&trie, (const uint8_t *)"youtube.com", 11);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_add_string(&trie, (const uint8_t *)"youtu.be", 8);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_add_string(&trie, (const uint8_t *)"ytimg.com", 9);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_add_string(&trie, (const uint8_t *)"you", 3);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = suffix_set_init(&set);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_foreach_string(&trie, collect_string, &set);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_EQUAL(4, set.len);
+
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "i.ytimg.com", &offset, &offlen));
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "youtu.be", &offset, &offlen));
+	TEST_ASSERT_EQUAL(1, MATCH(&set, "you", &offset, &offlen));
+	TEST_ASSERT_EQUAL(0, MATCH(&set, "youtube", &offset, &offlen));
+
+	ret = trie_finalize(&trie, TRIE_LAYOUT_FULL);
+	TEST_ASSERT_EQUAL(0, ret);
+	ret = trie_foreach_string(&trie, collect_string, &set);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+
+	trie_destroy(&trie);
+	suffix_set_destroy(&set);
+}
+
+TEST_GROUP_RUNNER(SuffixSetTest)
+{
+	RUN_TEST_CASE(SuffixSetTest, Test_label_boundaries);
+	RUN_TEST_CASE(SuffixSetTest, Test_longest_match);
+	RUN_TEST_CASE(SuffixSetTest, Test_grows);
+	RUN_TEST_CASE(SuffixSetTest, Test_from_trie);
+}
@@ -51,8 +51,40 @@ TEST(TLSTest, Test_Bruteforce_detects)
 	trie_destroy(&trie);
 }
 
+TEST(TLSTest, Test_SNI_found_once_matched_by_sections)
+{
+	struct section_config_t target_sconf = default_section_config;
+	struct section_config_t other_sconf = default_section_config;
+	struct tls_verdict sni, tlsv;
+	int ret;
+
+	trie_init(&target_sconf.sni_domains);
+	trie_add_string(&target_sconf.sni_domains, (uint8_t *)"ndev", 4);
+	trie_init(&other_sconf.sni_domains);
+	trie_add_string(&other_sconf.sni_domains, (uint8_t *)"youtube.com", 11);
+
+	ret = tls_message_find_sni((const uint8_t *)tls_chlo_message, sizeof(tls_chlo_message) - 1, &sni);
+	TEST_ASSERT_EQUAL(TLS_MESSAGE_ANALYZE_FOUND, ret);
+	TEST_ASSERT_EQUAL(0, sni.target_sni);
+	TEST_ASSERT_EQUAL_STRING_LEN("abc.defghijklm.ndev", sni.sni_ptr, 19);
+
+	tlsv = sni;
+	tls_match_sni(&other_sconf, &tlsv);
+	TEST_ASSERT_EQUAL(0, tlsv.target_sni);
+
+	tlsv = sni;
+	tls_match_sni(&target_sconf, &tlsv);
+	TEST_ASSERT_EQUAL(1, tlsv.target_sni);
+	TEST_ASSERT_EQUAL(4, tlsv.target_sni_len);
+	TEST_ASSERT_EQUAL_PTR(sni.sni_ptr + 15, tlsv.target_sni_ptr);
+
+	trie_destroy(&target_sconf.sni_domains);
+	trie_destroy(&other_sconf.sni_domains);
+}
+
 TEST_GROUP_RUNNER(TLSTest)
 {
 	RUN_TEST_CASE(TLSTest, Test_CHLO_message_detect);
 	RUN_TEST_CASE(TLSTest, Test_Bruteforce_detects);
+	RUN_TEST_CASE(TLSTest, Test_SNI_found_once_matched_by_sections);
 }
@@ -137,6 +137,253 @@ TEST(TrieTest, Trie_uninitialized)
 }
 
 
+TEST(TrieTest, Trie_finalized_finds)
+{
+	int ret;
+	size_t offset;
+	size_t offlen;
+	struct trie_container trie;
+
+	ret = trie_init(&trie);
+	ret = trie_add_string(&trie, (uint8_t *)ASTR, sizeof(ASTR) - 1);
+	ret = trie_add_string(&trie, (uint8_t *)BSTR, sizeof(BSTR) - 1);
+	ret = trie_add_string(&trie, (uint8_t *)CSTR, sizeof(CSTR) - 1);
+
+	ret = trie_finalize(&trie, TRIE_LAYOUT_FULL);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_EQUAL(1, trie.finalized);
+
+	// Read-only now
+	ret = trie_add_string(&trie, (uint8_t *)"abc", 3);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)tstr, sizeof(tstr) - 1,
+			0, &offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL(11, offlen);
+	TEST_ASSERT_EQUAL_STRING_LEN("abracadabra", tstr + offset, offlen);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)tstr, sizeof(tstr) - 1,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL(7, offlen);
+	TEST_ASSERT_EQUAL_STRING_LEN("abacaba", tstr + offset, offlen);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)tstr, sizeof(tstr),
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	trie_destroy(&trie);
+}
+
+TEST(TrieTest, Trie_output_links)
+{
+	int ret;
+	size_t offset;
+	size_t offlen;
+	struct trie_container trie;
+	const char str[] = "www.youtube.co";
+
+	ret = trie_init(&trie);
+	ret = trie_add_string(&trie, (uint8_t *)"youtube.community", 17);
+	ret = trie_add_string(&trie, (uint8_t *)"tube.co", 7);
+
+	// The longest prefix at the end is not a pattern, its suffix is
+	ret = trie_process_str(&trie,
+			(uint8_t *)str, sizeof(str) - 1,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL_STRING_LEN("tube.co", str + offset, offlen);
+
+	ret = trie_finalize(&trie, TRIE_LAYOUT_FULL);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)str, sizeof(str) - 1,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL_STRING_LEN("tube.co", str + offset, offlen);
+
+	trie_destroy(&trie);
+}
+
+TEST(TrieTest, Trie_compact_finds)
+{
+	int ret;
+	size_t offset;
+	size_t offlen;
+	struct trie_container trie;
+	const char str[] = "www.youtube.co";
+
+	ret = trie_init(&trie);
+	ret = trie_add_string(&trie, (uint8_t *)ASTR, sizeof(ASTR) - 1);
+	ret = trie_add_string(&trie, (uint8_t *)BSTR, sizeof(BSTR) - 1);
+	ret = trie_add_string(&trie, (uint8_t *)CSTR, sizeof(CSTR) - 1);
+	ret = trie_add_string(&trie, (uint8_t *)"youtube.community", 17);
+	ret = trie_add_string(&trie, (uint8_t *)"tube.co", 7);
+
+	ret = trie_finalize(&trie, TRIE_LAYOUT_COMPACT);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_EQUAL(TRIE_LAYOUT_COMPACT, trie.layout);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)tstr, sizeof(tstr) - 1,
+			0, &offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL_STRING_LEN("abracadabra", tstr + offset, offlen);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)tstr, sizeof(tstr) - 1,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL_STRING_LEN("abacaba", tstr + offset, offlen);
+
+	ret = trie_process_str(&trie,
+			(uint8_t *)str, sizeof(str) - 1,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL_STRING_LEN("tube.co", str + offset, offlen);
+
+	trie_destroy(&trie);
+}
+
+TEST(TrieTest, Trie_compact_over_nmax)
+{
+	int ret;
+	size_t offset;
+	size_t offlen;
+	struct trie_container full, compact;
+	char domain[32];
+	int len;
+
+	ret = trie_init(&full);
+	ret = trie_init(&compact);
+	for (int i = 0; i < 10000; i++) {
+		len = snprintf(domain, sizeof(domain), "d%d.example", i);
+		trie_add_string(&full, (uint8_t *)domain, len);
+		trie_add_string(&compact, (uint8_t *)domain, len);
+	}
+	TEST_ASSERT_GREATER_THAN(NMAX, compact.sz);
+
+	ret = trie_finalize(&full, TRIE_LAYOUT_FULL);
+	TEST_ASSERT_EQUAL(-E2BIG, ret);
+
+	ret = trie_finalize(&compact, TRIE_LAYOUT_COMPACT);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	ret = trie_process_str(&compact,
+			(uint8_t *)"www.d9999.example", 17,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(1, ret);
+	TEST_ASSERT_EQUAL(4, offset);
+	TEST_ASSERT_EQUAL(13, offlen);
+
+	ret = trie_process_str(&compact,
+			(uint8_t *)"d10000.example", 14,
+			TRIE_OPT_MAP_TO_END,
+			&offset, &offlen
+	);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	trie_destroy(&full);
+	trie_destroy(&compact);
+}
+
+TEST(TrieTest, Trie_prefilter_anchors)
+{
+	struct trie_container trie;
+
+	trie_init(&trie);
+	trie_add_string(&trie, (uint8_t *)"youtube.com", 11);
+	trie_add_string(&trie, (uint8_t *)"ytimg.com", 9);
+	trie_finalize(&trie, TRIE_LAYOUT_FULL);
+
+	TEST_ASSERT_EQUAL(1, trie.pf.enabled);
+	TEST_ASSERT_EQUAL(1, trie.pf.anchors_len);
+	TEST_ASSERT_EQUAL('.', trie.pf.anchors[0]);
+	TEST_ASSERT_EQUAL(0, trie.pf.follow_any);
+	TEST_ASSERT_EQUAL(11, trie.pf.maxlen);
+	trie_destroy(&trie);
+
+	trie_init(&trie);
+	trie_add_string(&trie, (uint8_t *)"ytimg.com", 9);
+	trie_add_string(&trie, (uint8_t *)"ytimg.net", 9);
+	trie_add_string(&trie, (uint8_t *)"aaa", 3);
+	trie_finalize(&trie, TRIE_LAYOUT_COMPACT);
+
+	TEST_ASSERT_EQUAL(1, trie.pf.enabled);
+	TEST_ASSERT_EQUAL(2, trie.pf.anchors_len);
+	TEST_ASSERT_EQUAL('.', trie.pf.anchors[0]);
+	TEST_ASSERT_EQUAL('a', trie.pf.anchors[1]);
+	TEST_ASSERT_EQUAL(1, trie.pf.follow_any);
+	trie_destroy(&trie);
+}
+
+TEST(TrieTest, Trie_prefilter_matches_scan)
+{
+	const char *patterns[] = {"youtube.com", "tube.co", "localhost", "l.google.com"};
+	struct trie_container trie;
+	uint8_t payload[4096];
+	size_t offset, offlen, pf_offset, pf_offlen;
+	int ret, pf_ret;
+
+	for (int layout = TRIE_LAYOUT_FULL; layout <= TRIE_LAYOUT_COMPACT; layout++) {
+		trie_init(&trie);
+		for (int i = 0; i < sizeof(patterns) / sizeof(*patterns); i++) {
+			trie_add_string(&trie, (uint8_t *)patterns[i], strlen(patterns[i]));
+		}
+		trie_finalize(&trie, layout);
+		TEST_ASSERT_EQUAL(1, trie.pf.enabled);
+
+		for (int pos = 0; pos < 64; pos++) {
+			for (int i = 0; i < sizeof(payload); i++) {
+				payload[i] = (i * 7 + pos) % 251;
+			}
+
+			// At the vector boundaries and on the end
+			const char *p = patterns[pos % 4];
+			size_t at = pos < 32 ? pos * 17 : sizeof(payload) - strlen(p) - (pos - 32);
+			memcpy(payload + at, p, strlen(p));
+
+			ret = trie_process_str(&trie, payload, sizeof(payload), 0,
+				&offset, &offlen);
+			pf_ret = trie_process_str(&trie, payload, sizeof(payload),
+				TRIE_OPT_PREFILTER, &pf_offset, &pf_offlen);
+
+			TEST_ASSERT_EQUAL(1, ret);
+			TEST_ASSERT_EQUAL(ret, pf_ret);
+			TEST_ASSERT_EQUAL(offset, pf_offset);
+			TEST_ASSERT_EQUAL(offlen, pf_offlen);
+		}
+
+		memset(payload, '.', sizeof(payload));
+		ret = trie_process_str(&trie, payload, sizeof(payload),
+			TRIE_OPT_PREFILTER, &offset, &offlen);
+		TEST_ASSERT_EQUAL(0, ret);
+
+		trie_destroy(&trie);
+	}
+}
+
 TEST_GROUP_RUNNER(TrieTest)
 {
 	RUN_TEST_CASE(TrieTest, Trie_string_adds);
@@ -144,4 +391,10 @@ TEST_GROUP_RUNNER(TrieTest)
 	RUN_TEST_CASE(TrieTest, Trie_string_finds_opt_end);
 	RUN_TEST_CASE(TrieTest, Trie_single_vertex);
 	RUN_TEST_CASE(TrieTest, Trie_uninitialized);
+	RUN_TEST_CASE(TrieTest, Trie_finalized_finds);
+	RUN_TEST_CASE(TrieTest, Trie_output_links);
+	RUN_TEST_CASE(TrieTest, Trie_compact_finds);
+	RUN_TEST_CASE(TrieTest, Trie_compact_over_nmax);
+	RUN_TEST_CASE(TrieTest, Trie_prefilter_anchors);
+	RUN_TEST_CASE(TrieTest, Trie_prefilter_matches_scan);
 }
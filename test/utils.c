@@ -0,0 +1,106 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "types.h"
+#include "utils.h"
+
+TEST_GROUP(UtilsTest);
+
+TEST_SETUP(UtilsTest)
+{
+}
+
+TEST_TEAR_DOWN(UtilsTest)
+{
+}
+
+#define SEG_PLEN 3000
+#define SEG_MAX 4
+
+static uint8_t segs[SEG_MAX][200 + 40];
+static size_t seglens[SEG_MAX];
+static int segs_len;
+
+static int collect_seg(const uint8_t *seg, size_t seglen)
+{
+	if (segs_len == SEG_MAX || seglen > sizeof(segs[0]))
+		return -ENOMEM;
+
+	memcpy(segs[segs_len], seg, seglen);
+	seglens[segs_len++] = seglen;
+
+	return seglen;
+}
+
+TEST(UtilsTest, Test_tcp_segment)
+{
+	static uint8_t pkt[40 + SEG_PLEN];
+	struct iphdr *iph = (struct iphdr *)pkt;
+	struct tcphdr *tcph = (struct tcphdr *)(pkt + 20);
+	uint8_t seg[240];
+	int ret;
+
+	memset(pkt, 0, sizeof(pkt));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_TCP;
+	iph->tot_len = htons(sizeof(pkt));
+	iph->id = htons(100);
+	iph->saddr = htonl(0xc0000202);
+	iph->daddr = htonl(0xc0000201);
+	tcph->source = htons(40000);
+	tcph->dest = htons(443);
+	tcph->seq = htonl(1000);
+	tcph->doff = 5;
+	tcph->ack = 1;
+	tcph->psh = 1;
+	tcph->fin = 1;
+	for (int i = 0; i < SEG_PLEN; i++)
+		pkt[40 + i] = i;
+
+	segs_len = 0;
+	ret = tcp_segment(pkt, sizeof(pkt), seg, sizeof(seg), collect_seg);
+	// Only SEG_MAX segments are collected
+	TEST_ASSERT_EQUAL(-ENOMEM, ret);
+	TEST_ASSERT_EQUAL(SEG_MAX, segs_len);
+
+	segs_len = 0;
+	ret = tcp_segment(pkt, 40 + 600, seg, sizeof(seg), collect_seg);
+	TEST_ASSERT_EQUAL(-EINVAL, ret);
+
+	iph->tot_len = htons(40 + 500);
+	ret = tcp_segment(pkt, 40 + 500, seg, sizeof(seg), collect_seg);
+	TEST_ASSERT_EQUAL(40 * 3 + 500, ret);
+	TEST_ASSERT_EQUAL(3, segs_len);
+
+	for (int i = 0; i < segs_len; i++) {
+		struct iphdr *siph = (struct iphdr *)segs[i];
+		struct tcphdr *stcph = (struct tcphdr *)(segs[i] + 20);
+		size_t plen = i == 2 ? 500 - 400 : 200;
+		uint16_t ip_check = siph->check;
+		uint16_t tcp_check = stcph->check;
+
+		TEST_ASSERT_EQUAL(40 + plen, seglens[i]);
+		TEST_ASSERT_EQUAL(40 + plen, ntohs(siph->tot_len));
+		TEST_ASSERT_EQUAL(100 + i, ntohs(siph->id));
+		TEST_ASSERT_EQUAL(1000 + 200 * i, ntohl(stcph->seq));
+		TEST_ASSERT_EQUAL(i == 2, stcph->fin);
+		TEST_ASSERT_EQUAL(i == 2, stcph->psh);
+		TEST_ASSERT_EQUAL(1, stcph->ack);
+		TEST_ASSERT_EQUAL_MEMORY(pkt + 40 + 200 * i, segs[i] + 40, plen);
+
+		set_ip_checksum(siph, seglens[i]);
+		set_tcp_checksum(stcph, siph, seglens[i]);
+		TEST_ASSERT_EQUAL_HEX16(ip_check, siph->check);
+		TEST_ASSERT_EQUAL_HEX16(tcp_check, stcph->check);
+	}
+}
+
+TEST_GROUP_RUNNER(UtilsTest)
+{
+	RUN_TEST_CASE(UtilsTest, Test_tcp_segment);
+}
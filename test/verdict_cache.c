@@ -0,0 +1,136 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+#include <netinet/ip.h>
+
+#include "config.h"
+#include "args.h"
+#include "verdict_cache.h"
+
+TEST_GROUP(VerdictCacheTest);
+
+static struct config_t config;
+static struct iphdr iph;
+
+TEST_SETUP(VerdictCacheTest)
+{
+	char *argv[] = {"youtubeUnblock", "--silent"};
+	int ret;
+
+	ret = yparse_args(&config, 2, argv);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	iph = (struct iphdr){
+		.version = 4,
+		.ihl = 5,
+		.protocol = IPPROTO_TCP,
+		.daddr = htonl(0x8efa0102),
+	};
+
+	vcache_set_ttl(60);
+}
+
+TEST_TEAR_DOWN(VerdictCacheTest)
+{
+	vcache_set_ttl(0);
+	vcache_thread_destroy();
+	free_config(&config);
+}
+
+// The SNI www.youtube.com at 10, the target youtube.com at 14
+static const uint8_t hello[] = "\x16\x03\x01\x00\x00\x00\x00\x00\x00\x00"
+	"www.youtube.com\x00\x00";
+
+TEST(VerdictCacheTest, Test_tls_hit)
+{
+	struct vcache_key key;
+	struct tls_verdict vrd = {
+		.sni_ptr = hello + 10,
+		.sni_len = 15,
+		.target_sni = 1,
+		.target_sni_ptr = hello + 14,
+		.target_sni_len = 11,
+	};
+	struct tls_verdict cached;
+	uint8_t next[sizeof(hello)];
+	int ret;
+
+	ret = vcache_key_build(&key, &iph, sizeof(iph), IPPROTO_TCP,
+			       htons(443), config.first_section);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_FALSE(vcache_tls_lookup(&key, hello, sizeof(hello), &cached));
+	vcache_tls_store(&key, hello, &vrd);
+
+	memcpy(next, hello, sizeof(next));
+	TEST_ASSERT_TRUE(vcache_tls_lookup(&key, next, sizeof(next), &cached));
+	TEST_ASSERT_EQUAL_PTR(next + 10, cached.sni_ptr);
+	TEST_ASSERT_EQUAL(15, cached.sni_len);
+	TEST_ASSERT_EQUAL(1, cached.target_sni);
+	TEST_ASSERT_EQUAL_PTR(next + 14, cached.target_sni_ptr);
+	TEST_ASSERT_EQUAL(11, cached.target_sni_len);
+
+	TEST_ASSERT_TRUE(vcache_target_lookup(&key));
+}
+
+TEST(VerdictCacheTest, Test_tls_miss)
+{
+	struct vcache_key key, other;
+	struct tls_verdict vrd = {
+		.sni_ptr = hello + 10,
+		.sni_len = 15,
+	};
+	struct tls_verdict cached;
+	uint8_t next[sizeof(hello)];
+	int ret;
+
+	ret = vcache_key_build(&key, &iph, sizeof(iph), IPPROTO_TCP,
+			       htons(443), config.first_section);
+	TEST_ASSERT_EQUAL(0, ret);
+	vcache_tls_store(&key, hello, &vrd);
+	TEST_ASSERT_FALSE(vcache_target_lookup(&key));
+
+	// Another SNI to the same destination
+	memcpy(next, hello, sizeof(next));
+	memcpy(next + 10, "www.example.com", 15);
+	TEST_ASSERT_FALSE(vcache_tls_lookup(&key, next, sizeof(next), &cached));
+
+	// Truncated before the SNI end
+	TEST_ASSERT_FALSE(vcache_tls_lookup(&key, hello, 20, &cached));
+
+	// Another port
+	ret = vcache_key_build(&other, &iph, sizeof(iph), IPPROTO_TCP,
+			       htons(8443), config.first_section);
+	TEST_ASSERT_EQUAL(0, ret);
+	TEST_ASSERT_FALSE(vcache_tls_lookup(&other, hello, sizeof(hello), &cached));
+
+	// Disabled
+	vcache_set_ttl(0);
+	TEST_ASSERT_FALSE(vcache_tls_lookup(&key, hello, sizeof(hello), &cached));
+}
+
+TEST(VerdictCacheTest, Test_quic)
+{
+	struct vcache_key key;
+	int ret;
+
+	iph.protocol = IPPROTO_UDP;
+	ret = vcache_key_build(&key, &iph, sizeof(iph), IPPROTO_UDP,
+			       htons(443), config.first_section);
+	TEST_ASSERT_EQUAL(0, ret);
+
+	TEST_ASSERT_FALSE(vcache_quic_lookup(&key));
+	vcache_quic_store(&key);
+	TEST_ASSERT_TRUE(vcache_quic_lookup(&key));
+
+	// TCP verdicts are kept apart
+	key.proto = IPPROTO_TCP;
+	TEST_ASSERT_FALSE(vcache_quic_lookup(&key));
+}
+
+TEST_GROUP_RUNNER(VerdictCacheTest)
+{
+	RUN_TEST_CASE(VerdictCacheTest, Test_tls_hit);
+	RUN_TEST_CASE(VerdictCacheTest, Test_tls_miss);
+	RUN_TEST_CASE(VerdictCacheTest, Test_quic);
+}
@@ -1,5 +1,7 @@
 #Check for using system libs
 USE_SYS_LIBS := no
+#Build io_uring queue backend (--io-uring)
+USE_IO_URING := no
 
 #Userspace app makes here
 BUILD_DIR := $(CURDIR)/build
@@ -33,10 +35,15 @@ export CC CCLD LD CFLAGS LDFLAGS LIBNFNETLINK_CFLAGS LIBNFNETLINK_LIBS LIBMNL_CF
 
 APP:=$(BUILD_DIR)/youtubeUnblock
 TEST_APP:=$(BUILD_DIR)/testYoutubeUnblock
+BENCH_APP:=$(BUILD_DIR)/trieBench
 
-SRCS := mangle.c args.c utils.c quic.c tls.c getopt.c quic_crypto.c inet_ntop.c trie.c dpi.c
+SRCS := mangle.c args.c utils.c quic.c tls.c getopt.c quic_crypto.c inet_ntop.c trie.c suffix_set.c dpi.c nft.c dns.c verdict_cache.c shed.c pmtu.c
 OBJS := $(SRCS:%.c=$(BUILD_DIR)/%.o)
-APP_EXEC := youtubeUnblock.c 
+APP_EXEC := youtubeUnblock.c delay_scheduler.c bpf_prefilter.c tx_ring.c route_cache.c
+ifeq ($(USE_IO_URING), yes)
+	override CFLAGS += -DUSE_IO_URING
+	APP_EXEC += uring.c
+endif
 APP_OBJ := $(APP_EXEC:%.c=$(BUILD_DIR)/%.o)
 
 
@@ -49,7 +56,7 @@ LIBMNL := $(DEPSDIR)/lib/libmnl.la
 LIBNETFILTER_QUEUE := $(DEPSDIR)/lib/libnetfilter_queue.la
 LIBCYCLONE := $(DEPSDIR)/lib/libcyclone.a
 
-.PHONY: default all test build_test dev dev_attrs prepare_dirs
+.PHONY: default all test build_test bench dev dev_attrs prepare_dirs
 default: all
 
 run_dev: dev
@@ -66,11 +73,15 @@ build_test: prepare_dirs $(TEST_APP)
 test: build_test
 	$(TEST_APP)
 
+bench: prepare_dirs $(BENCH_APP)
+	$(BENCH_APP)
+
 prepare_dirs:
 	mkdir -p $(BUILD_DIR)
 	mkdir -p $(BUILD_DIR)/crypto
 	mkdir -p $(BUILD_DIR)/test
 	mkdir -p $(BUILD_DIR)/test/unity
+	mkdir -p $(BUILD_DIR)/bench
 	mkdir -p $(DEPSDIR)
 
 $(LIBCYCLONE):
@@ -101,10 +112,18 @@ $(TEST_APP): $(APP) $(TEST_OBJS) $(REQ) $(LIBCYCLONE)
 	@echo 'CCLD $(TEST_APP)'
 	$(CCLD) $(OBJS) $(TEST_OBJS) -o $(TEST_APP) $(LDFLAGS) -lmnl -lnetfilter_queue -lpthread -lcyclone
 
+$(BENCH_APP): $(BUILD_DIR)/trie.o $(BUILD_DIR)/bench/trie.o
+	@echo 'CCLD $(BENCH_APP)'
+	$(CCLD) $^ -o $(BENCH_APP) $(LDFLAGS)
+
 $(BUILD_DIR)/%.o: src/%.c $(REQ) $(INCLUDE_DIR)/config.h
 	@echo 'CC $@'
 	$(CC) -c $(CFLAGS) $(LDFLAGS) $< -o $@
 
+$(BUILD_DIR)/bench/%.o: bench/%.c $(INCLUDE_DIR)/trie.h
+	@echo 'CC $@'
+	$(CC) -c $(CFLAGS) -O2 $< -o $@
+
 $(BUILD_DIR)/test/%.o: test/%.c $(REQ) $(INCLUDE_DIR)/config.h
 	@echo 'CC $@'
 	$(CC) -c $(CFLAGS) $(LDFLAGS) $(TEST_CFLAGS) $< -o $@